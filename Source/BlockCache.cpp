@@ -0,0 +1,111 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "BlockCache.h"
+
+BlockCache::BlockCache() :
+	budget(int64_t(64) << 20)
+{
+	clear();
+}
+
+void BlockCache::setBudget(int64_t bytes)
+{
+	budget = bytes > 0 ? bytes : 0;
+
+	while (!blocks.empty() && statistics.bytes > budget)
+		evict();
+}
+
+const int16_t* BlockCache::find(const Key& key)
+{
+	auto it = lookup.find(key);
+
+	if (it == lookup.end())
+	{
+		statistics.misses++;
+		return nullptr;
+	}
+
+	statistics.hits++;
+
+	blocks.splice(blocks.begin(), blocks, it->second);
+
+	return it->second->samples.data();
+}
+
+int16_t* BlockCache::insert(const Key& key, size_t numValues)
+{
+	const int64_t bytes = int64_t(numValues * sizeof(int16_t));
+
+	if (bytes > budget || lookup.count(key))
+		return nullptr;
+
+	while (!blocks.empty() && statistics.bytes + bytes > budget)
+		evict();
+
+	blocks.push_front(Block());
+	blocks.front().key = key;
+	blocks.front().samples.resize(numValues);
+
+	lookup[key] = blocks.begin();
+	statistics.bytes += bytes;
+
+	return blocks.front().samples.data();
+}
+
+void BlockCache::evict()
+{
+	const Block& last = blocks.back();
+
+	statistics.bytes -= int64_t(last.samples.size() * sizeof(int16_t));
+	statistics.evictions++;
+
+	lookup.erase(last.key);
+	blocks.pop_back();
+}
+
+void BlockCache::clear()
+{
+	blocks.clear();
+	lookup.clear();
+
+	statistics.hits = 0;
+	statistics.misses = 0;
+	statistics.evictions = 0;
+	statistics.bytes = 0;
+}
+
+uint64_t BlockCache::hashChannels(const int* channels, int numChannels)
+{
+	// FNV-1a over the channel indices, in order
+	uint64_t hash = 14695981039346656037ull ^ uint64_t(numChannels);
+
+	for (int i = 0; i < numChannels; i++)
+	{
+		hash ^= uint64_t(uint32_t(channels[i]));
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
@@ -0,0 +1,120 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BLOCKCACHE_H_DEFINED
+#define BLOCKCACHE_H_DEFINED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/**
+	Least-recently-used cache of decoded, interleaved records, within a byte budget.
+
+	Each block holds one record (1024 samples) of a set of channels of a stream, in the
+	layout the File Source returns from readData, so looped playback decodes every
+	record once and then copies it from memory.
+*/
+class BlockCache
+{
+public:
+
+	/** Identifies a block: a record of a stream, decoded for one set of channels */
+	struct Key
+	{
+		int stream;
+		int64_t record;
+		uint64_t channelSet;
+
+		bool operator==(const Key& other) const
+		{
+			return stream == other.stream && record == other.record && channelSet == other.channelSet;
+		}
+	};
+
+	/** Counters since the last call to clear() */
+	struct Statistics
+	{
+		int64_t hits;
+		int64_t misses;
+		int64_t evictions;
+		int64_t bytes;
+	};
+
+	/** Constructor */
+	BlockCache();
+
+	/** Sets the maximum number of bytes of cached samples, evicting blocks if needed (0 disables the cache) */
+	void setBudget(int64_t bytes);
+
+	/** Returns the maximum number of bytes of cached samples */
+	int64_t getBudget() const { return budget; }
+
+	/** Returns a cached block (and marks it as the most recently used), or nullptr */
+	const int16_t* find(const Key& key);
+
+	/** Adds a block of numValues samples for the caller to fill, evicting the least recently used ones
+		to make room. Returns nullptr if the block doesn't fit in the budget. */
+	int16_t* insert(const Key& key, size_t numValues);
+
+	/** Drops all blocks and resets the statistics */
+	void clear();
+
+	/** Returns the cache counters */
+	Statistics getStatistics() const { return statistics; }
+
+	/** Hash of a list of channel indices, for Key::channelSet */
+	static uint64_t hashChannels(const int* channels, int numChannels);
+
+private:
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			return (size_t) (key.channelSet ^ (uint64_t(key.record) * 0x9e3779b97f4a7c15ull) ^ uint64_t(key.stream));
+		}
+	};
+
+	struct Block
+	{
+		Key key;
+		std::vector<int16_t> samples;
+	};
+
+	/** Removes the least recently used block */
+	void evict();
+
+	/** Most recently used first */
+	std::list<Block> blocks;
+	std::unordered_map<Key, std::list<Block>::iterator, KeyHash> lookup;
+
+	int64_t budget;
+	Statistics statistics;
+
+};
+
+#endif
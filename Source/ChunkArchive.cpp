@@ -0,0 +1,568 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ChunkArchive.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "Definitions.h"
+#include "WorkerPool.h"
+
+namespace
+{
+	/** The header at the start of every archive */
+	struct ArchiveHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		int64_t size;
+		int64_t firstRecord;
+		int64_t chunkBytes;
+		int64_t recordBytes;
+		int64_t numChunks;
+		int64_t indexOffset;
+	};
+
+	static_assert(sizeof(ArchiveHeader) == 64, "ArchiveHeader must match the on-disk layout");
+
+	const char archiveMagic[8] = { 'O', 'E', 'A', 'R', 'C', 'H', 'I', 'V' };
+	const uint32_t archiveVersion = 1;
+
+	/** Chunk flag: the chunk is stored uncompressed */
+	const uint32_t chunkStored = 1;
+
+	/** Tags of the units of a compressed chunk */
+	const uint8_t rawUnit = 0;
+	const uint8_t codedRecord = 1;
+
+	/** Samples per bit-packed group */
+	const int groupSize = 64;
+
+	const uint8_t recordMarker[RECORD_MARKER_SIZE] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 255 };
+
+	int seekTo(FILE* file, int64_t position)
+	{
+#ifdef _WIN32
+		return _fseeki64(file, position, SEEK_SET);
+#else
+		return fseeko(file, (off_t) position, SEEK_SET);
+#endif
+	}
+
+	int64_t getFileSize(FILE* file)
+	{
+#ifdef _WIN32
+		_fseeki64(file, 0, SEEK_END);
+		return _ftelli64(file);
+#else
+		fseeko(file, 0, SEEK_END);
+		return (int64_t) ftello(file);
+#endif
+	}
+
+	/** Adler-32 of the stored bytes of a chunk */
+	uint32_t getChecksum(const uint8_t* data, size_t length)
+	{
+		const uint32_t modulus = 65521;
+		uint32_t a = 1, b = 0;
+
+		while (length > 0)
+		{
+			// the largest run that can't overflow b before the modulo
+			const size_t run = std::min<size_t>(length, 5552);
+
+			for (size_t i = 0; i < run; i++)
+			{
+				a += data[i];
+				b += a;
+			}
+
+			a %= modulus;
+			b %= modulus;
+			data += run;
+			length -= run;
+		}
+
+		return (b << 16) | a;
+	}
+
+	bool readHeader(FILE* file, ArchiveHeader& header)
+	{
+		return seekTo(file, 0) == 0
+			&& fread(&header, sizeof(header), 1, file) == 1
+			&& memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) == 0
+			&& header.version == archiveVersion
+			&& header.size >= 0 && header.firstRecord >= 0 && header.firstRecord <= header.size && header.chunkBytes > 0;
+	}
+
+	int64_t countChunks(int64_t size, int64_t firstRecord, int64_t chunkBytes)
+	{
+		return 1 + (size - firstRecord + chunkBytes - 1) / chunkBytes;
+	}
+
+	/** Appends the coded form of a complete record; returns false (leaving 'out' as it was)
+		if it isn't one, or if coding wouldn't make it smaller */
+	bool encodeRecord(const uint8_t* record, std::vector<uint8_t>& out)
+	{
+		uint16_t count;
+		memcpy(&count, record + 8, sizeof(count));
+
+		if (count != BLOCK_LENGTH || memcmp(record + RECORD_SIZE - RECORD_MARKER_SIZE, recordMarker, RECORD_MARKER_SIZE) != 0)
+			return false;
+
+		// zigzag coded differences between consecutive (big-endian) samples
+		uint16_t values[BLOCK_LENGTH];
+		uint16_t previous = 0;
+
+		for (int i = 0; i < BLOCK_LENGTH; i++)
+		{
+			const uint16_t sample = uint16_t((record[RECORD_HEADER_SIZE + 2 * i] << 8) | record[RECORD_HEADER_SIZE + 2 * i + 1]);
+			const int16_t delta = int16_t(uint16_t(sample - previous));
+
+			values[i] = uint16_t(uint16_t(delta) << 1) ^ uint16_t(delta >> 15);
+			previous = sample;
+		}
+
+		const size_t start = out.size();
+
+		out.push_back(codedRecord);
+		out.insert(out.end(), record, record + RECORD_HEADER_SIZE);
+
+		for (int group = 0; group < BLOCK_LENGTH; group += groupSize)
+		{
+			uint16_t maximum = 0;
+
+			for (int i = group; i < group + groupSize; i++)
+				maximum |= values[i];
+
+			int width = 0;
+
+			while (width < 16 && (maximum >> width) != 0)
+				width++;
+
+			out.push_back(uint8_t(width));
+
+			// groupSize values of 'width' bits always end on a byte boundary
+			size_t position = out.size();
+			out.resize(position + size_t(groupSize / 8 * width));
+
+			uint64_t bits = 0;
+			int numBits = 0;
+
+			for (int i = group; i < group + groupSize; i++)
+			{
+				bits |= uint64_t(values[i]) << numBits;
+				numBits += width;
+
+				for (; numBits >= 8; numBits -= 8, bits >>= 8)
+					out[position++] = uint8_t(bits);
+			}
+		}
+
+		if (out.size() - start > size_t(RECORD_SIZE))
+		{
+			out.resize(start);
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Decodes a coded record into 'record'; returns the number of bytes read from 'data', or 0 if it's damaged */
+	size_t decodeRecord(const uint8_t* data, size_t available, uint8_t* record)
+	{
+		if (available < size_t(RECORD_HEADER_SIZE))
+			return 0;
+
+		memcpy(record, data, RECORD_HEADER_SIZE);
+
+		size_t position = RECORD_HEADER_SIZE;
+		uint16_t previous = 0;
+
+		for (int group = 0; group < BLOCK_LENGTH; group += groupSize)
+		{
+			if (position >= available)
+				return 0;
+
+			const int width = data[position++];
+
+			if (width > 16 || position + size_t(groupSize / 8 * width) > available)
+				return 0;
+
+			const uint64_t mask = (uint64_t(1) << width) - 1;
+
+			uint64_t bits = 0;
+			int numBits = 0;
+
+			for (int i = group; i < group + groupSize; i++)
+			{
+				for (; numBits < width; numBits += 8)
+					bits |= uint64_t(data[position++]) << numBits;
+
+				const uint16_t value = uint16_t(bits & mask);
+				bits >>= width;
+				numBits -= width;
+
+				previous = uint16_t(previous + uint16_t((value >> 1) ^ uint16_t(0 - (value & 1))));
+
+				record[RECORD_HEADER_SIZE + 2 * i] = uint8_t(previous >> 8);
+				record[RECORD_HEADER_SIZE + 2 * i + 1] = uint8_t(previous);
+			}
+		}
+
+		memcpy(record + RECORD_SIZE - RECORD_MARKER_SIZE, recordMarker, RECORD_MARKER_SIZE);
+
+		return position;
+	}
+}
+
+ChunkArchive::ChunkArchive() :
+	file(nullptr),
+	size(0),
+	firstRecord(0),
+	chunkBytes(1)
+{
+}
+
+ChunkArchive::~ChunkArchive()
+{
+	close();
+}
+
+bool ChunkArchive::open(const std::string& path)
+{
+	close();
+
+	file = fopen(path.c_str(), "rb");
+
+	if (file == nullptr)
+		return false;
+
+	ArchiveHeader header;
+
+	bool ok = readHeader(file, header)
+		&& header.numChunks == countChunks(header.size, header.firstRecord, header.chunkBytes)
+		&& header.indexOffset >= (int64_t) sizeof(header)
+		&& header.indexOffset + header.numChunks * (int64_t) sizeof(ChunkEntry) <= getFileSize(file)
+		&& seekTo(file, header.indexOffset) == 0;
+
+	if (ok)
+	{
+		chunks.resize((size_t) header.numChunks);
+		ok = fread(chunks.data(), sizeof(ChunkEntry), chunks.size(), file) == chunks.size();
+	}
+
+	if (!ok)
+	{
+		close();
+		return false;
+	}
+
+	size = header.size;
+	firstRecord = header.firstRecord;
+	chunkBytes = header.chunkBytes;
+
+	return true;
+}
+
+void ChunkArchive::close()
+{
+	if (file != nullptr)
+		fclose(file);
+
+	file = nullptr;
+	chunks.clear();
+	size = 0;
+	firstRecord = 0;
+	chunkBytes = 1;
+}
+
+int64_t ChunkArchive::getChunkStart(int64_t chunk) const
+{
+	if (chunk <= 0)
+		return 0;
+
+	if (chunk >= getNumChunks())
+		return size;
+
+	return std::min(size, firstRecord + (chunk - 1) * chunkBytes);
+}
+
+int64_t ChunkArchive::findChunk(int64_t offset) const
+{
+	if (offset < firstRecord)
+		return 0;
+
+	return std::min(getNumChunks() - 1, 1 + (offset - firstRecord) / chunkBytes);
+}
+
+bool ChunkArchive::readChunk(int64_t chunk, uint8_t* dest, std::vector<uint8_t>& buffer)
+{
+	const ChunkEntry& entry = chunks[(size_t) chunk];
+	const size_t length = size_t(getChunkStart(chunk + 1) - getChunkStart(chunk));
+	const bool stored = (entry.flags & chunkStored) != 0;
+
+	if (stored && entry.compressedSize != length)
+		return false;
+
+	buffer.resize(entry.compressedSize);
+
+	{
+		std::lock_guard<std::mutex> lock(fileMutex);
+
+		if (seekTo(file, entry.offset) != 0
+			|| fread(stored ? dest : buffer.data(), 1, entry.compressedSize, file) != entry.compressedSize)
+			return false;
+	}
+
+	if (stored)
+		return getChecksum(dest, length) == entry.checksum;
+
+	return getChecksum(buffer.data(), buffer.size()) == entry.checksum
+		&& decompressChunk(buffer.data(), buffer.size(), dest, length);
+}
+
+bool ChunkArchive::read(int64_t offset, int64_t length, uint8_t* dest, WorkerPool* pool)
+{
+	if (file == nullptr || offset < 0 || length < 0 || offset + length > size)
+		return false;
+
+	if (length == 0)
+		return true;
+
+	const int64_t first = findChunk(offset);
+	const int64_t last = findChunk(offset + length - 1);
+
+	std::atomic<bool> ok(true);
+
+	auto readOne = [&](int i)
+	{
+		const int64_t chunk = first + i;
+		const int64_t start = getChunkStart(chunk);
+		const int64_t end = getChunkStart(chunk + 1);
+
+		std::vector<uint8_t> buffer;
+
+		// chunks the range covers whole are decompressed in place, the ones at its ends through a copy
+		if (start >= offset && end <= offset + length)
+		{
+			if (!readChunk(chunk, dest + (start - offset), buffer))
+				ok = false;
+		}
+		else
+		{
+			std::vector<uint8_t> whole(size_t(end - start));
+
+			const int64_t from = std::max(start, offset);
+			const int64_t to = std::min(end, offset + length);
+
+			if (readChunk(chunk, whole.data(), buffer))
+				memcpy(dest + (from - offset), whole.data() + (from - start), size_t(to - from));
+			else
+				ok = false;
+		}
+	};
+
+	if (pool != nullptr && last > first)
+		pool->run(int(last - first + 1), readOne);
+	else
+		for (int i = 0; i <= int(last - first); i++)
+			readOne(i);
+
+	return ok;
+}
+
+bool ChunkArchive::pack(const std::string& dataPath, const std::string& archivePath, int64_t firstRecord,
+	int64_t recordBytes, int64_t recordsPerChunk, WorkerPool& pool, std::string& error)
+{
+	FILE* in = fopen(dataPath.c_str(), "rb");
+
+	if (in == nullptr)
+	{
+		error = "cannot open " + dataPath;
+		return false;
+	}
+
+	FILE* out = fopen(archivePath.c_str(), "wb");
+
+	if (out == nullptr)
+	{
+		fclose(in);
+		error = "cannot create " + archivePath;
+		return false;
+	}
+
+	ArchiveHeader header;
+	memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+	header.version = archiveVersion;
+	header.reserved = 0;
+	header.size = getFileSize(in);
+	header.firstRecord = std::max<int64_t>(0, std::min(firstRecord, header.size));
+	header.chunkBytes = std::max<int64_t>(1, recordBytes) * std::max<int64_t>(1, recordsPerChunk);
+	header.recordBytes = recordBytes;
+	header.numChunks = countChunks(header.size, header.firstRecord, header.chunkBytes);
+	header.indexOffset = 0;
+
+	// the header is written again once the index is in place
+	bool ok = seekTo(in, 0) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+
+	std::vector<ChunkEntry> entries;
+	int64_t position = (int64_t) sizeof(header);
+
+	const int batchSize = 4 * pool.getNumThreads();
+	std::vector<std::vector<uint8_t>> inputs((size_t) batchSize), outputs((size_t) batchSize);
+
+	for (int64_t batch = 0; ok && batch < header.numChunks; batch += batchSize)
+	{
+		const int numChunks = (int) std::min<int64_t>(batchSize, header.numChunks - batch);
+
+		// chunks are read in order, so the data file is read sequentially
+		for (int i = 0; ok && i < numChunks; i++)
+		{
+			const int64_t chunk = batch + i;
+			const int64_t start = chunk == 0 ? 0 : header.firstRecord + (chunk - 1) * header.chunkBytes;
+			const int64_t end = chunk == 0 ? header.firstRecord : std::min(header.size, start + header.chunkBytes);
+
+			inputs[(size_t) i].resize(size_t(end - start));
+			ok = fread(inputs[(size_t) i].data(), 1, inputs[(size_t) i].size(), in) == inputs[(size_t) i].size();
+		}
+
+		if (!ok)
+			break;
+
+		pool.run(numChunks, [&](int i)
+			{
+				outputs[(size_t) i].clear();
+				compressChunk(inputs[(size_t) i].data(), inputs[(size_t) i].size(), outputs[(size_t) i]);
+			});
+
+		for (int i = 0; ok && i < numChunks; i++)
+		{
+			// chunks that don't get smaller are stored as they are
+			const bool stored = outputs[(size_t) i].size() >= inputs[(size_t) i].size();
+			const std::vector<uint8_t>& chunk = stored ? inputs[(size_t) i] : outputs[(size_t) i];
+
+			entries.push_back({ position, (uint32_t) chunk.size(), stored ? chunkStored : 0, getChecksum(chunk.data(), chunk.size()), 0 });
+
+			ok = fwrite(chunk.data(), 1, chunk.size(), out) == chunk.size();
+			position += (int64_t) chunk.size();
+		}
+	}
+
+	header.indexOffset = position;
+
+	ok = ok
+		&& fwrite(entries.data(), sizeof(ChunkEntry), entries.size(), out) == entries.size()
+		&& seekTo(out, 0) == 0
+		&& fwrite(&header, sizeof(header), 1, out) == 1;
+
+	fclose(in);
+	ok = fclose(out) == 0 && ok;
+
+	if (!ok)
+	{
+		remove(archivePath.c_str());
+		error = "cannot archive " + dataPath;
+	}
+
+	return ok;
+}
+
+int64_t ChunkArchive::readOriginalSize(const std::string& path)
+{
+	FILE* archive = fopen(path.c_str(), "rb");
+
+	if (archive == nullptr)
+		return -1;
+
+	ArchiveHeader header;
+	bool ok = readHeader(archive, header);
+
+	fclose(archive);
+
+	return ok ? header.size : -1;
+}
+
+void ChunkArchive::compressChunk(const uint8_t* data, size_t length, std::vector<uint8_t>& out)
+{
+	size_t position = 0;
+
+	// chunks start on a record boundary, so records are found by position
+	for (; position + RECORD_SIZE <= length; position += RECORD_SIZE)
+	{
+		if (!encodeRecord(data + position, out))
+		{
+			out.push_back(rawUnit);
+			out.insert(out.end(), data + position, data + position + RECORD_SIZE);
+		}
+	}
+
+	// whatever is left is shorter than a record, and kept as it is
+	out.insert(out.end(), data + position, data + length);
+}
+
+bool ChunkArchive::decompressChunk(const uint8_t* data, size_t compressedLength, uint8_t* dest, size_t length)
+{
+	size_t in = 0;
+	size_t position = 0;
+
+	for (; position + RECORD_SIZE <= length; position += RECORD_SIZE)
+	{
+		if (in >= compressedLength)
+			return false;
+
+		const uint8_t tag = data[in++];
+
+		if (tag == rawUnit)
+		{
+			if (in + RECORD_SIZE > compressedLength)
+				return false;
+
+			memcpy(dest + position, data + in, RECORD_SIZE);
+			in += RECORD_SIZE;
+		}
+		else if (tag == codedRecord)
+		{
+			size_t used = decodeRecord(data + in, compressedLength - in, dest + position);
+
+			if (used == 0)
+				return false;
+
+			in += used;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (compressedLength - in != length - position)
+		return false;
+
+	memcpy(dest + position, data + in, length - position);
+	return true;
+}
@@ -0,0 +1,131 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHUNKARCHIVE_H_DEFINED
+#define CHUNKARCHIVE_H_DEFINED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+class WorkerPool;
+
+/**
+	A data file stored as independently compressed chunks, with an index of where
+	each chunk is, so any byte range of the original file can be read by
+	decompressing only the chunks it touches.
+
+	The first chunk holds everything before the first record (the file headers),
+	and every other chunk a fixed number of whole records, or packed frames, of
+	the original file (the last one holds whatever is left). Chunks are compressed
+	with the archive's own codec: record headers are kept as they are, and the
+	samples of each record are delta coded and bit packed in groups of 64, with
+	the record marker left implied. Anything that isn't a complete record is
+	stored unchanged, as is any chunk that wouldn't get smaller.
+
+	An archive file holds a 64-byte header, the compressed chunks, then the chunk
+	index: the offset, compressed size, flags and checksum (Adler-32 of the stored
+	bytes) of each chunk. Chunks that fail their checksum can't be read.
+*/
+class ChunkArchive
+{
+public:
+
+	/** Constructor */
+	ChunkArchive();
+
+	/** Closes the archive */
+	~ChunkArchive();
+
+	/** Opens an archive and reads its chunk index; returns false if it isn't a valid archive */
+	bool open(const std::string& path);
+
+	/** Closes the archive */
+	void close();
+
+	/** Size of the original data file, in bytes */
+	int64_t getSize() const { return size; }
+
+	/** Number of chunks */
+	int64_t getNumChunks() const { return (int64_t) chunks.size(); }
+
+	/** Offset in the original file of the first byte of a chunk (the file size for getNumChunks()) */
+	int64_t getChunkStart(int64_t chunk) const;
+
+	/** Index of the chunk holding a byte of the original file */
+	int64_t findChunk(int64_t offset) const;
+
+	/** Copies [offset, offset + length) of the original file to dest, decompressing the chunks it touches
+		(several at once on 'pool', if there is one). Returns false if the range isn't in the file, or if
+		one of its chunks can't be read or is damaged. */
+	bool read(int64_t offset, int64_t length, uint8_t* dest, WorkerPool* pool = nullptr);
+
+	/** Compresses a data file into an archive, with chunks of 'recordsPerChunk' records of 'recordBytes'
+		each from 'firstRecord' on. Batches of chunks are compressed on 'pool'.
+		Returns false (with a message in 'error') if it fails. */
+	static bool pack(const std::string& dataPath, const std::string& archivePath, int64_t firstRecord,
+		int64_t recordBytes, int64_t recordsPerChunk, WorkerPool& pool, std::string& error);
+
+	/** Size of the original data file stored in an archive, or -1 if it isn't a valid archive */
+	static int64_t readOriginalSize(const std::string& path);
+
+	/** Name of the archive that replaces a data file */
+	static std::string getArchivePath(const std::string& dataPath) { return dataPath + ".oea"; }
+
+	/** Appends the compressed form of one chunk to 'out' */
+	static void compressChunk(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+
+	/** Decompresses one chunk of 'length' bytes; returns false if the compressed data is damaged */
+	static bool decompressChunk(const uint8_t* data, size_t compressedLength, uint8_t* dest, size_t length);
+
+private:
+
+	ChunkArchive(const ChunkArchive&) = delete;
+	ChunkArchive& operator=(const ChunkArchive&) = delete;
+
+	struct ChunkEntry
+	{
+		int64_t offset;
+		uint32_t compressedSize;
+		uint32_t flags;
+		uint32_t checksum;
+		uint32_t reserved;
+	};
+
+	/** Reads and decompresses a whole chunk, using 'buffer' for its compressed bytes */
+	bool readChunk(int64_t chunk, uint8_t* dest, std::vector<uint8_t>& buffer);
+
+	FILE* file;
+	std::mutex fileMutex;
+
+	int64_t size;
+	int64_t firstRecord;
+	int64_t chunkBytes;
+	std::vector<ChunkEntry> chunks;
+
+};
+
+#endif
@@ -27,6 +27,10 @@
 #define HEADER_SIZE 1024
 #define BLOCK_LENGTH 1024
 
+#define RECORD_HEADER_SIZE 12 // int64 sample number, uint16 sample count, uint16 recordingNumber
+#define RECORD_MARKER_SIZE 10
+#define RECORD_SIZE (RECORD_HEADER_SIZE + 2 * BLOCK_LENGTH + RECORD_MARKER_SIZE)
+
 #define VERSION 0.6
 
 #define VSTR(s) #s
@@ -0,0 +1,133 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "EventStore.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+
+void EventStore::clear()
+{
+	timestamps.clear();
+	channels.clear();
+	states.clear();
+}
+
+void EventStore::reserve(size_t numEvents)
+{
+	timestamps.reserve(numEvents);
+	channels.reserve(numEvents);
+	states.reserve(numEvents);
+}
+
+void EventStore::add(int64_t timestamp, int16_t channel, int16_t state)
+{
+	timestamps.push_back(timestamp);
+	channels.push_back(channel);
+	states.push_back(state);
+}
+
+void EventStore::decode(const void* records, size_t numEvents, const std::vector<int64_t>& recordingOffsets)
+{
+	timestamps.resize(numEvents);
+	channels.resize(numEvents);
+	states.resize(numEvents);
+
+	const uint8_t* record = static_cast<const uint8_t*>(records);
+	const size_t lastRecording = recordingOffsets.empty() ? 0 : recordingOffsets.size() - 1;
+	const int64_t noOffset = 0;
+	const int64_t* offsets = recordingOffsets.empty() ? &noOffset : recordingOffsets.data();
+
+	// one pass over the records, with no branches besides the table clamp
+	for (size_t i = 0; i < numEvents; i++, record += 16)
+	{
+		int64_t timestamp;
+		uint16_t recording;
+
+		memcpy(&timestamp, record, 8);
+		memcpy(&recording, record + 14, 2);
+
+		timestamps[i] = timestamp - offsets[std::min<size_t>(recording, lastRecording)];
+		states[i] = record[12];
+		channels[i] = record[13];
+	}
+
+	sort();
+}
+
+void EventStore::sort()
+{
+	// events are almost always written in order already
+	if (std::is_sorted(timestamps.begin(), timestamps.end()))
+		return;
+
+	std::vector<size_t> order(timestamps.size());
+	std::iota(order.begin(), order.end(), size_t(0));
+
+	std::stable_sort(order.begin(), order.end(),
+		[this](size_t a, size_t b) { return timestamps[a] < timestamps[b]; });
+
+	std::vector<int64_t> sortedTimestamps(order.size());
+	std::vector<int16_t> sortedChannels(order.size());
+	std::vector<int16_t> sortedStates(order.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		sortedTimestamps[i] = timestamps[order[i]];
+		sortedChannels[i] = channels[order[i]];
+		sortedStates[i] = states[order[i]];
+	}
+
+	timestamps.swap(sortedTimestamps);
+	channels.swap(sortedChannels);
+	states.swap(sortedStates);
+}
+
+EventSpan EventStore::find(int64_t start, int64_t stop) const
+{
+	if (stop < start)
+		return getSpan(0, 0);
+
+	size_t first = std::lower_bound(timestamps.begin(), timestamps.end(), start) - timestamps.begin();
+	size_t last = std::upper_bound(timestamps.begin() + first, timestamps.end(), stop) - timestamps.begin();
+
+	return getSpan(first, last);
+}
+
+EventSpan EventStore::getAll() const
+{
+	return getSpan(0, timestamps.size());
+}
+
+EventSpan EventStore::getSpan(size_t first, size_t last) const
+{
+	EventSpan span;
+	span.timestamps = timestamps.data() + first;
+	span.channels = channels.data() + first;
+	span.states = states.data() + first;
+	span.size = last - first;
+
+	return span;
+}
@@ -0,0 +1,87 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef EVENTSTORE_H_DEFINED
+#define EVENTSTORE_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/** A contiguous run of events inside an EventStore; valid until the store is modified */
+struct EventSpan
+{
+	const int64_t* timestamps;
+	const int16_t* channels;
+	const int16_t* states;
+	size_t size;
+};
+
+/**
+	TTL events of one stream, as columns sorted by timestamp.
+
+	Ranges of events are found by binary search and returned as spans into
+	the columns, without copying.
+*/
+class EventStore
+{
+public:
+
+	/** Removes all events */
+	void clear();
+
+	/** Reserves space for a number of events */
+	void reserve(size_t numEvents);
+
+	/** Appends an event (call sort() afterwards if they may be out of order) */
+	void add(int64_t timestamp, int16_t channel, int16_t state);
+
+	/** Replaces the contents with the events in the records of an .events file (16 bytes each: int64 timestamp,
+		int16 sample position, uint8 type, uint8 processor, uint8 state, uint8 channel, uint16 recording number),
+		sorted. recordingOffsets[n] is subtracted from the timestamps of recording number n; the last offset is
+		used for recording numbers past the end of the table. */
+	void decode(const void* records, size_t numEvents, const std::vector<int64_t>& recordingOffsets);
+
+	/** Sorts the events by timestamp, keeping the order of events with equal timestamps */
+	void sort();
+
+	/** Returns the events with start <= timestamp <= stop */
+	EventSpan find(int64_t start, int64_t stop) const;
+
+	/** Returns all events */
+	EventSpan getAll() const;
+
+	/** Number of events */
+	size_t size() const { return timestamps.size(); }
+
+private:
+
+	EventSpan getSpan(size_t first, size_t last) const;
+
+	std::vector<int64_t> timestamps;
+	std::vector<int16_t> channels;
+	std::vector<int16_t> states;
+};
+
+#endif
@@ -149,4 +149,96 @@ String generateHeader(const ChannelInfoObject* ch, String dateString)
 
 }
 
+String generatePackedHeader(const ChannelInfoObject* ch, int numChannels, bool summary, String dateString)
+{
+	String header = "header.format = 'Open Ephys Data Format'; \n";
+
+	header += "header.version = " + String(VERSION_STRING) + "; \n";
+	header += "header.header_bytes = ";
+	header += String(HEADER_SIZE);
+	header += ";\n";
+
+	if (summary)
+	{
+		header += "header.description = 'packed stream summary: this header is followed by num_channels .summary headers of header_bytes each, "
+			"then one .summary record per channel (in channel order) for every frame of the matching .packed file'; \n";
+	}
+	else
+	{
+		header += "header.description = 'packed stream: this header is followed by num_channels .continuous headers of header_bytes each, "
+			"then frames of num_channels .continuous records, one per channel in channel order'; \n";
+	}
+
+	header += "header.date_created = '";
+	header += dateString;
+	header += "';\n";
+
+	header += "header.stream = '";
+	header += ch->getStreamName();
+	header += "';\n";
+	header += "header.channelType = 'PackedContinuous';\n";
+	header += "header.sampleRate = ";
+	header += String(ch->getSampleRate());
+	header += ";\n";
+	header += "header.blockLength = ";
+	header += BLOCK_LENGTH;
+	header += ";\n";
+	header += "header.num_channels = ";
+	header += String(numChannels);
+	header += ";\n";
+
+	header = header.paddedRight(' ', HEADER_SIZE);
+
+	return header;
+}
+
+String generateIndexHeader(const ChannelInfoObject* ch, String dateString)
+{
+	String header = "header.format = 'Open Ephys Data Format'; \n";
+
+	header += "header.version = " + String(VERSION_STRING) + "; \n";
+	header += "header.header_bytes = ";
+	header += String(HEADER_SIZE);
+	header += ";\n";
+
+	header += "header.description = 'each record contains one int64 byte offset into the data file, one int64 sample number, "
+		"one uint16 recordingNumber, one uint16 sample count and one uint32 flags field'; \n";
+
+	header += "header.date_created = '";
+	header += dateString;
+	header += "';\n";
+
+	header += "header.stream = '";
+	header += ch->getStreamName();
+	header += "';\n";
+
+	header = header.paddedRight(' ', HEADER_SIZE);
+
+	return header;
+}
+
+String generateSummaryHeader(const ChannelInfoObject* ch, String dateString)
+{
+	String header = "header.format = 'Open Ephys Data Format'; \n";
+
+	header += "header.version = " + String(VERSION_STRING) + "; \n";
+	header += "header.header_bytes = ";
+	header += String(HEADER_SIZE);
+	header += ";\n";
+
+	header += "header.description = 'each record summarizes one record of the matching .continuous file and contains "
+		"one int64 sample number, one int64 sum, one uint64 sum of squares, one int16 minimum, one int16 maximum, "
+		"one uint16 sample count and one uint16 recordingNumber'; \n";
+
+	header += "header.date_created = '";
+	header += dateString;
+	header += "';\n";
+
+	header += getContinuousChannelHeaderText(ch);
+
+	header = header.paddedRight(' ', HEADER_SIZE);
+
+	return header;
+}
+
 #endif
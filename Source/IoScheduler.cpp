@@ -0,0 +1,244 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "IoScheduler.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	/** Asks the OS to start reading a range of an open file; returns false if it can't */
+	bool adviseRead(int descriptor, int64_t offset, int64_t length)
+	{
+#if defined(__APPLE__)
+		struct radvisory advice;
+		advice.ra_offset = (off_t) offset;
+		advice.ra_count = (int) std::min<int64_t>(length, INT32_MAX);
+
+		return fcntl(descriptor, F_RDADVISE, &advice) != -1;
+#elif !defined(_WIN32)
+		return posix_fadvise(descriptor, (off_t) offset, (off_t) length, POSIX_FADV_WILLNEED) == 0;
+#else
+		return false;
+#endif
+	}
+}
+
+IoScheduler::IoScheduler() : nextHandle(0), busy(false), exit(false), statistics()
+{
+	thread = std::thread(&IoScheduler::run, this);
+}
+
+IoScheduler::~IoScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exit = true;
+		pending.clear();
+	}
+
+	condition.notify_all();
+	thread.join();
+
+#ifndef _WIN32
+	for (auto& file : files)
+	{
+		if (file.second.descriptor >= 0)
+			close(file.second.descriptor);
+	}
+#endif
+}
+
+int IoScheduler::addFile(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto existing = handles.find(path);
+
+	if (existing != handles.end())
+	{
+		files[existing->second].numRegistrations++;
+		return existing->second;
+	}
+
+	RegisteredFile file;
+	file.path = path;
+	file.numRegistrations = 1;
+
+#ifndef _WIN32
+	file.descriptor = open(path.c_str(), O_RDONLY);
+#else
+	file.descriptor = -1;
+#endif
+
+	const int handle = nextHandle++;
+
+	files[handle] = file;
+	handles[path] = handle;
+
+	return handle;
+}
+
+void IoScheduler::removeFile(int file)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto registered = files.find(file);
+
+	if (registered == files.end() || --registered->second.numRegistrations > 0)
+		return;
+
+	pending.erase(std::remove_if(pending.begin(), pending.end(), [file](const Request& request)
+	{
+		return request.file == file;
+	}), pending.end());
+
+	// the batch being advised may still use the descriptor
+	condition.wait(lock, [this] { return !busy; });
+
+	// the path may have been registered again in the meantime
+	if (registered->second.numRegistrations > 0)
+		return;
+
+#ifndef _WIN32
+	if (registered->second.descriptor >= 0)
+		close(registered->second.descriptor);
+#endif
+
+	handles.erase(registered->second.path);
+	files.erase(registered);
+}
+
+void IoScheduler::request(int file, int64_t offset, int64_t length)
+{
+	if (length <= 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		pending.push_back({ file, offset, length });
+		statistics.numRequests++;
+	}
+
+	condition.notify_all();
+}
+
+void IoScheduler::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	condition.wait(lock, [this] { return exit || (pending.empty() && !busy); });
+}
+
+IoScheduler::Statistics IoScheduler::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return statistics;
+}
+
+void IoScheduler::run()
+{
+	std::vector<Request> batch;
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		condition.wait(lock, [this] { return exit || !pending.empty(); });
+
+		if (exit)
+			return;
+
+		// everything queued while the last batch was being advised goes into this one
+		batch.swap(pending);
+		busy = true;
+		lock.unlock();
+
+		advise(batch);
+		batch.clear();
+
+		lock.lock();
+		busy = false;
+
+		condition.notify_all();
+	}
+}
+
+void IoScheduler::advise(std::vector<Request>& batch)
+{
+	std::sort(batch.begin(), batch.end(), [](const Request& a, const Request& b)
+	{
+		return a.file != b.file ? a.file < b.file : a.offset < b.offset;
+	});
+
+	int64_t numRanges = 0;
+	int64_t advisedBytes = 0;
+
+	for (size_t first = 0; first < batch.size();)
+	{
+		const int file = batch[first].file;
+
+		// files are only removed between batches, so the descriptor stays open while it's used
+		int descriptor = -1;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto registered = files.find(file);
+
+			if (registered != files.end())
+				descriptor = registered->second.descriptor;
+		}
+
+		size_t last = first;
+
+		while (last < batch.size() && batch[last].file == file)
+		{
+			int64_t start = batch[last].offset;
+			int64_t end = start + batch[last].length;
+
+			for (last++; last < batch.size() && batch[last].file == file && batch[last].offset <= end + MERGE_GAP; last++)
+				end = std::max(end, batch[last].offset + batch[last].length);
+
+			if (descriptor >= 0 && adviseRead(descriptor, start, end - start))
+			{
+				numRanges++;
+				advisedBytes += end - start;
+			}
+		}
+
+		first = last;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	statistics.numBatches++;
+	statistics.numRanges += numRanges;
+	statistics.advisedBytes += advisedBytes;
+}
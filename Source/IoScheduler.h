@@ -0,0 +1,125 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef IOSCHEDULER_H_DEFINED
+#define IOSCHEDULER_H_DEFINED
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+	Asks the OS to load ranges of files ahead of the reads that will need them, on one
+	background thread shared by all the streams being played.
+
+	Requests are queued without blocking. The thread takes everything queued so far,
+	sorts it by file and offset, merges ranges that overlap or nearly touch, and advises
+	each merged range once, so streams reading from the same disk get one ordered batch
+	of read-ahead instead of competing page faults.
+
+	Registered files are kept open until their last registration is removed, so batches
+	don't reopen them. Where the OS has no way to advise reads (Windows), requests are
+	dropped and the pages are faulted in by the reads themselves.
+*/
+class IoScheduler
+{
+public:
+
+	/** Counters since the scheduler was created */
+	struct Statistics
+	{
+		int64_t numRequests;
+		int64_t numBatches;
+		int64_t numRanges;
+		int64_t advisedBytes;
+	};
+
+	/** Starts the scheduling thread */
+	IoScheduler();
+
+	/** Drops pending requests, stops the thread and closes all files */
+	~IoScheduler();
+
+	/** Registers a file and returns its handle; registering a path again returns the same handle */
+	int addFile(const std::string& path);
+
+	/** Removes one registration of a file. Once none are left, its pending requests are dropped,
+		the file is closed and the handle becomes invalid (it may be reused). */
+	void removeFile(int file);
+
+	/** Queues [offset, offset + length) of a file to be loaded */
+	void request(int file, int64_t offset, int64_t length);
+
+	/** Returns once every request queued so far has been advised */
+	void flush();
+
+	/** Returns the scheduling counters */
+	Statistics getStatistics() const;
+
+	/** Ranges closer than this are merged, so the gap is read along with them */
+	static const int64_t MERGE_GAP = 256 * 1024;
+
+private:
+
+	struct Request
+	{
+		int file;
+		int64_t offset;
+		int64_t length;
+	};
+
+	/** Body of the scheduling thread */
+	void run();
+
+	/** Sorts, merges and advises one batch of requests */
+	void advise(std::vector<Request>& batch);
+
+	/** A file being advised, opened once when it is first registered */
+	struct RegisteredFile
+	{
+		std::string path;
+		int descriptor;
+		int numRegistrations;
+	};
+
+	std::map<int, RegisteredFile> files;
+	std::map<std::string, int> handles;
+	int nextHandle;
+
+	std::vector<Request> pending;
+
+	bool busy;
+	bool exit;
+	Statistics statistics;
+
+	std::thread thread;
+	mutable std::mutex mutex;
+	std::condition_variable condition;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MappingManager.h"
+
+MappingManager::MappingManager() :
+	budget(int64(256) << 20),
+	workerPool(nullptr)
+{
+	clear();
+}
+
+void MappingManager::setBudget(int64 bytes)
+{
+	budget = jmax(int64(0), bytes);
+}
+
+int MappingManager::addFile(const File& file, int64 minimumWindow, Range<int64> byteRange)
+{
+	FileWindow* window = new FileWindow();
+
+	window->file = file;
+	window->first = 0;
+	window->size = file.getSize();
+	window->decodedCapacity = 0;
+
+	if (isArchived(file))
+	{
+		window->archive.reset(new ChunkArchive());
+
+		if (window->archive->open(ChunkArchive::getArchivePath(file.getFullPathName().toStdString())))
+			window->size = window->archive->getSize();
+		else
+			window->size = 0;
+	}
+
+	if (!byteRange.isEmpty())
+	{
+		window->first = jmax(int64(0), byteRange.getStart());
+		window->size = jmin(window->size, byteRange.getEnd());
+	}
+
+	window->minimumWindow = jmax(int64(1), minimumWindow);
+	window->start = 0;
+	window->end = 0;
+
+	files.add(window);
+
+	return files.size() - 1;
+}
+
+void MappingManager::clear()
+{
+	files.clear();
+
+	statistics.numMappings = 0;
+	statistics.numRemaps = 0;
+	statistics.mappedBytes = 0;
+	statistics.peakMappedBytes = 0;
+}
+
+const uint8* MappingManager::getData(int file, int64 offset, int64 length)
+{
+	FileWindow* window = files[file];
+
+	if (window == nullptr || offset < window->first || length < 0 || offset + length > window->size)
+		return nullptr;
+
+	if (window->archive != nullptr)
+		return getArchivedData(*window, offset, length);
+
+	if (window->map == nullptr || offset < window->start || offset + length > window->end)
+	{
+		if (window->map != nullptr)
+		{
+			statistics.mappedBytes -= window->end - window->start;
+			statistics.numRemaps++;
+			window->map.reset();
+		}
+
+		// Map from the read onwards, so everything up to the next remap is already mapped
+		int64 windowSize = jmax(window->minimumWindow, length, budget / jmax(1, files.size()));
+		Range<int64> range(offset, jmin(window->size, offset + windowSize));
+
+		window->map.reset(new MemoryMappedFile(window->file, range, MemoryMappedFile::readOnly));
+
+		if (window->map->getData() == nullptr)
+		{
+			window->map.reset();
+			return nullptr;
+		}
+
+		// the mapping starts at a page boundary at or before the requested offset
+		window->start = window->map->getRange().getStart();
+		window->end = window->map->getRange().getEnd();
+
+		statistics.numMappings++;
+		statistics.mappedBytes += window->end - window->start;
+		statistics.peakMappedBytes = jmax(statistics.peakMappedBytes, statistics.mappedBytes);
+	}
+
+	return static_cast<const uint8*>(window->map->getData()) + (offset - window->start);
+}
+
+const uint8* MappingManager::getArchivedData(FileWindow& window, int64 offset, int64 length)
+{
+	if (window.decodedCapacity == 0 || offset < window.start || offset + length > window.end)
+	{
+		ChunkArchive& archive = *window.archive;
+
+		// Whole chunks from the one holding the read, up to the minimum window past it; unlike
+		// mapped windows, all of it is decompressed up front, so the rest of the budget isn't used
+		const int64 start = archive.getChunkStart(archive.findChunk(offset));
+		const int64 last = archive.findChunk(jmin(window.size, offset + jmax(window.minimumWindow, length)) - 1);
+		const int64 end = archive.getChunkStart(last + 1);
+
+		if (window.decodedCapacity < end - start)
+		{
+			window.decoded.malloc((size_t) (end - start));
+			window.decodedCapacity = end - start;
+		}
+
+		if (window.end > window.start)
+		{
+			statistics.mappedBytes -= window.end - window.start;
+			statistics.numRemaps++;
+		}
+
+		window.start = 0;
+		window.end = 0;
+
+		if (!archive.read(start, end - start, window.decoded.getData(), workerPool))
+			return nullptr;
+
+		window.start = start;
+		window.end = end;
+
+		statistics.numMappings++;
+		statistics.mappedBytes += end - start;
+		statistics.peakMappedBytes = jmax(statistics.peakMappedBytes, statistics.mappedBytes);
+	}
+
+	return window.decoded.getData() + (offset - window.start);
+}
+
+bool MappingManager::isArchived(const File& file)
+{
+	return !file.existsAsFile() && File(String(ChunkArchive::getArchivePath(file.getFullPathName().toStdString()))).existsAsFile();
+}
+
+int64 MappingManager::getFileSize(const File& file)
+{
+	if (!isArchived(file))
+		return file.getSize();
+
+	return jmax(int64(0), (int64) ChunkArchive::readOriginalSize(ChunkArchive::getArchivePath(file.getFullPathName().toStdString())));
+}
@@ -0,0 +1,119 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef MAPPINGMANAGER_H_DEFINED
+#define MAPPINGMANAGER_H_DEFINED
+
+#include <FileSourceHeaders.h>
+
+#include "ChunkArchive.h"
+
+class WorkerPool;
+
+/**
+	Maps a bounded window of each of a set of files, instead of whole files.
+
+	Each file gets a window of (budget / number of files) bytes, but never less than
+	its minimum window. When a read falls outside a file's window, the window is
+	remapped to start at the read, so the data ahead of the read position stays mapped
+	and whatever was behind it is released. This keeps the address space and resident
+	memory of the File Source bounded however many (and however large) the files are.
+
+	Data files that have been replaced by a ChunkArchive (<file>.oea) are read the
+	same way: instead of mapping a window, the chunks holding it are decompressed
+	into memory, and only those chunks.
+*/
+class MappingManager
+{
+public:
+
+	/** Counters since the last call to clear() */
+	struct Statistics
+	{
+		int64 numMappings;
+		int64 numRemaps;
+		int64 mappedBytes;
+		int64 peakMappedBytes;
+	};
+
+	/** Constructor */
+	MappingManager();
+
+	/** Sets the total number of bytes to keep mapped across all files (takes effect at the next remap) */
+	void setBudget(int64 bytes);
+
+	/** Returns the total number of bytes to keep mapped across all files */
+	int64 getBudget() const { return budget; }
+
+	/** Sets the threads archived files are decompressed on (nullptr for the calling thread only) */
+	void setWorkerPool(WorkerPool* pool) { workerPool = pool; }
+
+	/** Adds a file; reads from it return at least 'minimumWindow' bytes. Returns its handle.
+		If 'byteRange' isn't empty, only that part of the file is ever mapped, and reads outside it fail. */
+	int addFile(const File& file, int64 minimumWindow, Range<int64> byteRange = Range<int64>());
+
+	/** Unmaps and removes all files, and resets the statistics */
+	void clear();
+
+	/** Returns a pointer to 'length' bytes of a file starting at 'offset', remapping its window if needed.
+		The pointer stays valid until the next call for the same file. Returns nullptr if the bytes
+		are not all in the file, or if it can't be mapped. */
+	const uint8* getData(int file, int64 offset, int64 length);
+
+	/** Returns the mapping counters */
+	Statistics getStatistics() const { return statistics; }
+
+	/** Returns true if a data file has been replaced by its ChunkArchive */
+	static bool isArchived(const File& file);
+
+	/** Returns the size of a data file, or of the original file if it has been archived */
+	static int64 getFileSize(const File& file);
+
+private:
+
+	struct FileWindow
+	{
+		File file;
+		int64 first;
+		int64 size;
+		int64 minimumWindow;
+		std::unique_ptr<MemoryMappedFile> map;
+		std::unique_ptr<ChunkArchive> archive;
+		HeapBlock<uint8> decoded;
+		int64 decodedCapacity;
+		int64 start;
+		int64 end;
+	};
+
+	/** Decompresses the chunks of an archived file around a read, if they aren't already */
+	const uint8* getArchivedData(FileWindow& window, int64 offset, int64 length);
+
+	OwnedArray<FileWindow> files;
+
+	int64 budget;
+	WorkerPool* workerPool;
+	Statistics statistics;
+
+};
+
+#endif
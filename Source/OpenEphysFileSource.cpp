@@ -26,403 +26,1655 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 OpenEphysFileSource::OpenEphysFileSource() : 
 	m_samplePos(0), 
 	totalSamplesRead(0),
-	samplesLeftInBlock(0),
-	blockIdx(0)
-{}
+	currentSegment(0),
+	convertedSource(nullptr),
+	convertedSamples(0),
+	readAheadSegment(0),
+	readAheadEnabled(false),
+	readAheadExit(false)
+{
+	nextBlock.capacity = 0;
+	nextBlock.position = 0;
+	nextBlock.numSamples = 0;
+	nextBlock.requested = false;
+	nextBlock.busy = false;
+	nextBlock.ready = false;
+
+	readAheadStats = ReadAheadStatistics();
+
+	// nothing is read until a stream is selected
+	active.index = 0;
+	active.recording = 0;
+	active.recordingStart = 0;
+	active.sampleRate = 0.0f;
+	active.startTimestamp = 0;
+	active.recordStride = RECORD_SIZE / 2;
+	active.segment = 0;
+	active.prefetchedRecord = 0;
+	active.recordIndex = nullptr;
+	active.firstEntry = 0;
+	active.numOutOfOrderRecords = 0;
+	active.numMismatchedRecords = 0;
+
+	// a few threads are plenty to keep up with real time on dense probes
+	decodePool.reset(new WorkerPool(jlimit(1, 8, SystemStats::getNumCpus())));
+	active.mappings.setWorkerPool(decodePool.get());
+
+	overviewProgress = 0.0f;
+	overviewCancel = false;
+
+	setReadAhead(true);
+}
 
+OpenEphysFileSource::~OpenEphysFileSource()
+{
+	stopOverview();
+	setReadAhead(false);
+}
 
 bool OpenEphysFileSource::open(File file)
 {
 
-    XmlDocument doc(file);
-    std::unique_ptr<XmlElement> xml = doc.getDocumentElement();
+	// One pass over the text fills flat tables of recordings, streams and channels
+	int64 startTime = Time::getHighResolutionTicks();
 
-    if (xml == 0 || !xml->hasTagName("EXPERIMENT"))
-    {
-        LOGD("File not found!");
-        return false;
-    }
+	MemoryBlock text;
+	StructureTables tables;
+	std::string error;
 
-	m_rootPath = file.getParentDirectory();
+	if (!file.loadFileAsData(text) || !StructureReader::parse(static_cast<const char*>(text.getData()), text.getSize(), tables, error))
+	{
+		LOGD("Could not read ", file.getFullPathName(), ": ", String(error));
+		return false;
+	}
 
-    for (auto* recordTag: xml->getChildIterator())
-    {
-        if (recordTag->hasTagName("RECORDING"))
-        {
+	m_rootPath = file.getParentDirectory();
 
-			Recording recording;
+	std::map<String, File> eventFiles;
+	std::set<String> spikeChannelNames;
 
-            recording.id = recordTag->getIntAttribute("number");
+	for (const StructureTables::Recording& recordingEntry : tables.recordings)
+	{
+		Recording& recording = recordings[recordingEntry.number];
+		recording.id = recordingEntry.number;
 
-            for (auto* streamTag: recordTag->getChildIterator())
-            {
+		for (int s = recordingEntry.firstStream; s < recordingEntry.firstStream + recordingEntry.numStreams; s++)
+		{
+			const StructureTables::Stream& streamEntry = tables.streams[s];
+			String streamName = String(streamEntry.sourceNodeId) + "_" + String::fromUTF8(streamEntry.name.c_str());
 
-				int sourceNodeId = streamTag->getIntAttribute("source_node_id");
-				String streamName = String(sourceNodeId) + "_" + streamTag->getStringAttribute("name");
-				String sourceNodeName = streamTag->getStringAttribute("source_node_name");
-				float sampleRate = streamTag->getIntAttribute("sample_rate") * 1.0f;
+			if (streamEntry.numChannels > 0)
+			{
+				StreamInfo& streamInfo = recording.streams[streamName];
+				const StructureTables::Channel& first = tables.channels[streamEntry.firstChannel];
 
-                for (auto* channel: streamTag->getChildIterator())
-                {
+				streamInfo.sampleRate = (float) streamEntry.sampleRate;
+				streamInfo.startPos = first.position;
 
-                    ChannelInfo info;
+				// Packed streams keep the records of all channels in one file
+				streamInfo.numPackedChannels = streamEntry.numPackedChannels;
 
-                    info.filename = channel->getStringAttribute("filename");
+				// set from the record index once all recordings are known
+				streamInfo.startTimestamp = 0;
+				streamInfo.numSamples = 0;
+				streamInfo.numRecords = 0;
+				streamInfo.firstEntry = 0;
 
-					if (channel->getTagName() == "CHANNEL")
-					{
+				streamInfo.channels.resize(streamEntry.numChannels);
 
-						info.name = channel->getStringAttribute("name");
-						info.bitVolts = channel->getStringAttribute("bitVolts").getDoubleValue();
-						info.startPos = channel->getIntAttribute("position");
+				for (int c = 0; c < streamEntry.numChannels; c++)
+				{
+					const StructureTables::Channel& channel = tables.channels[streamEntry.firstChannel + c];
+					ChannelInfo& info = streamInfo.channels[c];
+
+					info.id = c;
+					info.name = String::fromUTF8(channel.name.c_str());
+					info.bitVolts = channel.bitVolts;
+					info.filename = String::fromUTF8(channel.filename.c_str());
+					info.startPos = channel.position;
+					info.summaryFilename = String::fromUTF8(channel.summaryFilename.c_str());
+					info.summaryPos = channel.summaryPosition;
+					info.packedIndex = channel.packedIndex;
+				}
+			}
 
+			// every recording appends to the same spikes file, which starts at its first position
+			for (int c = streamEntry.firstSpikeChannel; c < streamEntry.firstSpikeChannel + streamEntry.numSpikeChannels; c++)
+			{
+				const StructureTables::SpikeChannel& channel = tables.spikeChannels[c];
+				String channelName = String::fromUTF8(channel.name.c_str());
+
+				if (spikeChannelNames.insert(streamName + "/" + channelName).second)
+					spikeReaders[streamName].add(new SpikeReader(channelName,
+						m_rootPath.getChildFile(String::fromUTF8(channel.filename.c_str())),
+						channel.position,
+						channel.numChannels,
+						channel.numSamples,
+						channel.bitVolts));
+			}
 
-						if (!recording.streams.count(streamName))
-						{
-							StreamInfo streamInfo;
+			// every recording of a stream appends to the same events file
+			if (!streamEntry.eventsFilename.empty() && !eventFiles.count(streamName))
+				eventFiles[streamName] = m_rootPath.getChildFile(String::fromUTF8(streamEntry.eventsFilename.c_str()));
 
-							streamInfo.sampleRate = sampleRate;
-							streamInfo.startPos = info.startPos;
+			// and to the same synchronized timestamps file
+			if (!streamEntry.timestampsFilename.empty() && !timestampFiles.count(streamName))
+				timestampFiles[streamName] = m_rootPath.getChildFile(String::fromUTF8(streamEntry.timestampsFilename.c_str()));
+		}
+	}
 
-							std::unique_ptr<MemoryMappedFile> timestampFileMap(new MemoryMappedFile(m_rootPath.getChildFile(info.filename), MemoryMappedFile::readOnly));
+	LOGD("Read ", tables.recordings.size(), " recordings, ", tables.streams.size(), " streams and ", tables.channels.size(), " channels in ",
+		Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime), " s");
 
-							int16* recordingNum = static_cast<int16*>(timestampFileMap->getData()) + 512 + 5;
+	// Sizes and start sample numbers of all recordings come from each stream's record index
+	StringArray streamNames;
 
-							int64* startTimestamp = reinterpret_cast<int64*>(recordingNum - 5);
+	for (auto rec : extract_keys(recordings))
+		for (auto streamName : extract_keys(recordings[rec].streams))
+			streamNames.addIfNotAlreadyThere(streamName);
 
-							int count = 0;
-							if (*recordingNum != recording.id - 1)
-							{
-								//Iterate over the file until we find the current recording number
-								while (*recordingNum < recording.id - 1)
-									recordingNum += 1035;
+	for (auto streamName : streamNames)
+		loadRecordIndex(streamName);
 
-								//Get the start timestamp for the current recording 
-								startTimestamp = reinterpret_cast<int64*>(recordingNum - 5);
+	// Load in event data
+	startTime = Time::getHighResolutionTicks();
 
-							}
+	std::vector<String> eventStreams;
+	std::vector<std::vector<int64_t>> recordingOffsets;
 
-							streamInfo.startTimestamp = *startTimestamp;
-							recording.streams[streamName] = streamInfo;
+	for (auto const& eventFile : eventFiles)
+	{
+		eventStreams.push_back(eventFile.first);
+		recordingOffsets.push_back(getRecordingOffsets(eventFile.first));
+		eventStores[eventFile.first];
+	}
 
-						}
+	// Streams are decoded in parallel; each thread only touches its own store
+	std::vector<std::thread> loaders;
+	int64 totalEvents = 0;
 
-						recording.streams[streamName].channels.push_back(info);
+	for (size_t i = 0; i < eventStreams.size(); i++)
+	{
+		File eventsFile = eventFiles[eventStreams[i]];
+		int64 nEvents = (eventsFile.getSize() - EVENT_HEADER_SIZE_IN_BYTES) / BYTES_PER_EVENT;
 
-					}
+		if (nEvents <= 0)
+			continue;
 
-                }
+		totalEvents += nEvents;
 
-            }
-			recordings[recording.id] = recording;
+		EventStore* store = &eventStores[eventStreams[i]];
+		const std::vector<int64_t>* offsets = &recordingOffsets[i];
 
-			//Update the total number of samples for each stream in the previous recording
-			if (recording.id > 1)
-			{
+		loaders.emplace_back([=]()
+		{
+			MemoryMappedFile eventFileMap(eventsFile, MemoryMappedFile::readOnly);
 
-				Recording curr = recordings[recording.id];
-				Recording prev = recordings[recording.id - 1];
+			if (eventFileMap.getData() != nullptr)
+				store->decode(static_cast<const uint8*>(eventFileMap.getData()) + EVENT_HEADER_SIZE_IN_BYTES, (size_t) nEvents, *offsets);
+		});
+	}
 
-				std::vector<String> streams;
-				for (auto const& imap : recordings[recording.id].streams)
-				{
+	for (auto& loader : loaders)
+		loader.join();
 
-					String streamName = imap.first;
+	LOGD("Loaded ", totalEvents, " events from ", loaders.size(), " streams in ",
+		Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime), " s");
 
-					long int prevStartPos = prev.streams[streamName].startPos;
-					long int currStartPos = curr.streams[streamName].startPos;
+	return true;
+}
 
-					prev.streams[streamName].numSamples = (currStartPos - prevStartPos) / 2070 * 1024;
+std::vector<int64_t> OpenEphysFileSource::getRecordingOffsets(const String& streamName)
+{
+	// Recordings are concatenated, so an event of recording n moves from its sample number to
+	// (sample number - start of recording n) + (samples in all earlier recordings)
+	std::vector<int64_t> offsets;
+	int64 samplesBefore = 0;
 
-				}
+	for (auto rec : extract_keys(recordings))
+	{
+		if (!recordings[rec].streams.count(streamName))
+			continue;
 
-				recordings[recording.id - 1] = prev;
-			}
+		const StreamInfo& stream = recordings[rec].streams[streamName];
 
-        }
-    }
+		// recording numbers in event files start at 0
+		while ((int) offsets.size() < rec)
+			offsets.push_back(stream.startTimestamp - samplesBefore);
 
-	///Update the total number of samples for the last recording
-	int numRecordings = recordings.size();
-	if (numRecordings > 0)
-	{
-		Recording last = recordings[numRecordings];
-		std::vector<String> streams;
-		for (auto const& imap : last.streams)
-		{
-			String streamName = imap.first;
+		samplesBefore += stream.numSamples;
+	}
 
-			StreamInfo info = recordings[numRecordings].streams[streamName];
-			juce::File dataFile = m_rootPath.getChildFile(info.channels[0].filename);
-			int fileSize = dataFile.getSize();
-			last.streams[streamName].numSamples = (dataFile.getSize() - info.startPos) / 2070 * 1024;
+	return offsets;
+}
 
-		}
-		recordings[recordings.size()] = last;
-	}
+bool OpenEphysFileSource::readIndexEntry(const String& streamName, int64 entryIndex, RecordIndexEntry& entry)
+{
+	const StreamIndex& index = streamIndices[streamName];
 
-	// Load in event data
-	for (auto* recordTag: xml->getChildIterator())
-    {
-        if (recordTag->hasTagName("RECORDING"))
-        {
+	if (index.loaded)
+	{
+		if (entryIndex < 0 || entryIndex >= index.entries.size())
+			return false;
 
-            int id = recordTag->getIntAttribute("number");
+		entry = index.entries[entryIndex];
+		return true;
+	}
 
-			Recording recording = recordings[id];
+	return RecordIndex::readEntry(index.file.getFullPathName().toStdString(), entryIndex, entry);
+}
 
-            for (auto* streamTag: recordTag->getChildIterator())
-            {
+void OpenEphysFileSource::loadRecordIndex(const String& streamName)
+{
+	// Records of consecutive recordings follow each other in the stream's (first) data file
+	std::vector<int> ids;
 
-				int sourceNodeId = streamTag->getIntAttribute("source_node_id");
-				String streamName = String(sourceNodeId) + "_" + streamTag->getStringAttribute("name");
-				String sourceNodeName = streamTag->getStringAttribute("source_node_name");
-				float sampleRate = streamTag->getIntAttribute("sample_rate") * 1.0f;
+	for (auto rec : extract_keys(recordings))
+		if (recordings[rec].streams.count(streamName))
+			ids.push_back(rec);
 
-                for (auto* channel: streamTag->getChildIterator())
-                {
+	const StreamInfo& first = recordings[ids[0]].streams[streamName];
 
-                    ChannelInfo info;
+	File dataFile = m_rootPath.getChildFile(first.channels[0].filename);
+	const int64 bytesPerBlock = int64(RECORD_SIZE) * jmax(1, first.numPackedChannels);
+	const int64 numRecords = jmax(int64(0), (MappingManager::getFileSize(dataFile) - first.startPos) / bytesPerBlock);
 
-                    info.filename = channel->getStringAttribute("filename");
+	StreamIndex& index = streamIndices[streamName];
+	index.file = m_rootPath.getChildFile(first.channels[0].filename + ".index");
+	index.loaded = false;
 
-					if (channel->getTagName() == "EVENTS")
-					{
+	// The index written with the data is used as long as it covers every record; otherwise
+	// (older data, or an interrupted recording) it is rebuilt from the record headers once
+	RecordIndexEntry entry;
+	int64 numEntries = RecordIndex::countEntries(index.file.getFullPathName().toStdString());
+	bool valid = numEntries > 0 && readIndexEntry(streamName, 0, entry);
 
-						File eventsFile = m_rootPath.getChildFile(info.filename);
-						int nEvents = (eventsFile.getSize() - EVENT_HEADER_SIZE_IN_BYTES) / BYTES_PER_EVENT;
+	index.firstOffset = valid ? entry.offset : first.startPos;
 
-						if (nEvents > 0 && !eventInfoMap.count(streamName))
-						{
-							std::unique_ptr<MemoryMappedFile> eventFileMap(new MemoryMappedFile(eventsFile, MemoryMappedFile::readOnly));
+	valid = valid && index.firstOffset <= first.startPos
+		&& numEntries >= (first.startPos - index.firstOffset) / bytesPerBlock + numRecords;
 
-							EventInfo eventInfo;
+	for (int i = 0; valid && i < ids.size(); i++)
+	{
+		const StreamInfo& stream = recordings[ids[i]].streams[streamName];
+		int64 entryIndex = (stream.startPos - index.firstOffset) / bytesPerBlock;
 
-							for (int i = 0; i < nEvents; i++)
-							{
+		valid = stream.startPos >= first.startPos
+			&& (stream.startPos == MappingManager::getFileSize(dataFile) || (readIndexEntry(streamName, entryIndex, entry) && entry.offset == stream.startPos));
+	}
 
-								int64* timestamp = static_cast<int64*>(eventFileMap->getData()) + EVENT_HEADER_SIZE_IN_BYTES / 8 + i * sizeof(int64) / 4;
-								uint8* eventType = static_cast<uint8*>(eventFileMap->getData()) + EVENT_HEADER_SIZE_IN_BYTES + i * BYTES_PER_EVENT + 10;
-								uint8* sourceID = static_cast<uint8*>(eventFileMap->getData()) + EVENT_HEADER_SIZE_IN_BYTES + i * BYTES_PER_EVENT + 11;
-								uint8* channelState = static_cast<uint8*>(eventFileMap->getData()) + EVENT_HEADER_SIZE_IN_BYTES + i * BYTES_PER_EVENT + 12;
-								uint8* channel = static_cast<uint8*>(eventFileMap->getData()) + EVENT_HEADER_SIZE_IN_BYTES + i * BYTES_PER_EVENT + 13;
-								uint16* recordingNum = reinterpret_cast<uint16*>(channel + 1);
+	if (!valid)
+	{
+		int64 startTime = Time::getHighResolutionTicks();
 
-								eventInfo.channels.push_back(*channel);
-								eventInfo.channelStates.push_back(*channelState);
+		index.firstOffset = first.startPos;
+		index.loaded = index.entries.build(dataFile.getFullPathName().toStdString(), first.startPos, bytesPerBlock);
 
-								// Correct event timestamp offsets based on the current recording number
-								int64 offset = recordings[1].streams[streamName].startTimestamp;
-								if (*recordingNum > 0)
-								{
+		std::string header = "header.format = 'Open Ephys Data Format'; \n";
+		header += "header.version = " + std::string(VERSION_STRING) + "; \n";
+		header += "header.header_bytes = " + std::to_string(HEADER_SIZE) + ";\n";
+		header += "header.description = 'each record contains one int64 byte offset into the data file, one int64 sample number, "
+			"one uint16 recordingNumber, one uint16 sample count and one uint32 flags field (rebuilt by the File Reader)'; \n";
+		header += "header.stream = '" + streamName.toStdString() + "';\n";
 
-									int numRecordings = *recordingNum + 1;
-									while (numRecordings > 1)
-									{
-										Recording curr = recordings[numRecordings];
-										Recording prev = recordings[numRecordings - 1];
-										offset += curr.streams[streamName].startTimestamp - (prev.streams[streamName].numSamples + prev.streams[streamName].startTimestamp); 
-										numRecordings--;
-									}
+		// if the directory isn't writable the index just stays in memory
+		bool saved = index.loaded && index.entries.save(index.file.getFullPathName().toStdString(), header);
 
-								}
+		LOGC("Built record index for ", streamName, " (", index.entries.size(), " records) in ",
+			Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime), " s", saved ? "" : " (not saved)");
+	}
 
-								eventInfo.timestamps.push_back(*timestamp - offset);
+	for (int i = 0; i < ids.size(); i++)
+	{
+		StreamInfo& stream = recordings[ids[i]].streams[streamName];
 
-							}
+		int64 endPos = i + 1 < ids.size() ? recordings[ids[i + 1]].streams[streamName].startPos : first.startPos + numRecords * bytesPerBlock;
 
-							eventInfoMap[streamName] = eventInfo;
+		stream.firstEntry = (stream.startPos - index.firstOffset) / bytesPerBlock;
+		stream.numRecords = jmax(int64(0), (endPos - stream.startPos) / bytesPerBlock);
 
-						}
+		RecordIndexEntry firstRecord, lastRecord;
 
-					}
-				}
-			}
+		// records can skip samples (e.g. event-gated recordings), so the length comes from the last record
+		if (stream.numRecords > 0
+			&& readIndexEntry(streamName, stream.firstEntry, firstRecord)
+			&& readIndexEntry(streamName, stream.firstEntry + stream.numRecords - 1, lastRecord))
+		{
+			stream.startTimestamp = firstRecord.sampleNumber;
+			stream.numSamples = lastRecord.sampleNumber + BLOCK_LENGTH - firstRecord.sampleNumber;
+		}
+		else
+		{
+			stream.numRecords = 0;
+			stream.startTimestamp = 0;
+			stream.numSamples = 0;
 		}
 	}
-
-	return true;
 }
 
 void OpenEphysFileSource::fillRecordInfo()
 {
 
-	// Note: Currently all recordings are concatenated into a single recording. 
-	int recordingNum = 1;
+	selectableRecords.clear();
 
-	for (auto streamName : extract_keys(recordings[recordingNum].streams))
-	{
+	// Every stream with all its recordings concatenated together (in order)
+	for (auto streamName : extract_keys(recordings[1].streams))
+		addRecordInfo(streamName, 0);
+
+	// and each recording on its own, so a single trial can be played without sizing or mapping the others
+	if (recordings.size() > 1)
+		for (auto rec : extract_keys(recordings))
+			for (auto streamName : extract_keys(recordings[rec].streams))
+				addRecordInfo(streamName, rec);
+
+}
+
+void OpenEphysFileSource::addRecordInfo(const String& streamName, int recording)
+{
+	const StreamInfo& stream = recordings[jmax(1, recording)].streams[streamName];
 
-		RecordInfo info;
+	RecordInfo info;
 
-		info.name = String(streamName);
-		info.sampleRate = recordings[1].streams[streamName].sampleRate;
-		juce::File dataFile = m_rootPath.getChildFile(recordings[recordingNum].streams[streamName].channels[0].filename);
+	info.name = recording > 0 ? streamName + " (recording " + String(recording) + ")" : streamName;
+	info.sampleRate = stream.sampleRate;
+	info.numSamples = stream.numSamples;
 
-		// Add the number of samples for each recording since they are all concatenated
+	// Add the number of samples for each recording if they are all concatenated
+	if (recording == 0)
+	{
 		info.numSamples = 0;
+
 		for (auto rec : extract_keys(recordings))
-			info.numSamples += recordings[rec].streams[streamName].numSamples;
+			if (recordings[rec].streams.count(streamName))
+				info.numSamples += recordings[rec].streams[streamName].numSamples;
+	}
 
-		for (int i = 0; i < recordings[recordingNum].streams[streamName].channels.size(); i++)
-		{
-			RecordedChannelInfo cInfo;
+	for (int i = 0; i < stream.channels.size(); i++)
+	{
+		RecordedChannelInfo cInfo;
 
-			cInfo.name = recordings[recordingNum].streams[streamName].channels[i].name;
-			cInfo.bitVolts = recordings[recordingNum].streams[streamName].channels[i].bitVolts;
-				
-			info.channels.add(cInfo);
-		}
-		infoArray.add(info);
-		numRecords++;
-			
+		cInfo.name = stream.channels[i].name;
+		cInfo.bitVolts = stream.channels[i].bitVolts;
+
+		info.channels.add(cInfo);
 	}
 
+	infoArray.add(info);
+	numRecords++;
+
+	selectableRecords.push_back({ streamName, recording });
 }
 
 void OpenEphysFileSource::updateActiveRecord(int index)
 {
 
+	// the background threads must not touch the old stream's files any more
+	stopOverview();
+
+	{
+		std::unique_lock<std::mutex> lock(readAheadMutex);
+		waitForReadAhead(lock);
+
+		nextBlock.requested = false;
+		nextBlock.ready = false;
+		readAheadSegment = 0;
+	}
+
 	activeRecord.set(index);
-	dataFiles.clear();
 
-	// Note: All recordings are concatenated together (in order) into a single recording
-	// This may need to change if individual recordings get sufficiently large. 
-	int selectedRecording = 1; 
-	currentStream = extract_keys(recordings[selectedRecording].streams)[index];
+	if (active.channelFiles.size() > 0)
+	{
+		MappingManager::Statistics stats = active.mappings.getStatistics();
+
+		LOGD("Closing ", currentStream, ": ", stats.numMappings, " mappings, ", stats.numRemaps, " remaps, peak ",
+			stats.peakMappedBytes / (1 << 20), " MB mapped");
+	}
+
+	blockCache.clear();
+	summaryFiles.clear();
+	summaryData.clear();
+	numSummaries.clear();
+
+	setUpStream(active, index);
+
+	currentStream = active.name;
+	currentSegment = 0;
+
+	const StreamInfo& stream = recordings[jmax(1, active.recording)].streams[currentStream];
+
+	// Packed streams share one summary file between all channels
+	const int summaryStride = jmax(1, stream.numPackedChannels);
 
 	for (int i = 0; i < infoArray[index].channels.size(); i++)
 	{
-		juce::File dataFile = m_rootPath.getChildFile(recordings[selectedRecording].streams[currentStream].channels[i].filename);
-		dataFiles.add(new MemoryMappedFile(dataFile, juce::MemoryMappedFile::readOnly));
+		const ChannelInfo& channelInfo = stream.channels[i];
+		const int slot = jmax(0, channelInfo.packedIndex);
+
+		File summaryFile = m_rootPath.getChildFile(channelInfo.summaryFilename);
+
+		if (channelInfo.summaryFilename.isNotEmpty() && summaryFile.existsAsFile())
+		{
+			if (summaryFiles.isEmpty() || stream.numPackedChannels == 0)
+				summaryFiles.add(new MemoryMappedFile(summaryFile, MemoryMappedFile::readOnly));
+
+			const uint8* summaries = static_cast<const uint8*>(summaryFiles.getLast()->getData());
+			int64 numFrames = ((int64) summaryFiles.getLast()->getSize() - channelInfo.summaryPos) / sizeof(RecordSummary) / summaryStride;
+
+			// the summaries of later recordings follow those of a selected one
+			if (active.recording > 0)
+				numFrames = jmin(numFrames, stream.numRecords);
+
+			summaryData.add(reinterpret_cast<const RecordSummary*>(summaries + channelInfo.summaryPos) + slot);
+			numSummaries.add(numFrames);
+		}
+		else
+		{
+			summaryData.add(nullptr);
+			numSummaries.add(0);
+		}
 	}
 
 	m_samplePos = 0;
 
-	blockIdx = 0;
-	samplesLeftInBlock = 0;
-
 	numActiveChannels = getActiveNumChannels();
+	missingRecord.calloc(BLOCK_LENGTH);
+
+	// sized up front, so the audio thread never allocates
+	convertedData.malloc(jmax(1, numActiveChannels) * MAX_CONVERTED_SAMPLES);
+	convertedChannels.malloc(jmax(1, numActiveChannels));
+	convertedSource = nullptr;
+	convertedSamples = 0;
 
 	totalSamples = infoArray[activeRecord.get()].numSamples;
-	totalBlocks = totalSamples / 1024; //1024 samples per block
 
 	bitVolts.clear();
 
 	for (int i = 0; i < numActiveChannels; i++)
 		bitVolts.add(getChannelInfo(index, i).bitVolts);
+
+	startOverview();
 }
 
-void OpenEphysFileSource::seekTo(int64 sample)
+void OpenEphysFileSource::clearStream(StreamReader& reader)
 {
-	m_samplePos = sample % getActiveNumSamples();
+	// packed channels share the registration of their stream's file
+	for (int i = 0; i < reader.scheduledFiles.size(); i++)
+		if ((i == 0 || reader.channelFiles[i] != reader.channelFiles[i - 1]) && reader.scheduledFiles[i] >= 0)
+			ioScheduler.removeFile(reader.scheduledFiles[i]);
+
+	reader.mappings.clear();
+	reader.channelFiles.clear();
+	reader.scheduledFiles.clear();
+	reader.channelOffsets.clear();
 }
 
-int OpenEphysFileSource::readData(int16* buffer, int nSamples)
+void OpenEphysFileSource::setUpStream(StreamReader& reader, int index)
 {
+	clearStream(reader);
 
-	int64 samplesToRead = nSamples;
+	reader.channels.clear();
+	reader.prefetchedRecord = 0;
 
-	// Check if we're at the end of the file
-	if (m_samplePos + nSamples > getActiveNumSamples())
-		samplesToRead = getActiveNumSamples() - m_samplePos;
+	const SelectableRecord& selected = selectableRecords[index];
 
-	readSamples(buffer, samplesToRead);
+	reader.name = selected.streamName;
+	reader.index = index;
+	reader.recording = selected.recording;
 
-	m_samplePos += samplesToRead;
+	// All recordings are concatenated together (in order) unless a single one is selected;
+	// the first one describes the channels and files of the concatenation
+	const StreamInfo& stream = recordings[jmax(1, selected.recording)].streams[reader.name];
 
-	return samplesToRead;
+	reader.recordingStart = 0;
+
+	if (selected.recording > 0)
+		for (auto rec : extract_keys(recordings))
+			if (rec < selected.recording && recordings[rec].streams.count(reader.name))
+				reader.recordingStart += recordings[rec].streams[reader.name].numSamples;
+
+	reader.sampleRate = stream.sampleRate;
+	reader.startTimestamp = stream.startTimestamp;
+
+	// Packed streams share one data file between all channels
+	reader.recordStride = int64(RECORD_SIZE / 2) * jmax(1, stream.numPackedChannels);
+
+	const int64 recordingBytes = stream.numRecords * reader.recordStride * int64(sizeof(int16));
+
+	// a few records (or packed frames) per file at the very least, whatever the budget
+	const int64 minimumWindow = 4 * reader.recordStride * int64(sizeof(int16));
+
+	for (int i = 0; i < infoArray[index].channels.size(); i++)
+	{
+		const ChannelInfo& channelInfo = stream.channels[i];
+		const int slot = jmax(0, channelInfo.packedIndex);
+
+		// Data files are only mapped a window at a time, as they are read
+		if (i == 0 || stream.numPackedChannels == 0)
+		{
+			File dataFile = m_rootPath.getChildFile(channelInfo.filename);
+
+			// a single recording never maps (or reads) anything outside its own records
+			Range<int64> byteRange;
+
+			if (selected.recording > 0)
+				byteRange = Range<int64>(channelInfo.startPos, channelInfo.startPos + recordingBytes);
+
+			reader.channelFiles.add(reader.mappings.addFile(dataFile, minimumWindow, byteRange));
+
+			// archived files are read (and decompressed) by the read-ahead thread itself, not advised
+			reader.scheduledFiles.add(MappingManager::isArchived(dataFile) ? -1 : ioScheduler.addFile(dataFile.getFullPathName().toStdString()));
+		}
+		else
+		{
+			reader.channelFiles.add(reader.channelFiles.getLast());
+			reader.scheduledFiles.add(reader.scheduledFiles.getLast());
+		}
+
+		reader.channelOffsets.add(channelInfo.startPos + int64(slot) * RECORD_SIZE + RECORD_HEADER_SIZE);
+		reader.channels.add(i);
+	}
 
+	reader.recordSources.malloc(jmax(1, reader.channelFiles.size()));
+
+	buildSegments(reader);
 }
 
-void OpenEphysFileSource::processChannelData(int16* inBuffer, float* outBuffer, int channel, int64 numSamples)
+void OpenEphysFileSource::setPlaybackStreams(const Array<int>& indices)
 {
+	// reads share the block cache and the I/O scheduler with the read-ahead thread
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
 
-	// Convert data from inBuffer to outBuffer based on numSamples for each channel
+	for (StreamReader* reader : playbackStreams)
+		clearStream(*reader);
 
-	for (int i = 0; i < numSamples; i++)
+	playbackStreams.clear();
+
+	for (int index : indices)
 	{
-		int16 hibyte = (*(inBuffer + (numActiveChannels * i) + channel) & 0x00ff) << 8;
-		int16 lobyte = (*(inBuffer + (numActiveChannels * i) + channel) & 0xff00) >> 8;
-		*(outBuffer + i) = ( lobyte | hibyte ) * bitVolts[channel];
+		if (index < 0 || index >= infoArray.size())
+			continue;
+
+		StreamReader* reader = playbackStreams.add(new StreamReader());
+		reader->mappings.setBudget(active.mappings.getBudget());
+		reader->mappings.setWorkerPool(decodePool.get());
+
+		setUpStream(*reader, index);
 	}
+
+	missingRecord.calloc(BLOCK_LENGTH);
 }
 
-void OpenEphysFileSource::processEventData(EventInfo &eventInfo, int64 start, int64 stop) 
-{ 
+int OpenEphysFileSource::getNumPlaybackStreams() const
+{
+	return playbackStreams.size();
+}
+
+int OpenEphysFileSource::getPlaybackBufferSize(int stream, int numSamples) const
+{
+	if (stream < 0 || stream >= playbackStreams.size() || active.sampleRate <= 0)
+		return 0;
 
-	// Find all event data within this start/stop interval
+	// one more sample than the ratio of the rates, as block boundaries are rounded in each stream
+	return (int) std::ceil(numSamples * double(playbackStreams[stream]->sampleRate) / active.sampleRate) + 1;
+}
+
+int64 OpenEphysFileSource::getAlignedPosition(const StreamReader& reader, int64 activePosition) const
+{
+	if (active.sampleRate <= 0)
+		return activePosition;
+
+	const double seconds = double(active.startTimestamp + activePosition) / active.sampleRate;
+
+	return (int64) std::floor(seconds * reader.sampleRate + 0.5) - reader.startTimestamp;
+}
+
+void OpenEphysFileSource::readStreams(int64 position, int numSamples, int16* const* buffers, int* numRead)
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
 
-	int local_start = start % getActiveNumSamples();;
-	int local_stop = stop % getActiveNumSamples();
-	int loop_count = start / getActiveNumSamples();
+	for (int i = 0; i < playbackStreams.size(); i++)
+	{
+		StreamReader& reader = *playbackStreams[i];
+
+		// consecutive blocks of the active stream map to consecutive blocks of each stream
+		const int64 start = getAlignedPosition(reader, position);
+		const int64 count = jlimit(int64(0), int64(getPlaybackBufferSize(i, numSamples)), getAlignedPosition(reader, position + numSamples) - start);
+
+		readSamples(reader, buffers[i], start, count, reader.channels.getRawDataPointer(), reader.channels.size(), reader.segment);
+		numRead[i] = (int) count;
+	}
+
+	// the following records of every stream go to the scheduler together, so it can order them on disk
+	for (auto* reader : playbackStreams)
+		prefetchAfter(*reader, getAlignedPosition(*reader, position + numSamples), reader->segment);
+}
+
+IoScheduler::Statistics OpenEphysFileSource::getIoStatistics() const
+{
+	return ioScheduler.getStatistics();
+}
 
-	EventInfo info = eventInfoMap[currentStream];
+uint64 OpenEphysFileSource::getSourceSignature() const
+{
+	// FNV-1a over the names, sizes and modification times of the stream's data files
+	uint64 hash = 14695981039346656037ull;
 
-	int i = 0;
+	auto addBytes = [&hash](const void* bytes, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= static_cast<const uint8*>(bytes)[i];
+			hash *= 1099511628211ull;
+		}
+	};
 
-	while (i < info.timestamps.size())
+	for (auto rec : extract_keys(recordings))
 	{
-		if (info.timestamps[i] >= local_start && info.timestamps[i] <= local_stop)
+		auto stream = recordings.find(rec)->second.streams.find(currentStream);
+
+		if (stream == recordings.find(rec)->second.streams.end())
+			continue;
+
+		for (const ChannelInfo& channel : stream->second.channels)
 		{
-			eventInfo.channels.push_back(info.channels[i]);
-			eventInfo.channelStates.push_back((info.channelStates[i]));
-			eventInfo.timestamps.push_back(info.timestamps[i] + loop_count * getActiveNumSamples());
+			File dataFile = m_rootPath.getChildFile(channel.filename);
+
+			std::string name = channel.filename.toStdString();
+			int64 size = MappingManager::getFileSize(dataFile);
+			int64 modified = dataFile.getLastModificationTime().toMilliseconds();
+
+			addBytes(name.data(), name.size());
+			addBytes(&size, sizeof(size));
+			addBytes(&modified, sizeof(modified));
 		}
-		i++;
 	}
 
-};
+	addBytes(&totalSamples, sizeof(totalSamples));
 
+	return hash;
+}
 
-void OpenEphysFileSource::readSamples(int16* buffer, int64 samplesToRead)
+void OpenEphysFileSource::startOverview()
 {
+	overviewProgress = 0.0f;
+	overviewCancel = false;
 
-	/* Organize samples into a vector that mimics BinaryFormat */
-	std::vector<int16> samples;
+	if (numActiveChannels == 0)
+		return;
 
-	/* Read rest of previous block */
-	if (samplesLeftInBlock > 0) 
-	{
-		for (int i = 0; i < samplesLeftInBlock; i++) 
-			for (int j = 0; j < numActiveChannels; j++)
-				samples.push_back(*(static_cast<int16*>(dataFiles[j]->getData()) + 518 + blockIdx*1035 + (1024 - samplesLeftInBlock) + i));
+	// file names come from the selected recording, like the mappings set up for it
+	auto recording = recordings.find(jmax(1, active.recording));
+
+	if (recording == recordings.end())
+		return;
 
-		totalSamplesRead += samplesLeftInBlock;
+	auto stream = recording->second.streams.find(currentStream);
+
+	if (stream == recording->second.streams.end())
+		return;
+
+	// The thread gets its own copy of everything it needs, and its own mappings
+	std::vector<File> files;
+	std::vector<int> fileOfChannel;
+	std::vector<int64> offsets;
+	std::vector<const RecordSummary*> summaries;
+	std::vector<int64> summaryCounts;
+
+	for (int i = 0; i < numActiveChannels; i++)
+	{
+		if (i == 0 || active.channelFiles[i] != active.channelFiles[i - 1])
+			files.push_back(m_rootPath.getChildFile(stream->second.channels[i].filename));
 
-		samplesToRead -= samplesLeftInBlock;
-		samplesLeftInBlock = 0;
-		blockIdx = (blockIdx + 1) % (totalBlocks);
+		fileOfChannel.push_back((int) files.size() - 1);
+		offsets.push_back(active.channelOffsets[i]);
+		summaries.push_back(summaryData[i]);
+		summaryCounts.push_back(numSummaries[i]);
+	}
 
-	} 
+	const Array<RecordSegment> streamSegments = active.segments;
+	const int64 stride = active.recordStride;
+	const int64 numSamples = totalSamples;
+	const uint64 signature = getSourceSignature();
+	const String streamName = currentStream;
+	const String recordingSuffix = active.recording > 0 ? "_recording" + String(active.recording) : String();
+	const File overviewFile = m_rootPath.getChildFile(currentStream + recordingSuffix + ".overview");
 
-	/* Read full blocks */
-	while (samplesToRead >= 1024)
+	overviewThread = std::thread([=]()
 	{
-		for (int i = 0; i < 1024; i++)
-			for (int j = 0; j < numActiveChannels; j++)
-				samples.push_back(*(static_cast<int16*>(dataFiles[j]->getData()) + 518 + blockIdx*1035 + i));
+		std::unique_ptr<OverviewPyramid> pyramid(new OverviewPyramid());
+
+		if (pyramid->load(overviewFile.getFullPathName().toStdString(), signature))
+		{
+			std::lock_guard<std::mutex> lock(overviewMutex);
+			overview = std::move(pyramid);
+			overviewProgress = 1.0f;
+			return;
+		}
+
+		int64 startTime = Time::getHighResolutionTicks();
+
+		MappingManager maps;
+		maps.setBudget(int64(64) << 20);
+
+		for (const File& file : files)
+			maps.addFile(file, 4 * stride * int64(sizeof(int16)));
+
+		const int numChannels = (int) offsets.size();
+		const int summaryStride = (int) (stride / (RECORD_SIZE / 2));
+
+		pyramid->reset(numChannels, numSamples);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			for (const RecordSegment& segment : streamSegments)
+			{
+				for (int64 k = 0; k < segment.numRecords; k++)
+				{
+					if (overviewCancel)
+						return;
+
+					const int64 record = segment.firstRecord + k;
+					int16 minimum, maximum;
+
+					// write-time summaries save reading the samples
+					if (summaries[c] != nullptr && record < summaryCounts[c])
+					{
+						minimum = summaries[c][record * summaryStride].minimum;
+						maximum = summaries[c][record * summaryStride].maximum;
+					}
+					else
+					{
+						const int64 length = BLOCK_LENGTH * int64(sizeof(int16));
+						const uint8* data = maps.getData(fileOfChannel[c], offsets[c] + record * stride * int64(sizeof(int16)), length);
+
+						if (data == nullptr)
+							continue;
+
+						minimum = INT16_MAX;
+						maximum = INT16_MIN;
+
+						for (int i = 0; i < BLOCK_LENGTH; i++)
+						{
+							uint16 value = (uint16(data[2 * i]) << 8) | data[2 * i + 1];
+							minimum = jmin(minimum, int16(value));
+							maximum = jmax(maximum, int16(value));
+						}
+					}
+
+					pyramid->add(c, segment.firstSample + k * BLOCK_LENGTH, BLOCK_LENGTH, minimum, maximum);
+				}
+			}
+
+			overviewProgress = float(c + 1) / numChannels;
+		}
+
+		pyramid->finish();
+
+		std::string header = "header.format = 'Open Ephys Data Format'; \n";
+		header += "header.version = " + std::string(VERSION_STRING) + "; \n";
+		header += "header.header_bytes = " + std::to_string(HEADER_SIZE) + ";\n";
+		header += "header.description = 'min/max overview of each channel: an OverviewFileHeader, then for each channel and each level "
+			"one int16 minimum and one int16 maximum per bin of " + std::to_string(OverviewPyramid::BASE_BIN) + " x "
+			+ std::to_string(OverviewPyramid::FACTOR) + "^level samples'; \n";
+		header += "header.stream = '" + streamName.toStdString() + "';\n";
 
-		totalSamplesRead += 1024;
+		bool saved = pyramid->save(overviewFile.getFullPathName().toStdString(), header, signature);
 
-		blockIdx = (blockIdx + 1) % (totalBlocks);
-		samplesToRead -= 1024;
+		LOGC("Built overview of ", streamName, " (", pyramid->getNumLevels(), " levels) in ",
+			Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime), " s", saved ? "" : " (not saved)");
 
+		std::lock_guard<std::mutex> lock(overviewMutex);
+		overview = std::move(pyramid);
+	});
+}
+
+void OpenEphysFileSource::stopOverview()
+{
+	overviewCancel = true;
+
+	if (overviewThread.joinable())
+		overviewThread.join();
+
+	std::lock_guard<std::mutex> lock(overviewMutex);
+	overview.reset();
+}
+
+bool OpenEphysFileSource::getOverview(int channel, int64 start, int64 end, int numPixels, float* minimums, float* maximums)
+{
+	std::lock_guard<std::mutex> lock(overviewMutex);
+
+	if (overview == nullptr || channel < 0 || channel >= numActiveChannels || numPixels <= 0)
+		return false;
+
+	envelope.malloc(2 * numPixels);
+	overview->getEnvelope(channel, start, end, numPixels, envelope, envelope + numPixels);
+
+	const float scale = bitVolts[channel];
+
+	for (int i = 0; i < numPixels; i++)
+	{
+		minimums[i] = envelope[i] * scale;
+		maximums[i] = envelope[numPixels + i] * scale;
 	}
 
-	/* Read only some of next block */
-	if (samplesToRead > 0)
+	return true;
+}
+
+float OpenEphysFileSource::getOverviewProgress() const
+{
+	return overviewProgress;
+}
+
+void OpenEphysFileSource::buildSegments(StreamReader& reader)
+{
+	reader.segments.clear();
+	reader.segment = 0;
+	reader.recordIndex = nullptr;
+	reader.firstEntry = 0;
+	reader.numOutOfOrderRecords = 0;
+	reader.numMismatchedRecords = 0;
+
+	const String& streamName = reader.name;
+	StreamIndex& index = streamIndices[streamName];
+
+	if (!index.loaded)
+		index.loaded = index.entries.load(index.file.getFullPathName().toStdString());
+
+	if (!index.loaded)
+		return;
+
+	// Recordings are concatenated in sample positions; channelOffsets point at the first record of the first one
+	int64 firstEntry = -1;
+	int64 recordingStart = 0;
+
+	for (auto rec : extract_keys(recordings))
 	{
-		for (int i = 0; i < samplesToRead; i++) 
-			for (int j = 0; j < numActiveChannels; j++)
-				samples.push_back(*(static_cast<int16*>(dataFiles[j]->getData()) + 518 + blockIdx*1035 + i));
+		if (!recordings[rec].streams.count(streamName) || (reader.recording > 0 && rec != reader.recording))
+			continue;
+
+		const StreamInfo& stream = recordings[rec].streams[streamName];
+		int64 expected = -1;
+		bool skipped = false;
+
+		if (firstEntry < 0)
+			firstEntry = stream.firstEntry;
+
+		for (int64 i = stream.firstEntry; i < stream.firstEntry + stream.numRecords && i < index.entries.size(); i++)
+		{
+			const int64 sampleNumber = index.entries[i].sampleNumber;
+
+			/* A record starting before the previous one ended (a repeated buffer or a damaged header)
+			   has no place of its own, so it's left out and the next record starts a new segment */
+			if (sampleNumber < expected)
+			{
+				reader.numOutOfOrderRecords++;
+				skipped = true;
+				continue;
+			}
 
-		totalSamplesRead += samplesToRead;
+			if (sampleNumber != expected || skipped)
+			{
+				RecordSegment segment;
+				segment.firstSample = recordingStart + sampleNumber - stream.startTimestamp;
+				segment.firstRecord = i - firstEntry;
+				segment.numRecords = 0;
+				reader.segments.add(segment);
+				skipped = false;
+			}
+
+			reader.segments.getReference(reader.segments.size() - 1).numRecords++;
+			expected = sampleNumber + BLOCK_LENGTH;
+		}
+
+		recordingStart += stream.numSamples;
+	}
+
+	reader.recordIndex = &index.entries;
+	reader.firstEntry = jmax(int64(0), firstEntry);
+
+	if (reader.segments.size() > 1)
+		LOGD("Stream ", streamName, " has ", reader.segments.size() - 1, " gaps between records");
 
-		samplesLeftInBlock = 1024 - samplesToRead;
+	if (reader.numOutOfOrderRecords > 0)
+		LOGC("Stream ", streamName, ": skipped ", reader.numOutOfOrderRecords, " records with out of order sample numbers");
+}
+
+Array<OpenEphysFileSource::Gap> OpenEphysFileSource::getGaps() const
+{
+	Array<Gap> gaps;
+	int64 recorded = 0;
+
+	// everything between the end of one segment and the start of the next
+	for (const RecordSegment& segment : active.segments)
+	{
+		if (segment.firstSample > recorded)
+			gaps.add({ recorded, segment.firstSample - recorded });
 
+		recorded = jmax(recorded, segment.firstSample + segment.numRecords * BLOCK_LENGTH);
 	}
 
-	memcpy(buffer, &samples[0], samples.size()*sizeof(int16));
+	return gaps;
+}
+
+OpenEphysFileSource::RecordValidation OpenEphysFileSource::getRecordValidation() const
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	RecordValidation validation;
+	validation.numOutOfOrderRecords = active.numOutOfOrderRecords;
+	validation.numMismatchedRecords = active.numMismatchedRecords;
+
+	return validation;
+}
+
+const RecordSummary* OpenEphysFileSource::getRecordSummaries(int channel, int64& num, int& stride) const
+{
+	num = 0;
+	stride = (int) (active.recordStride / (RECORD_SIZE / 2));
+
+	if (channel < 0 || channel >= summaryData.size() || summaryData[channel] == nullptr)
+		return nullptr;
+
+	num = numSummaries[channel];
+
+	return summaryData[channel];
+}
+
+bool OpenEphysFileSource::getChannelStatistics(int channel, int64 firstRecord, int64 numRecords, ChannelStatistics& stats) const
+{
+	int64 available;
+	int stride;
+	const RecordSummary* summaries = getRecordSummaries(channel, available, stride);
+
+	if (summaries == nullptr || firstRecord < 0 || firstRecord >= available)
+		return false;
+
+	numRecords = jmin(numRecords, available - firstRecord);
+
+	int minimum = INT16_MAX;
+	int maximum = INT16_MIN;
+	double sum = 0;
+	double sumOfSquares = 0;
+	int64 numSamples = 0;
+
+	for (int64 i = firstRecord; i < firstRecord + numRecords; i++)
+	{
+		const RecordSummary& summary = summaries[i * stride];
+
+		minimum = jmin(minimum, (int) summary.minimum);
+		maximum = jmax(maximum, (int) summary.maximum);
+		sum += (double) summary.sum;
+		sumOfSquares += (double) summary.sumOfSquares;
+		numSamples += summary.numSamples;
+	}
+
+	if (numSamples == 0)
+		return false;
+
+	const float channelBitVolts = bitVolts[channel];
+
+	stats.minimum = minimum * channelBitVolts;
+	stats.maximum = maximum * channelBitVolts;
+	stats.mean = float(sum / numSamples) * channelBitVolts;
+	stats.rms = float(std::sqrt(sumOfSquares / numSamples)) * channelBitVolts;
+	stats.numSamples = numSamples;
+
+	return true;
+}
+
+void OpenEphysFileSource::seekTo(int64 sample)
+{
+	const int64 numSamples = getActiveNumSamples();
+
+	m_samplePos = numSamples > 0 ? sample % numSamples : 0;
+
+	// the next read starts directly at the right record, wherever it is
+	currentSegment = findSegment(active, m_samplePos, currentSegment);
+}
+
+int OpenEphysFileSource::findSegment(const StreamReader& reader, int64 position, int hint) const
+{
+	const int numSegments = reader.segments.size();
+
+	if (numSegments == 0)
+		return 0;
+
+	// Reads usually continue in the same segment or move on to the next one
+	for (int i = jmax(0, hint); i < jmin(hint + 2, numSegments); i++)
+		if (reader.segments[i].firstSample <= position && (i + 1 == numSegments || reader.segments[i + 1].firstSample > position))
+			return i;
+
+	// otherwise: last segment starting at or before the position (or the first one)
+	int low = 0;
+	int high = numSegments - 1;
+
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+
+		if (reader.segments[middle].firstSample <= position)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	return low;
+}
+
+int64 OpenEphysFileSource::readRange(const Array<int>& channels, int64 startSample, int64 numSamples, float* const* outBuffers)
+{
+	for (int channel : channels)
+		if (channel < 0 || channel >= active.channelFiles.size())
+			return 0;
+
+	if (channels.isEmpty() || startSample < 0 || startSample >= totalSamples)
+		return 0;
+
+	numSamples = jmin(numSamples, totalSamples - startSample);
+
+	// reads share the mapped windows and scratch pointers with the read-ahead thread
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	Array<float> scales;
+
+	for (int channel : channels)
+		scales.add(bitVolts[channel]);
+
+	// Read in chunks so the scratch buffer stays small however long the range is
+	const int64 chunkSize = 4096;
+	rangeBuffer.malloc(chunkSize * channels.size());
+
+	HeapBlock<float*> destinations(channels.size());
+	int segment = findSegment(active, startSample, 0);
+
+	for (int64 done = 0; done < numSamples; done += chunkSize)
+	{
+		const int64 count = jmin(chunkSize, numSamples - done);
+
+		readSamples(active, rangeBuffer, startSample + done, count, channels.getRawDataPointer(), channels.size(), segment);
+
+		for (int i = 0; i < channels.size(); i++)
+			destinations[i] = outBuffers[i] + done;
+
+		convertSamples(rangeBuffer, channels.size(), count, scales.getRawDataPointer(), destinations);
+	}
+
+	return numSamples;
+}
+
+int OpenEphysFileSource::readData(int16* buffer, int nSamples)
+{
+
+	int64 samplesToRead = nSamples;
+
+	// Check if we're at the end of the file
+	if (m_samplePos + nSamples > getActiveNumSamples())
+		samplesToRead = getActiveNumSamples() - m_samplePos;
+
+	if (readAheadEnabled)
+		readPrepared(buffer, samplesToRead, nSamples);
+	else
+		readSamples(active, buffer, m_samplePos, samplesToRead, active.channels.getRawDataPointer(), numActiveChannels, currentSegment);
+
+	m_samplePos += samplesToRead;
+	totalSamplesRead += samplesToRead;
+
+	return samplesToRead;
+
+}
+
+void OpenEphysFileSource::processChannelData(int16* inBuffer, float* outBuffer, int channel, int64 numSamples)
+{
+
+	// The File Reader asks for the channels of each block in order, starting with channel 0, on
+	// its own thread. Channel 0 converts all of them together and the rest are copied from there.
+	// readData runs on another thread and doesn't touch any of this, so it can fill the next
+	// block (possibly at the same address) while this one is being processed.
+
+	if (numSamples > MAX_CONVERTED_SAMPLES)
+	{
+		SampleKernels::convertFromInt16BE(inBuffer + channel, 1, numActiveChannels, (int) numSamples, bitVolts.getRawDataPointer() + channel, &outBuffer);
+		return;
+	}
+
+	if (channel == 0 || inBuffer != convertedSource || numSamples != convertedSamples)
+	{
+		for (int i = 0; i < numActiveChannels; i++)
+			convertedChannels[i] = convertedData + i * numSamples;
+
+		convertChannelData(inBuffer, convertedChannels, numSamples);
+
+		convertedSource = inBuffer;
+		convertedSamples = numSamples;
+	}
+
+	memcpy(outBuffer, convertedChannels[channel], sizeof(float) * numSamples);
+}
+
+void OpenEphysFileSource::convertChannelData(const int16* inBuffer, float* const* outBuffers, int64 numSamples)
+{
+	convertSamples(inBuffer, numActiveChannels, numSamples, bitVolts.getRawDataPointer(), outBuffers);
+}
+
+void OpenEphysFileSource::setDecodeThreads(int numThreads)
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	decodePool.reset(new WorkerPool(jmax(1, numThreads)));
+
+	active.mappings.setWorkerPool(decodePool.get());
+
+	for (StreamReader* reader : playbackStreams)
+		reader->mappings.setWorkerPool(decodePool.get());
+}
+
+int OpenEphysFileSource::getDecodeThreads() const
+{
+	return decodePool->getNumThreads();
+}
+
+void OpenEphysFileSource::interleaveSamples(const int16* const* sources, int numChannels, int64 numSamples, int16* dest)
+{
+	// Each thread writes its own columns of the output, so the result doesn't depend on the split
+	if (numChannels < 2 * MIN_CHANNELS_PER_THREAD)
+	{
+		SampleKernels::interleave(sources, numChannels, (int) numSamples, dest);
+		return;
+	}
+
+	decodePool->runRanges(numChannels, MIN_CHANNELS_PER_THREAD, 8, [=](int begin, int end)
+	{
+		SampleKernels::interleave(sources + begin, end - begin, (int) numSamples, dest + begin, numChannels);
+	});
+}
+
+void OpenEphysFileSource::convertSamples(const int16* source, int numChannels, int64 numSamples, const float* scales, float* const* dest)
+{
+	if (numChannels < 2 * MIN_CHANNELS_PER_THREAD)
+	{
+		SampleKernels::convertFromInt16BE(source, numChannels, (int) numSamples, scales, dest);
+		return;
+	}
+
+	decodePool->runRanges(numChannels, MIN_CHANNELS_PER_THREAD, 8, [=](int begin, int end)
+	{
+		SampleKernels::convertFromInt16BE(source + begin, end - begin, numChannels, (int) numSamples, scales + begin, dest + begin);
+	});
+}
+
+void OpenEphysFileSource::setMappingBudget(int64 bytes)
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	active.mappings.setBudget(bytes);
+
+	for (auto* reader : playbackStreams)
+		reader->mappings.setBudget(bytes);
+}
+
+MappingManager::Statistics OpenEphysFileSource::getMappingStatistics() const
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	return active.mappings.getStatistics();
+}
+
+void OpenEphysFileSource::setBlockCacheBudget(int64 bytes)
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	blockCache.setBudget(bytes);
+}
+
+BlockCache::Statistics OpenEphysFileSource::getBlockCacheStatistics() const
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+	waitForReadAhead(lock);
+
+	return blockCache.getStatistics();
+}
+
+void OpenEphysFileSource::setReadAhead(bool enabled)
+{
+	if (enabled == readAheadEnabled)
+		return;
+
+	if (enabled)
+	{
+		readAheadExit = false;
+		readAheadThread = std::thread(&OpenEphysFileSource::runReadAhead, this);
+	}
+	else
+	{
+		{
+			std::unique_lock<std::mutex> lock(readAheadMutex);
+			readAheadExit = true;
+		}
+
+		readAheadCondition.notify_all();
+		readAheadThread.join();
+
+		nextBlock.requested = false;
+		nextBlock.ready = false;
+	}
+
+	readAheadEnabled = enabled;
+}
+
+OpenEphysFileSource::ReadAheadStatistics OpenEphysFileSource::getReadAheadStatistics() const
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+
+	return readAheadStats;
+}
+
+void OpenEphysFileSource::waitForReadAhead(std::unique_lock<std::mutex>& lock) const
+{
+	readAheadCondition.wait(lock, [this] { return !nextBlock.busy; });
+}
+
+void OpenEphysFileSource::readPrepared(int16* buffer, int64 samplesToRead, int nSamples)
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+
+	readAheadStats.numReads++;
+
+	const bool prepared = nextBlock.requested && nextBlock.position == m_samplePos && nextBlock.numSamples == samplesToRead;
+
+	if (prepared)
+	{
+		if (!nextBlock.ready)
+		{
+			// the block is still being read: wait for it rather than reading it twice
+			int64 startTime = Time::getHighResolutionTicks();
+
+			readAheadCondition.wait(lock, [this] { return nextBlock.ready; });
+
+			readAheadStats.numStalls++;
+			readAheadStats.stallSeconds += Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime);
+		}
+		else
+		{
+			readAheadStats.numHits++;
+		}
+
+		memcpy(buffer, nextBlock.data, sizeof(int16) * samplesToRead * numActiveChannels);
+	}
+	else
+	{
+		// after a seek (or a change of read size), read directly once the thread is idle
+		waitForReadAhead(lock);
+
+		readSamples(active, buffer, m_samplePos, samplesToRead, active.channels.getRawDataPointer(), numActiveChannels, currentSegment);
+
+		readAheadStats.numMisses++;
+	}
+
+	// Prepare the next block, which wraps around to the start at the end of the recording
+	const int64 numSamples = getActiveNumSamples();
+	int64 nextPosition = m_samplePos + samplesToRead;
+
+	if (nextPosition >= numSamples)
+		nextPosition = 0;
+
+	nextBlock.requested = false;
+	nextBlock.ready = false;
+
+	const int64 nextCount = jmin(int64(nSamples), numSamples - nextPosition);
+
+	if (nextCount > 0 && numActiveChannels > 0)
+	{
+		if (nextBlock.capacity < nextCount * numActiveChannels)
+		{
+			nextBlock.capacity = nextCount * numActiveChannels;
+			nextBlock.data.malloc(nextBlock.capacity);
+		}
+
+		nextBlock.position = nextPosition;
+		nextBlock.numSamples = nextCount;
+		nextBlock.requested = true;
+
+		readAheadCondition.notify_all();
+	}
+}
+
+void OpenEphysFileSource::runReadAhead()
+{
+	std::unique_lock<std::mutex> lock(readAheadMutex);
+
+	while (true)
+	{
+		readAheadCondition.wait(lock, [this] { return readAheadExit || (nextBlock.requested && !nextBlock.ready); });
+
+		if (readAheadExit)
+			return;
+
+		nextBlock.busy = true;
+		lock.unlock();
+
+		// only this thread reads while the block is busy
+		readSamples(active, nextBlock.data, nextBlock.position, nextBlock.numSamples, active.channels.getRawDataPointer(), numActiveChannels, readAheadSegment);
+		int64 advised = prefetchAfter(active, nextBlock.position + nextBlock.numSamples, readAheadSegment);
+
+		lock.lock();
+
+		nextBlock.busy = false;
+		nextBlock.ready = true;
+		readAheadStats.prefetchedBytes += advised;
+
+		readAheadCondition.notify_all();
+	}
+}
+
+int64 OpenEphysFileSource::prefetchAfter(StreamReader& reader, int64 position, int hint)
+{
+	int segment = findSegment(reader, position, hint);
+
+	if (reader.segments.isEmpty() || position < reader.segments[segment].firstSample)
+		return 0;
+
+	const RecordSegment& current = reader.segments.getReference(segment);
+	const int64 record = current.firstRecord + jmin(position - current.firstSample, current.numRecords * BLOCK_LENGTH) / BLOCK_LENGTH;
+	const int64 recordBytes = reader.recordStride * int64(sizeof(int16));
+
+	// only the records that entered the window since the last request (all of them after a seek)
+	int64 first = record;
+
+	if (reader.prefetchedRecord > record && reader.prefetchedRecord <= record + READ_AHEAD_RECORDS)
+		first = reader.prefetchedRecord;
+
+	reader.prefetchedRecord = record + READ_AHEAD_RECORDS;
+
+	const int64 length = (reader.prefetchedRecord - first) * recordBytes;
+
+	if (length <= 0)
+		return 0;
+
+	int64 requested = 0;
+
+	// one request per data file: packed channels share theirs
+	for (int i = 0; i < reader.channelFiles.size(); i++)
+	{
+		if ((i == 0 || reader.channelFiles[i] != reader.channelFiles[i - 1]) && reader.scheduledFiles[i] >= 0)
+		{
+			ioScheduler.request(reader.scheduledFiles[i], reader.channelOffsets[i] + first * recordBytes, length);
+			requested += length;
+		}
+	}
+
+	return requested;
+}
+
+const TimestampMap& OpenEphysFileSource::getTimestampMap(const String& streamName)
+{
+	auto existing = timestampMaps.find(streamName);
+
+	if (existing != timestampMaps.end())
+		return existing->second;
+
+	TimestampMap& map = timestampMaps[streamName];
+
+	const StreamInfo& first = recordings[1].streams[streamName];
+	map.clear(first.sampleRate);
+
+	StreamIndex& index = streamIndices[streamName];
+
+	if (!index.loaded)
+		index.loaded = index.entries.load(index.file.getFullPathName().toStdString());
+
+	if (!timestampFiles.count(streamName) || !index.loaded)
+		return map;
+
+	MemoryMappedFile timestampFile(timestampFiles[streamName], MemoryMappedFile::readOnly);
+
+	if (timestampFile.getData() == nullptr)
+		return map;
+
+	// One double per record of the stream's first data file, in file order, from its first record on
+	const double* times = static_cast<const double*>(timestampFile.getData());
+	const int64 numTimes = (int64) timestampFile.getSize() / (int64) sizeof(double);
+	const int64 bytesPerBlock = int64(RECORD_SIZE) * jmax(1, first.numPackedChannels);
+
+	int64 recordingStart = 0;
+
+	for (auto rec : extract_keys(recordings))
+	{
+		if (!recordings[rec].streams.count(streamName))
+			continue;
+
+		const StreamInfo& stream = recordings[rec].streams[streamName];
+
+		for (int64 i = stream.firstEntry; i < stream.firstEntry + stream.numRecords && i < index.entries.size(); i++)
+		{
+			const int64 fileRecord = (index.entries[i].offset - HEADER_SIZE) / bytesPerBlock;
+
+			if (fileRecord >= 0 && fileRecord < numTimes)
+				map.add(recordingStart + index.entries[i].sampleNumber - stream.startTimestamp, times[fileRecord]);
+		}
+
+		recordingStart += stream.numSamples;
+	}
+
+	LOGD("Stream ", streamName, ": ", map.size(), " synchronized timestamps");
+
+	return map;
+}
+
+double OpenEphysFileSource::getSynchronizedTime(int64 position)
+{
+	return getTimestampMap(currentStream).toSeconds((double) (position + active.recordingStart));
+}
+
+int64 OpenEphysFileSource::getSamplePosition(double seconds)
+{
+	return (int64) std::floor(getTimestampMap(currentStream).toPosition(seconds) + 0.5) - active.recordingStart;
+}
+
+int OpenEphysFileSource::getNumSpikeChannels() const
+{
+	auto readers = spikeReaders.find(currentStream);
+
+	return readers == spikeReaders.end() ? 0 : readers->second.size();
+}
+
+SpikeReader* OpenEphysFileSource::getSpikeChannel(int index)
+{
+	auto readers = spikeReaders.find(currentStream);
+
+	if (readers == spikeReaders.end() || index < 0 || index >= readers->second.size())
+		return nullptr;
+
+	SpikeReader* reader = readers->second[index];
+
+	if (!reader->buildIndex(getRecordingOffsets(currentStream)))
+		return nullptr;
+
+	return reader;
+}
+
+EventSpan OpenEphysFileSource::getEvents(int64 start, int64 stop) const
+{
+	auto store = eventStores.find(currentStream);
+
+	if (store == eventStores.end())
+	{
+		EventSpan none = { nullptr, nullptr, nullptr, 0 };
+		return none;
+	}
+
+	return store->second.find(start, stop);
+}
+
+int64 OpenEphysFileSource::getActiveRecordingStart() const
+{
+	return active.recordingStart;
+}
+
+void OpenEphysFileSource::processEventData(EventInfo &eventInfo, int64 start, int64 stop) 
+{ 
+
+	// Find all event data within this start/stop interval, which can span the loop
+	// back to the start of the recording
+
+	const int64 numSamples = getActiveNumSamples();
+
+	if (numSamples <= 0)
+		return;
+
+	for (int64 loop = start / numSamples; loop <= stop / numSamples; loop++)
+	{
+		const int64 loopStart = loop * numSamples;
+
+		// events are stored in positions of the concatenated recordings
+		const int64 offset = loopStart - active.recordingStart;
+
+		EventSpan span = getEvents(jmax(start, loopStart) - offset, jmin(stop, loopStart + numSamples - 1) - offset);
+
+		for (size_t i = 0; i < span.size; i++)
+		{
+			eventInfo.channels.push_back(span.channels[i]);
+			eventInfo.channelStates.push_back(span.states[i]);
+			eventInfo.timestamps.push_back(span.timestamps[i] + offset);
+		}
+	}
+
+}
+
+
+void OpenEphysFileSource::gatherRecord(StreamReader& reader, int64 record, int64 inRecord, int64 count, const int* channels, int numChannels)
+{
+	/* Each channel is read from its record header on, so its sample number can be checked against the index */
+	const int64 recordOffset = record * reader.recordStride * int64(sizeof(int16)) - RECORD_HEADER_SIZE;
+	const int64 length = RECORD_HEADER_SIZE + (inRecord + count) * int64(sizeof(int16));
+
+	const int64 entry = reader.firstEntry + record;
+	const bool checked = reader.recordIndex != nullptr && entry < reader.recordIndex->size();
+	const int64 expected = checked ? (*reader.recordIndex)[entry].sampleNumber : 0;
+
+	/* Channels sharing a data file (packed streams) are mapped with one request,
+	   as remapping a window would invalidate the pointers already taken from it */
+	for (int first = 0; first < numChannels;)
+	{
+		const int file = reader.channelFiles[channels[first]];
+		int64 start = reader.channelOffsets[channels[first]];
+		int64 end = start;
+		int last = first;
+
+		for (; last < numChannels && reader.channelFiles[channels[last]] == file; last++)
+		{
+			start = jmin(start, reader.channelOffsets[channels[last]]);
+			end = jmax(end, reader.channelOffsets[channels[last]]);
+		}
+
+		const uint8* data = reader.mappings.getData(file, start + recordOffset, end - start + length);
+
+		for (int j = first; j < last; j++)
+		{
+			/* Records past the end of a truncated file read as zeros */
+			if (data == nullptr)
+			{
+				reader.recordSources[j] = missingRecord.getData();
+				continue;
+			}
+
+			const uint8* header = data + (reader.channelOffsets[channels[j]] - start);
+			int64 sampleNumber;
+			memcpy(&sampleNumber, header, sizeof(sampleNumber));
+
+			/* and so do records that aren't the one the index expects, rather than shifting the channel */
+			if (checked && sampleNumber != expected)
+			{
+				if (reader.numMismatchedRecords++ == 0)
+					LOGC("Stream ", reader.name, ": channel ", channels[j], " has sample number ", sampleNumber,
+						" instead of ", expected, " in record ", record, "; mismatched records read as zeros");
+
+				reader.recordSources[j] = missingRecord.getData();
+				continue;
+			}
+
+			reader.recordSources[j] = reinterpret_cast<const int16*>(header + RECORD_HEADER_SIZE) + inRecord;
+		}
+
+		first = last;
+	}
+}
+
+void OpenEphysFileSource::readSamples(StreamReader& reader, int16* buffer, int64 position, int64 samplesToRead, const int* channels, int numChannels, int& segmentIndex)
+{
+
+	/* Samples are interleaved in the output buffer, to mimic BinaryFormat */
+	const uint64 channelSet = BlockCache::hashChannels(channels, numChannels);
+
+	while (samplesToRead > 0)
+	{
+		/* Find the segment containing (or the gap preceding) the current position */
+		segmentIndex = findSegment(reader, position, segmentIndex);
+
+		int64 count;
+
+		if (reader.segments.isEmpty() || position < reader.segments[segmentIndex].firstSample)
+		{
+			/* Nothing was recorded before the first segment */
+			count = reader.segments.isEmpty() ? samplesToRead : jmin(samplesToRead, reader.segments[segmentIndex].firstSample - position);
+			zeromem(buffer, sizeof(int16) * count * numChannels);
+		}
+		else
+		{
+			const RecordSegment& segment = reader.segments.getReference(segmentIndex);
+			const int64 offset = position - segment.firstSample;
+			const int64 segmentLength = segment.numRecords * BLOCK_LENGTH;
+
+			if (offset >= segmentLength)
+			{
+				/* Gap between this segment and the next one (or the end of the recording) */
+				int64 gapEnd = segmentIndex + 1 < reader.segments.size() ? reader.segments[segmentIndex + 1].firstSample : position + samplesToRead;
+				count = jmin(samplesToRead, gapEnd - position);
+				zeromem(buffer, sizeof(int16) * count * numChannels);
+			}
+			else
+			{
+				/* Rest of the current record, from the cache, or else decoded (as a whole record, to be cached) */
+				const int64 record = segment.firstRecord + offset / BLOCK_LENGTH;
+				const int64 inRecord = offset % BLOCK_LENGTH;
+				count = jmin(samplesToRead, BLOCK_LENGTH - inRecord);
+
+				BlockCache::Key key = { reader.index, record, channelSet };
+				const int16* block = blockCache.find(key);
+
+				if (block == nullptr)
+				{
+					if (int16* decoded = blockCache.insert(key, size_t(BLOCK_LENGTH) * numChannels))
+					{
+						gatherRecord(reader, record, 0, BLOCK_LENGTH, channels, numChannels);
+						interleaveSamples(reader.recordSources, numChannels, BLOCK_LENGTH, decoded);
+						block = decoded;
+					}
+				}
+
+				if (block != nullptr)
+				{
+					memcpy(buffer, block + inRecord * numChannels, sizeof(int16) * count * numChannels);
+				}
+				else
+				{
+					/* One contiguous run per channel, transposed into the output */
+					gatherRecord(reader, record, inRecord, count, channels, numChannels);
+					interleaveSamples(reader.recordSources, numChannels, count, buffer);
+				}
+			}
+		}
+
+		buffer += count * numChannels;
+		position += count;
+		samplesToRead -= count;
+	}
 
 }
@@ -26,6 +26,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <FileSourceHeaders.h>
 
+#include "BlockCache.h"
+#include "Definitions.h"
+#include "EventStore.h"
+#include "IoScheduler.h"
+#include "MappingManager.h"
+#include "OverviewPyramid.h"
+#include "RecordIndex.h"
+#include "RecordSummary.h"
+#include "SampleKernels.h"
+#include "SpikeReader.h"
+#include "StructureReader.h"
+#include "TimestampMap.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
 
 /**
 
@@ -44,22 +64,53 @@ public:
     OpenEphysFileSource();
     
     /** Destructor */
-    ~OpenEphysFileSource() { }
+    ~OpenEphysFileSource();
     
     /** Attempt to open a file, and return true if successful */
     bool open(File file) override;
     
-    /** Add info about available recordings */
+    /** Add info about available recordings: each stream with all its recordings concatenated, then
+        (if there are several) each recording of each stream on its own */
     void fillRecordInfo() override;
 
     /** Read in nSamples to a temporary buffer of int16*/
     int readData(int16* buffer, int nSamples) override;
 
-    /** Seek to a specific sample number */
+    /** Seek to a specific sample number; the next read starts at the record holding it */
     void seekTo(int64 sample) override;
 
+    /** Reads 'numSamples' samples of some channels of the active stream, starting at 'startSample' (in sample
+        positions of the concatenated recordings), into one float buffer per channel (scaled by bitVolts).
+        Samples that weren't recorded read as zero. Doesn't move the playback position.
+        Returns the number of samples read, which is less than requested at the end of the stream. */
+    int64 readRange(const Array<int>& channels, int64 startSample, int64 numSamples, float* const* outBuffers);
+
+    /** Sets the streams (indices as passed to updateActiveRecord) that readStreams reads along with the active one.
+        Their sample positions are aligned with the active stream's through the start timestamps and sample rates
+        of the first recording, and their read-ahead goes through the same I/O scheduler. */
+    void setPlaybackStreams(const Array<int>& indices);
+
+    /** Number of streams read by readStreams */
+    int getNumPlaybackStreams() const;
+
+    /** Most samples of a playback stream that readStreams returns for 'numSamples' samples of the active stream */
+    int getPlaybackBufferSize(int stream, int numSamples) const;
+
+    /** Reads the interleaved int16 samples of every playback stream that line up with 'numSamples' samples of the
+        active stream from 'position' (e.g. the block just returned by readData). buffers[i] must hold
+        getPlaybackBufferSize(i, numSamples) samples of every channel of stream i, and numRead[i] is set to the
+        number of samples written to it. Samples before or after a stream's data read as zero. */
+    void readStreams(int64 position, int numSamples, int16* const* buffers, int* numRead);
+
+    /** Returns the counters of the I/O scheduler shared by all streams */
+    IoScheduler::Statistics getIoStatistics() const;
+
     /** Convert input buffer of ints to a float output buffer */
     void processChannelData(int16* inBuffer, float* outBuffer, int channel, int64 numSamples) override;
+
+    /** Converts an interleaved buffer returned by readData into one float buffer per active channel
+        (byte-swapped and scaled by bitVolts), in a single pass over the input */
+    void convertChannelData(const int16* inBuffer, float* const* outBuffers, int64 numSamples);
     
     /** Add info about events occurring in an interval */
     void processEventData(EventInfo &info, int64 startTimestamp, int64 stopTimestamp) override;
@@ -67,10 +118,193 @@ public:
     /** Update the current recording to read from */
     void updateActiveRecord(int index) override;
 
+    /** Returns the events of the active stream with start <= timestamp <= stop (in sample positions
+        of the concatenated recordings), as a view into the event store; no events are copied */
+    EventSpan getEvents(int64 start, int64 stop) const;
+
+    /** Position of the active record's first sample in the concatenated recordings: 0, unless a single
+        recording is selected. Add it to sample positions of the active record to get the positions
+        used by events and spikes. */
+    int64 getActiveRecordingStart() const;
+
+    /** Sets how many bytes of data files may be mapped at once, across all channels of the active stream
+        (each file still gets a window of at least a few records) */
+    void setMappingBudget(int64 bytes);
+
+    /** Returns how often data file windows were mapped and remapped since the active stream was selected */
+    MappingManager::Statistics getMappingStatistics() const;
+
+    /** Fills one minimum and one maximum per pixel (in channel units) for samples [start, end) of a channel
+        of the active stream, from its overview. Takes time proportional to the number of pixels, however
+        long the range. Each pixel's envelope is widened to whole overview bins (at least 1024 samples).
+        Returns false until the overview has been loaded or built. */
+    bool getOverview(int channel, int64 start, int64 end, int numPixels, float* minimums, float* maximums);
+
+    /** Fraction of the active stream's overview that has been built (1 once it's available) */
+    float getOverviewProgress() const;
+
+    /** Sets how many threads (including the reading one) interleave and convert the channels of each read */
+    void setDecodeThreads(int numThreads);
+
+    /** Returns how many threads interleave and convert the channels of each read */
+    int getDecodeThreads() const;
+
+    /** Sets how many bytes of decoded records are kept for repeated reads, e.g. when playback loops
+        (64 MB by default; 0 turns the cache off) */
+    void setBlockCacheBudget(int64 bytes);
+
+    /** Returns the hits, misses and size of the decoded record cache since the active stream was selected */
+    BlockCache::Statistics getBlockCacheStatistics() const;
+
+    /** Turns reading ahead on a background thread on or off (on by default). While it's on, the block
+        following each read is prepared for the next readData call, and the OS is asked to start
+        loading the records after it. */
+    void setReadAhead(bool enabled);
+
+    /** Counters of the read-ahead thread since the source was created */
+    struct ReadAheadStatistics
+    {
+        int64 numReads;
+        int64 numHits;
+        int64 numStalls;
+        int64 numMisses;
+        double stallSeconds;
+        int64 prefetchedBytes;
+    };
+
+    /** Returns how many reads were served from a prepared block (hits), had to wait for it (stalls),
+        or were read directly after a seek (misses), and how many bytes were prefetched */
+    ReadAheadStatistics getReadAheadStatistics() const;
+
+    /** Synchronized time in seconds of a sample position of the active stream, interpolated between the
+        times recorded in its .timestamps file (position / sample rate if it has none) */
+    double getSynchronizedTime(int64 position);
+
+    /** Sample position of the active stream closest to a synchronized time */
+    int64 getSamplePosition(double seconds);
+
+    /** Number of electrodes with a .spikes file in the active stream */
+    int getNumSpikeChannels() const;
+
+    /** Returns the spike reader of an electrode of the active stream (indexing its file the first time),
+        or nullptr if there's no such electrode or its file can't be read. Spike positions are in
+        sample positions of the concatenated recordings, like events. */
+    SpikeReader* getSpikeChannel(int index);
+
+    /** A run of samples of the active record that weren't recorded (according to the sample numbers of the
+        records around it), and read as zeros */
+    struct Gap
+    {
+        int64 position;
+        int64 numSamples;
+    };
+
+    /** Returns the gaps of the active record, in order */
+    Array<Gap> getGaps() const;
+
+    /** Records of the active stream that couldn't be trusted */
+    struct RecordValidation
+    {
+        /** Records whose sample number went backwards (repeated buffers or damaged headers); they are skipped */
+        int64 numOutOfOrderRecords;
+
+        /** Records of a channel file whose header has a different sample number than the record index
+            (e.g. a buffer lost by that file only); they are read as zeros, so later data doesn't shift */
+        int64 numMismatchedRecords;
+    };
+
+    /** Returns what was found while indexing and reading the active stream */
+    RecordValidation getRecordValidation() const;
+
+    /** Returns the write-time summaries of every record of a channel in the active stream
+        (all recordings, in order), or nullptr if the data was saved without .summary files.
+        Consecutive records of the channel are 'stride' entries apart (more than one for packed streams). */
+    const RecordSummary* getRecordSummaries(int channel, int64& numSummaries, int& stride) const;
+
+    /** Statistics of a channel over a range of records, in channel units */
+    struct ChannelStatistics
+    {
+        float minimum;
+        float maximum;
+        float mean;
+        float rms;
+        int64 numSamples;
+    };
+
+    /** Computes min, max, mean and RMS of a channel from its record summaries, without reading any samples.
+        Returns false if no summaries are available. */
+    bool getChannelStatistics(int channel, int64 firstRecord, int64 numRecords, ChannelStatistics& stats) const;
+
 private:
 
-    /** Helper function for reading in int16 data */
-    void readSamples(int16* buffer, int64 samplesToRead);
+    struct StreamReader;
+
+    /** Reads interleaved int16 data of some channels of a stream from a position, updating 'segmentIndex' as it goes */
+    void readSamples(StreamReader& reader, int16* buffer, int64 position, int64 samplesToRead, const int* channels, int numChannels, int& segmentIndex);
+
+    /** Loads the active stream's overview in the background, or builds (and saves) it if it's missing or out of date */
+    void startOverview();
+
+    /** Stops building the overview and drops it */
+    void stopOverview();
+
+    /** Hash of the names, sizes and modification times of the active stream's data files */
+    uint64 getSourceSignature() const;
+
+    /** Interleaves one run of samples per channel, splitting the channels between the decode threads */
+    void interleaveSamples(const int16* const* sources, int numChannels, int64 numSamples, int16* dest);
+
+    /** Converts interleaved samples to scaled float channels, splitting the channels between the decode threads */
+    void convertSamples(const int16* source, int numChannels, int64 numSamples, const float* scales, float* const* dest);
+
+    /** Points the reader's recordSources at 'count' samples of a record of each channel, starting at sample 'inRecord' */
+    void gatherRecord(StreamReader& reader, int64 record, int64 inRecord, int64 count, const int* channels, int numChannels);
+
+    /** Index of the segment of a stream containing a position, or of the one before the gap containing it
+        (checks 'hint' and the segment after it first, then does a binary search) */
+    int findSegment(const StreamReader& reader, int64 position, int hint) const;
+
+    /** Lists a stream (recording 0) or one recording of it as a selectable record */
+    void addRecordInfo(const String& streamName, int recording);
+
+    /** Maps the data files of a stream (as indexed in updateActiveRecord) and builds its segments;
+        a single recording only gets the byte range of its records mapped */
+    void setUpStream(StreamReader& reader, int index);
+
+    /** Unmaps a stream's data files and removes them from the I/O scheduler */
+    void clearStream(StreamReader& reader);
+
+    /** Position in a stream with the same synchronized time as a position of the active stream,
+        from the start timestamps and sample rates of both */
+    int64 getAlignedPosition(const StreamReader& reader, int64 activePosition) const;
+
+    /** Finds (or rebuilds) a stream's record index, and sets the record counts, start sample numbers
+        and lengths of the stream in every recording from it */
+    void loadRecordIndex(const String& streamName);
+
+    /** Returns the sample position to synchronized time mapping of a stream, building it the first time */
+    const TimestampMap& getTimestampMap(const String& streamName);
+
+    /** Offsets to subtract from event sample numbers of each recording number, to get positions in the concatenated recordings */
+    std::vector<int64_t> getRecordingOffsets(const String& streamName);
+
+    /** Reads one entry of a stream's record index, from memory if it's loaded or else from its file */
+    bool readIndexEntry(const String& streamName, int64 entryIndex, RecordIndexEntry& entry);
+
+    /** Serves a readData call from the prepared block (or reads it directly), then requests the next one */
+    void readPrepared(int16* buffer, int64 samplesToRead, int nSamples);
+
+    /** Body of the read-ahead thread */
+    void runReadAhead();
+
+    /** Waits until the read-ahead thread isn't reading; 'lock' must hold readAheadMutex */
+    void waitForReadAhead(std::unique_lock<std::mutex>& lock) const;
+
+    /** Queues the records following a position in a stream with the I/O scheduler; returns the bytes requested */
+    int64 prefetchAfter(StreamReader& reader, int64 position, int hint);
+
+    /** Builds the segments of a stream from its record index */
+    void buildSegments(StreamReader& reader);
 
     struct ChannelInfo
     {
@@ -78,7 +312,10 @@ private:
         String name;
         double bitVolts;
         String filename;
-        long int startPos;
+        int64 startPos;
+        String summaryFilename;
+        int64 summaryPos;
+        int packedIndex;
     };
 
     struct StreamInfo
@@ -90,6 +327,9 @@ private:
         int64 startPos;
         int64 startTimestamp;
         int64 numSamples;
+        int64 numRecords;
+        int64 firstEntry;
+        int numPackedChannels;
     };
 
     struct Recording
@@ -98,20 +338,180 @@ private:
         std::map<String, StreamInfo> streams;
     };
 
-    OwnedArray<MemoryMappedFile> dataFiles;
+    /** A run of records with consecutive sample numbers. Samples between segments were not
+        recorded (e.g. event-gated recordings) and are read as zeros. */
+    struct RecordSegment
+    {
+        int64 firstSample;
+        int64 firstRecord;
+        int64 numRecords;
+    };
+
+    /** Record index of a stream: one entry per record (or packed frame) of its first data file,
+        kept in a .index file next to it */
+    struct StreamIndex
+    {
+        File file;
+        int64 firstOffset;
+        RecordIndex entries;
+        bool loaded;
+    };
+
+    std::map<String, StreamIndex> streamIndices;
+
+    /** Everything needed to read the samples of one stream: the active one, or one played along with it */
+    struct StreamReader
+    {
+        /** Stream name, and its index as passed to updateActiveRecord */
+        String name;
+        int index;
+
+        /** Recording read, or 0 for all recordings concatenated together (in order) */
+        int recording;
+
+        /** Position of the stream's first sample in the concatenated recordings */
+        int64 recordingStart;
+
+        /** Sample rate and first sample number of the (first) recording, to align streams with each other */
+        float sampleRate;
+        int64 startTimestamp;
+
+        /** Segments of the stream, in the concatenated sample positions of all recordings */
+        Array<RecordSegment> segments;
+
+        /** Windows of the stream's data files around the read position */
+        MappingManager mappings;
+
+        /** Data file (handle in 'mappings', and in the I/O scheduler) of each channel, and byte offset of its first sample in it */
+        Array<int> channelFiles;
+        Array<int> scheduledFiles;
+        Array<int64> channelOffsets;
+
+        /** Distance between consecutive records of a channel, in samples (larger for packed streams) */
+        int64 recordStride;
+
+        /** Per-channel read positions within the current record, for interleaving */
+        HeapBlock<const int16*> recordSources;
+
+        /** Indices of all channels, for whole-stream reads */
+        Array<int> channels;
+
+        /** Segment of the last read, to start the next one from */
+        int segment;
+
+        /** Record after the last one requested from the I/O scheduler */
+        int64 prefetchedRecord;
+
+        /** The stream's record index, and the entry of the first record read, to check record headers against */
+        const RecordIndex* recordIndex;
+        int64 firstEntry;
+
+        /** Records left out because their sample numbers went backwards, and channel records read as
+            zeros because their headers didn't match the index */
+        int64 numOutOfOrderRecords;
+        int64 numMismatchedRecords;
+    };
+
+    /** The active stream, read by readData, readRange and the read-ahead thread */
+    StreamReader active;
+    int currentSegment;
+
+    /** Other streams read along with the active one by readStreams */
+    OwnedArray<StreamReader> playbackStreams;
+
+    /** Read-ahead requests of all streams, advised in file order on one thread */
+    IoScheduler ioScheduler;
+
+    OwnedArray<MemoryMappedFile> summaryFiles;
+
+    /** Decoded records of all streams being read, for repeated reads */
+    BlockCache blockCache;
+
+    /** One record of zeros, read in place of records missing from a data file */
+    HeapBlock<int16> missingRecord;
+
+    /** Interleaved samples of the chunk being read by readRange */
+    HeapBlock<int16> rangeBuffer;
+
+    /** All channels of the block being processed, converted when processChannelData is asked for its
+        first channel (only used by the thread that calls processChannelData; allocated in updateActiveRecord) */
+    HeapBlock<float> convertedData;
+    HeapBlock<float*> convertedChannels;
+    const int16* convertedSource;
+    int64 convertedSamples;
+
+    /** First record summary of each active channel (nullptr if there are none) */
+    Array<const RecordSummary*> summaryData;
+    Array<int64> numSummaries;
+
+    /** The block the read-ahead thread prepares for the next readData call */
+    struct ReadAheadBlock
+    {
+        HeapBlock<int16> data;
+        int64 capacity;
+        int64 position;
+        int64 numSamples;
+        bool requested;
+        bool busy;
+        bool ready;
+    };
+
+    ReadAheadBlock nextBlock;
+    int readAheadSegment;
+    bool readAheadEnabled;
+    bool readAheadExit;
+    ReadAheadStatistics readAheadStats;
+
+    std::thread readAheadThread;
+    mutable std::mutex readAheadMutex;
+    mutable std::condition_variable readAheadCondition;
+
+    /** Records to prefetch after each prepared block */
+    const int64 READ_AHEAD_RECORDS = 16;
+
+    /** Min/max overview of the active stream (kept in <stream>.overview next to structure.openephys) */
+    std::unique_ptr<OverviewPyramid> overview;
+    std::thread overviewThread;
+    std::mutex overviewMutex;
+    std::atomic<bool> overviewCancel;
+    std::atomic<float> overviewProgress;
+    HeapBlock<int16> envelope;
+
+    /** Threads sharing the interleaving and conversion of wide reads */
+    std::unique_ptr<WorkerPool> decodePool;
+
+    /** Channels below which a read isn't worth splitting between threads */
+    const int MIN_CHANNELS_PER_THREAD = 64;
+
+    /** Longest block processChannelData converts for all channels at once; longer ones are converted per channel */
+    const int MAX_CONVERTED_SAMPLES = 8192;
 
     std::map<int, Recording> recordings;
-    std::map<int, EventInfo> events;
+
+    /** What each record listed by fillRecordInfo reads: all recordings of a stream, or just one of them */
+    struct SelectableRecord
+    {
+        String streamName;
+        int recording;
+    };
+
+    std::vector<SelectableRecord> selectableRecords;
+
+    /** Synchronized timestamps file of each stream, and the mapping built from it */
+    std::map<String, File> timestampFiles;
+    std::map<String, TimestampMap> timestampMaps;
+
+    /** Spike files of each stream */
+    std::map<String, OwnedArray<SpikeReader>> spikeReaders;
+
+    /** TTL events of each stream, sorted by sample position */
+    std::map<String, EventStore> eventStores;
 
     File m_rootPath;
     int64 m_samplePos;
 
     int64 totalSamplesRead;
     int64 totalSamples;
-    int64 totalBlocks;
-
-    int64 blockIdx;
-    int64 samplesLeftInBlock;
 
     int numActiveChannels;
     Array<float> bitVolts;
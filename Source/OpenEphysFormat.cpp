@@ -25,25 +25,45 @@
 
 #include "FileHeaders.h"
 
-OpenEphysFormat::OpenEphysFormat() : 
-	recordingNumber(0), 
-	experimentNumber(0), 
-	zeroBuffer(1, 50000),
-    zeroBufferDouble(1, 50000),
-	messageFile(nullptr)
-{ 
-	continuousDataIntegerBuffer.malloc(10000);
-	continuousDataFloatBuffer.malloc(10000);
-	recordMarker.malloc(10);
+/** 64-bit position of a file opened by the engine */
+static int64 getFilePosition(FILE* file)
+{
+#ifdef _WIN32
+	return _ftelli64(file);
+#else
+	return ftello(file);
+#endif
+}
+
+/** Writes the NPY output of a stream writer through the GUI's NpyFile, which finishes the file when destroyed */
+class NpyFileTarget : public StreamWriter::NpyTarget
+{
+public:
+	NpyFileTarget(String path, NpyType type, int numColumns) : file(path, type, numColumns) {}
 
-	for (int i = 0; i < 9; i++)
+	void write(const void* data, size_t numBytes, int numRows) override
 	{
-		recordMarker[i] = i;
+		file.writeData(data, numBytes);
+		file.increaseRecordCount(numRows);
 	}
-	recordMarker[9] = 255;
 
-	zeroBuffer.clear();
-    zeroBufferDouble.clear();
+private:
+	NpyFile file;
+};
+
+OpenEphysFormat::OpenEphysFormat() : 
+	recordingNumber(0), 
+	experimentNumber(0), 
+	messageFile(nullptr),
+	writeNpyTimestamps(false),
+	writeNpyContinuousData(false),
+	writeRecordSummaries(true),
+	writePackedStreams(false),
+	eventGated(false),
+	gatePreSeconds(0.5f),
+	gatePostSeconds(1.0f),
+	filesAreOpen(false)
+{ 
 }
 	
 OpenEphysFormat::~OpenEphysFormat()
@@ -55,6 +75,29 @@ RecordEngineManager* OpenEphysFormat::getEngineManager()
 {
 	RecordEngineManager* man = new RecordEngineManager("OPENEPHYS", "Open Ephys",
 		&(engineFactory<OpenEphysFormat>));
+
+	EngineParameter* param;
+
+	param = new EngineParameter(EngineParameter::BOOL, 0, "Write NPY timestamps", false);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::BOOL, 1, "Write NPY continuous data", false);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::BOOL, 2, "Write record summaries", true);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::BOOL, 3, "One packed file per stream", false);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::BOOL, 4, "Event-gated recording", false);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::FLOAT, 5, "Gate pre-window (seconds)", 0.5f, 0.0f, 60.0f);
+	man->addParameter(param);
+
+	param = new EngineParameter(EngineParameter::FLOAT, 6, "Gate post-window (seconds)", 1.0f, 0.0f, 60.0f);
+	man->addParameter(param);
 	
 	return man;
 }
@@ -67,15 +110,14 @@ String OpenEphysFormat::getEngineId() const
 
 void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recordingNumber)
 {
-	fileArray.clear();
-    timestampFileArray.clear();
+    streamWriters.clear();
     eventFileArray.clear();
     eventFileMap.clear();
     firstChannelsInStream.clear();
 	spikeFileArray.clear();
-	blockIndex.clear();
     streamInfoArray.clear();
-	samplesSinceLastRecord.clear();
+    channelStreamIndex.clear();
+    channelIndexInStream.clear();
 
     // set
 	this->recordingNumber = recordingNumber;
@@ -84,6 +126,7 @@ void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recor
 	openMessageFile(rootFolder); // global message file
     
     uint16 activeStreamId = 0;
+    int streamStartIndex = 0;
 
 	for (int i = 0; i < getNumRecordedContinuousChannels(); i++)
 	{
@@ -93,7 +136,28 @@ void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recor
         {
             firstChannelsInStream.add(ch);
             activeStreamId = ch->getStreamId();
-            String timestampFileName = openTimestampFile(rootFolder, ch);
+            streamStartIndex = i;
+
+            int numChannelsInStream = 0;
+
+            for (int j = i; j < getNumRecordedContinuousChannels(); j++)
+            {
+                if (getContinuousChannel(getGlobalIndex(j))->getStreamId() != activeStreamId)
+                    break;
+
+                numChannelsInStream++;
+            }
+
+            StreamWriter* writer = new StreamWriter(numChannelsInStream);
+            writer->setRecordingNumber(recordingNumber);
+
+            if (eventGated)
+                writer->setGate(int64(gatePreSeconds * ch->getSampleRate()), int64(gatePostSeconds * ch->getSampleRate()));
+
+            streamWriters.add(writer);
+
+            String timestampFileName = getStreamBaseName(ch) + ".timestamps";
+            writer->setTimestampFile(openTimestampFile(rootFolder, timestampFileName));
             
             StreamInfo* info = new StreamInfo();
             info->streamId = ch->getStreamId();
@@ -103,17 +167,60 @@ void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recor
             info->sourceNodeName = ch->getSourceNodeName();
             info->timestampFileName = timestampFileName;
             streamInfoArray.add(info);
+
+            if (writeNpyTimestamps || writeNpyContinuousData)
+                openNpyFiles(rootFolder, ch, numChannelsInStream);
+
+            if (writePackedStreams)
+                openPackedStream(rootFolder, i, numChannelsInStream);
         }
-        
-		String filename = openContinuousFile(rootFolder, ch, getGlobalIndex(i));
-		blockIndex.add(0);
-        samplesSinceLastRecord.add(0);
+
+        StreamWriter* writer = streamWriters.getLast();
+        int indexInStream = i - streamStartIndex;
+
+        channelStreamIndex.add(streamWriters.size() - 1);
+        channelIndexInStream.add(indexInStream);
+
+        writer->setBitVolts(indexInStream, ch->getBitVolts());
         
         ChannelInfo* c = new ChannelInfo();
-        c->filename = filename;
         c->name = ch->getName();
-        c->startPos = ftell(fileArray.getLast());
-        c->bitVolts = dynamic_cast<const ContinuousChannel*>(ch)->getBitVolts();
+        c->bitVolts = ch->getBitVolts();
+
+        if (writePackedStreams)
+        {
+            // all channels of the stream share the packed files
+            StreamInfo* info = streamInfoArray.getLast();
+
+            c->filename = info->packedFileName;
+            c->startPos = info->packedStartPos;
+            c->summaryFilename = info->packedSummaryFileName;
+            c->summaryStartPos = info->packedSummaryStartPos;
+            c->packedIndex = indexInStream;
+        }
+        else
+        {
+            c->filename = getFileName(getGlobalIndex(i));
+
+            FILE* file = openContinuousFile(rootFolder, ch, c->filename);
+            FILE* summaryFile = nullptr;
+
+            c->startPos = getFilePosition(file);
+            c->packedIndex = -1;
+
+            if (indexInStream == 0)
+                writer->setIndexFile(openIndexFile(rootFolder, ch, c->filename + ".index"), c->startPos);
+
+            if (writeRecordSummaries)
+            {
+                c->summaryFilename = c->filename.upToLastOccurrenceOf(".continuous", false, false) + ".summary";
+                summaryFile = openSummaryFile(rootFolder, ch, c->summaryFilename);
+                c->summaryStartPos = getFilePosition(summaryFile);
+            }
+
+            writer->setChannelFile(indexInStream, file, summaryFile);
+        }
+
         streamInfoArray.getLast()->channels.add(c);
 	}
     
@@ -169,7 +276,7 @@ void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recor
         SpikeChannelInfo* c = new SpikeChannelInfo();
         c->filename = filename;
         c->name = ch->getName();
-        c->startPos = ftell(spikeFileArray.getLast());
+        c->startPos = getFilePosition(spikeFileArray.getLast());
         c->bitVolts = ch->getChannelBitVolts(0);
         c->num_samples = ch->getTotalSamples();
         c->num_channels = ch->getNumChannels();
@@ -199,24 +306,16 @@ void OpenEphysFormat::openFiles(File rootFolder, int experimentNumber, int recor
             streamInfoArray.add(info);
         }
 	}
+
+    filesAreOpen = true;
 }
 
-String OpenEphysFormat::openTimestampFile(File rootFolder, const ChannelInfoObject *channel)
+FILE* OpenEphysFormat::openTimestampFile(File rootFolder, String filename)
 {
     FILE* tsFile;
     
     String basePath = rootFolder.getFullPathName() + rootFolder.getSeparatorString();
     
-    String filename = String(channel->getSourceNodeId());
-    filename += "_";
-
-    // need to indicate stream somehow
-    filename += String(channel->getStreamName().removeCharacters(" ").replaceCharacter('_','-'));
-    if (experimentNumber > 1)
-        filename += "_" + String(experimentNumber);
-
-    filename += ".timestamps";
-    
     String fullpath = basePath + filename;
     
     File f = File(fullpath);
@@ -232,21 +331,15 @@ String OpenEphysFormat::openTimestampFile(File rootFolder, const ChannelInfoObje
     {
         fseek(tsFile, 0, SEEK_END);
     }
-
-    timestampFileArray.add(tsFile);
     
     diskWriteLock.exit();
     
-    return filename;
+    return tsFile;
     
 }
 
-String OpenEphysFormat::openEventFile(File rootFolder, const ChannelInfoObject* channel)
+String OpenEphysFormat::getStreamBaseName(const ChannelInfoObject* channel)
 {
-    FILE* eventFile;
-    
-    String basePath = rootFolder.getFullPathName() + rootFolder.getSeparatorString();
-    
     String filename = String(channel->getSourceNodeId());
     filename += "_";
 
@@ -254,6 +347,51 @@ String OpenEphysFormat::openEventFile(File rootFolder, const ChannelInfoObject*
     filename += String(channel->getStreamName().removeCharacters(" ").replaceCharacter('_','-'));
     if (experimentNumber > 1)
         filename += "_" + String(experimentNumber);
+
+    return filename;
+}
+
+void OpenEphysFormat::openNpyFiles(File rootFolder, const ChannelInfoObject* channel, int numChannels)
+{
+    String basePath = rootFolder.getFullPathName() + rootFolder.getSeparatorString();
+
+    // NPY files cannot be appended to, so each recording gets its own set
+    String filename = getStreamBaseName(channel);
+    filename += "_recording" + String(recordingNumber + 1);
+
+    StreamInfo* info = streamInfoArray.getLast();
+
+    std::unique_ptr<StreamWriter::NpyTarget> timestamps;
+    std::unique_ptr<StreamWriter::NpyTarget> samples;
+
+    diskWriteLock.enter();
+
+    if (writeNpyTimestamps)
+    {
+        info->npyTimestampFileName = filename + "_timestamps.npy";
+        LOGD("OPENING FILE: ", info->npyTimestampFileName);
+        timestamps = std::make_unique<NpyFileTarget>(basePath + info->npyTimestampFileName, NpyType(BaseType::DOUBLE, 1), 1);
+    }
+
+    if (writeNpyContinuousData)
+    {
+        info->npyContinuousFileName = filename + "_continuous.npy";
+        LOGD("OPENING FILE: ", info->npyContinuousFileName);
+        samples = std::make_unique<NpyFileTarget>(basePath + info->npyContinuousFileName, NpyType(BaseType::INT16, 1), numChannels);
+    }
+
+    streamWriters.getLast()->setNpyTargets(std::move(timestamps), std::move(samples));
+
+    diskWriteLock.exit();
+}
+
+String OpenEphysFormat::openEventFile(File rootFolder, const ChannelInfoObject* channel)
+{
+    FILE* eventFile;
+    
+    String basePath = rootFolder.getFullPathName() + rootFolder.getSeparatorString();
+    
+    String filename = getStreamBaseName(channel);
     filename += ".events";
     
     String fullPath = basePath + filename;
@@ -288,18 +426,14 @@ String OpenEphysFormat::openEventFile(File rootFolder, const ChannelInfoObject*
     
 }
 
-String OpenEphysFormat::openContinuousFile(File rootFolder, const ChannelInfoObject* ch, int channelIndex)
+FILE* OpenEphysFormat::openContinuousFile(File rootFolder, const ChannelInfoObject* ch, String fileName)
 {
 	FILE* chFile;
 
 	String fullPath(rootFolder.getFullPathName() + rootFolder.getSeparatorString());
-	String fileName;
 
 	recordPath = fullPath;
 
-    String fname = getFileName(channelIndex);
-
-    fileName += fname;
 	fullPath += fileName;
 	LOGD("OPENING FILE: ", fullPath);
 
@@ -329,12 +463,157 @@ String OpenEphysFormat::openContinuousFile(File rootFolder, const ChannelInfoObj
 		fseek(chFile, 0, SEEK_END);
 	}
 
-    fileArray.add(chFile);
-
 	diskWriteLock.exit();
     
-    return fname;
+    return chFile;
+
+}
+
+void OpenEphysFormat::openPackedStream(File rootFolder, int firstChannel, int numChannels)
+{
+	String basePath = rootFolder.getFullPathName() + rootFolder.getSeparatorString();
+
+	const ContinuousChannel* ch = getContinuousChannel(getGlobalIndex(firstChannel));
+	String dateString = generateDateString();
+
+	StreamInfo* info = streamInfoArray.getLast();
+	info->packedFileName = getStreamBaseName(ch) + ".packed";
+	info->packedIndexFileName = info->packedFileName + ".index";
+
+	FILE* packedFile;
+	FILE* indexFile;
+	FILE* summaryFile = nullptr;
+	int64 nextOffset;
+
+	recordPath = basePath;
+
+	diskWriteLock.enter();
+
+	// The data file holds a stream header and the usual header of every channel, so that
+	// classic per-channel files can be regenerated from it without any other metadata
+	File dataFile(basePath + info->packedFileName);
+	bool fileExists = dataFile.exists();
+
+	LOGD("OPENING FILE: ", dataFile.getFullPathName());
+	packedFile = fopen(dataFile.getFullPathName().toUTF8(), "ab");
+
+	if (!fileExists)
+	{
+		String header = generatePackedHeader(ch, numChannels, false, dateString);
+		fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), packedFile);
+
+		for (int k = 0; k < numChannels; k++)
+		{
+			header = generateHeader(getContinuousChannel(getGlobalIndex(firstChannel + k)), dateString);
+			fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), packedFile);
+		}
+
+		nextOffset = int64(HEADER_SIZE) * (numChannels + 1);
+	}
+	else
+	{
+		fseek(packedFile, 0, SEEK_END);
+		nextOffset = dataFile.getSize();
+	}
+
+	info->packedStartPos = nextOffset;
+
+	File indexPath(basePath + info->packedIndexFileName);
+	fileExists = indexPath.exists();
+
+	indexFile = fopen(indexPath.getFullPathName().toUTF8(), "ab");
+
+	if (!fileExists)
+	{
+		String header = generateIndexHeader(ch, dateString);
+		fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), indexFile);
+	}
+
+	if (writeRecordSummaries)
+	{
+		info->packedSummaryFileName = info->packedFileName + ".summary";
+
+		File summaryPath(basePath + info->packedSummaryFileName);
+		fileExists = summaryPath.exists();
+
+		summaryFile = fopen(summaryPath.getFullPathName().toUTF8(), "ab");
+
+		if (!fileExists)
+		{
+			String header = generatePackedHeader(ch, numChannels, true, dateString);
+			fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), summaryFile);
+
+			for (int k = 0; k < numChannels; k++)
+			{
+				header = generateSummaryHeader(getContinuousChannel(getGlobalIndex(firstChannel + k)), dateString);
+				fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), summaryFile);
+			}
+
+			info->packedSummaryStartPos = int64(HEADER_SIZE) * (numChannels + 1);
+		}
+		else
+		{
+			info->packedSummaryStartPos = summaryPath.getSize();
+		}
+	}
 
+	streamWriters.getLast()->setPackedFiles(packedFile, indexFile, summaryFile, nextOffset);
+
+	diskWriteLock.exit();
+}
+
+FILE* OpenEphysFormat::openIndexFile(File rootFolder, const ChannelInfoObject* ch, String fileName)
+{
+	String fullPath = rootFolder.getFullPathName() + rootFolder.getSeparatorString() + fileName;
+
+	LOGD("OPENING FILE: ", fullPath);
+
+	bool fileExists = File(fullPath).exists();
+
+	diskWriteLock.enter();
+
+	FILE* indexFile = fopen(fullPath.toUTF8(), "ab");
+
+	if (!fileExists && indexFile != nullptr)
+	{
+		String header = generateIndexHeader(ch, generateDateString());
+		fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), indexFile);
+	}
+
+	diskWriteLock.exit();
+
+	return indexFile;
+}
+
+FILE* OpenEphysFormat::openSummaryFile(File rootFolder, const ChannelInfoObject* ch, String fileName)
+{
+	FILE* sumFile;
+
+	String fullPath = rootFolder.getFullPathName() + rootFolder.getSeparatorString() + fileName;
+
+	LOGD("OPENING FILE: ", fullPath);
+
+	File f = File(fullPath);
+
+	bool fileExists = f.exists();
+
+	diskWriteLock.enter();
+
+	sumFile = fopen(fullPath.toUTF8(), "ab");
+
+	if (!fileExists)
+	{
+		String header = generateSummaryHeader(ch, generateDateString());
+		fwrite(header.toUTF8(), 1, header.getNumBytesAsUTF8(), sumFile);
+	}
+	else
+	{
+		fseek(sumFile, 0, SEEK_END);
+	}
+
+	diskWriteLock.exit();
+
+	return sumFile;
 }
 
 String OpenEphysFormat::openSpikeFile(File rootFolder, const SpikeChannel* elec, int channelIndex)
@@ -441,37 +720,20 @@ String OpenEphysFormat::getFileName(int channelIndex)
 
 void OpenEphysFormat::closeFiles()
 {
-	for (int i = 0; i < fileArray.size(); i++)
+	filesAreOpen = false;
+
+	// NpyFile patches the array shape into its header when the writer closes it
+	diskWriteLock.enter();
+
+	for (auto writer : streamWriters)
 	{
-		if (fileArray[i] != nullptr)
-		{
-			if (blockIndex[i] < BLOCK_LENGTH)
-			{
-				// fill out the rest of the current buffer
-				writeContinuousBuffer(zeroBuffer.getReadPointer(0),
-                                      zeroBufferDouble.getReadPointer(0),
-                                      BLOCK_LENGTH - blockIndex[i], i);
-				diskWriteLock.enter();
-				fclose(fileArray[i]);
-				diskWriteLock.exit();
-			}
-		}
+		writer->finish();
+		writer->close();
 	}
-	fileArray.clear();
 
-	blockIndex.clear();
-    samplesSinceLastRecord.clear();
-    
-    for (int i = 0; i < timestampFileArray.size(); i++)
-    {
-        if (timestampFileArray[i] != nullptr)
-        {
-            diskWriteLock.enter();
-            fclose(timestampFileArray[i]);
-            timestampFileArray.set(i, nullptr);
-            diskWriteLock.exit();
-        }
-    }
+	diskWriteLock.exit();
+
+	streamWriters.clear();
 	
     for (int i = 0; i < spikeFileArray.size(); i++)
 	{
@@ -509,48 +771,17 @@ void OpenEphysFormat::writeContinuousData(int writeChannel,
                                            const double* timestampBuffer,
                                            int size)
 {
-	int samplesWritten = 0;
+	StreamWriter* writer = streamWriters[channelStreamIndex[writeChannel]];
 
-    samplesSinceLastRecord.set(writeChannel, 0);
-
-	int nSamples = size;
-
-	while (samplesWritten < nSamples) // there are still unwritten samples in this buffer
-	{
-		int numSamplesToWrite = nSamples - samplesWritten;
-
-		if (blockIndex[writeChannel] + numSamplesToWrite < BLOCK_LENGTH) // we still have space in this block
-		{
-
-			// write buffer to disk!
-			writeContinuousBuffer(buffer + samplesWritten,
-                timestampBuffer + samplesWritten,
-				numSamplesToWrite,
-				writeChannel);
-
-            samplesSinceLastRecord.set(writeChannel, samplesSinceLastRecord[writeChannel] + numSamplesToWrite);
-			blockIndex.set(writeChannel, blockIndex[writeChannel] + numSamplesToWrite);
-			samplesWritten += numSamplesToWrite;
-
-		}
-		else   // there's not enough space left in this block for all remaining samples
-		{
-
-			numSamplesToWrite = BLOCK_LENGTH - blockIndex[writeChannel];
-
-			// write buffer to disk!
-			writeContinuousBuffer(buffer + samplesWritten,
-                timestampBuffer + samplesWritten,
-				numSamplesToWrite,
-				writeChannel);
+	diskWriteLock.enter();
 
-			// update our variables
-			samplesWritten += numSamplesToWrite;
-            samplesSinceLastRecord.set(writeChannel, samplesSinceLastRecord[writeChannel] + numSamplesToWrite);
-			blockIndex.set(writeChannel, 0); // back to the beginning of the block
-		}
-	}
+	writer->write(channelIndexInStream[writeChannel],
+		buffer,
+		timestampBuffer,
+		getLatestSampleNumber(writeChannel),
+		size);
 
+	diskWriteLock.exit();
 }
 
 void OpenEphysFormat::writeEvent(int eventChannel, const EventPacket& event)
@@ -565,6 +796,9 @@ void OpenEphysFormat::writeEvent(int eventChannel, const EventPacket& event)
         
         const EventChannel* info = getEventChannel(eventChannel);
         writeTTLEvent(info, event);
+
+        if (eventGated && filesAreOpen)
+            openGate(info->getStreamId(), Event::getSampleNumber(event));
     }
 }
 
@@ -700,108 +934,19 @@ void OpenEphysFormat::writeTTLEvent(const EventChannel* info, const EventPacket&
 
 
 
-void OpenEphysFormat::writeContinuousBuffer(const float* data, const double* timestamps, int nSamples, int writeChannel)
+void OpenEphysFormat::openGate(uint16 streamId, int64 sampleNumber)
 {
-	// check to see if the file exists
-	if (fileArray[writeChannel] == nullptr)
-		return;
-
-	// scale the data back into the range of int16
-    const ContinuousChannel* ch = getContinuousChannel(getGlobalIndex(writeChannel));
-	float scaleFactor = float(0x7fff) * ch->getBitVolts();
-
-	for (int n = 0; n < nSamples; n++)
+	for (int i = 0; i < firstChannelsInStream.size(); i++)
 	{
-		*(continuousDataFloatBuffer + n) = *(data + n) / scaleFactor;
-	}
-	AudioDataConverters::convertFloatToInt16BE(continuousDataFloatBuffer, continuousDataIntegerBuffer, nSamples);
-
-	if (blockIndex[writeChannel] == 0)
-	{
-		writeSampleNumberAndCount(fileArray[writeChannel], writeChannel);
-        
-        int index = firstChannelsInStream.indexOf(ch);
-        
-        if (index > -1)
-        {
-            writeSynchronizedTimestamp(timestampFileArray[index], timestamps);
-        }
-	}
-
-	diskWriteLock.enter();
-
-	size_t count = fwrite(continuousDataIntegerBuffer,      // ptr
-		2,                                // size of each element
-		nSamples,                         // count
-		fileArray[writeChannel]); // ptr to FILE object
-
-	LOGB(writeChannel, " : ", nSamples, " : ", count);
-
-	jassert(count == nSamples); // make sure all the data was written
-	(void)count;  // Suppress unused variable warning in release builds
-
-	diskWriteLock.exit();
+		if (firstChannelsInStream[i]->getStreamId() != streamId)
+			continue;
 
-	if (blockIndex[writeChannel] + nSamples == BLOCK_LENGTH)
-	{
-		writeRecordMarker(fileArray[writeChannel]);
+		diskWriteLock.enter();
+		streamWriters[i]->openGate(sampleNumber);
+		diskWriteLock.exit();
 	}
 }
 
-
-void OpenEphysFormat::writeSynchronizedTimestamp(FILE* file, const double* ts)
-{
-    
-    diskWriteLock.enter();
-    
-    fwrite(ts,         // ptr
-        8,              // size of each element
-        1,              // count
-        file);          // ptr to FILE object
-    
-    diskWriteLock.exit();
-}
-
-void OpenEphysFormat::writeSampleNumberAndCount(FILE* file, int channel)
-{
-	diskWriteLock.enter();
-
-	uint16 samps = BLOCK_LENGTH;
-
-	int64 sampleNumber = getLatestSampleNumber(channel) + samplesSinceLastRecord[channel];
-
-	fwrite(&sampleNumber,                       // ptr
-		8,                               // size of each element
-		1,                               // count
-		file); // ptr to FILE object
-
-	fwrite(&samps,                           // ptr
-		2,                               // size of each element
-		1,                               // count
-		file); // ptr to FILE object
-
-	fwrite(&recordingNumber,                         // ptr
-		2,                               // size of each element
-		1,                               // count
-		file); // ptr to FILE object
-
-	diskWriteLock.exit();
-}
-
-void OpenEphysFormat::writeRecordMarker(FILE* file)
-{
-
-	diskWriteLock.enter();
-
-	fwrite(recordMarker,     // ptr
-		1,                   // size of each element
-		10,                  // count
-		file);               // ptr to FILE object
-
-	diskWriteLock.exit();
-}
-
-
 void OpenEphysFormat::writeXml()
 {
 	String name = recordPath + "structure";
@@ -841,6 +986,16 @@ void OpenEphysFormat::writeXml()
             channelXml->setAttribute("bitVolts", channelInfo->bitVolts);
             channelXml->setAttribute("filename", channelInfo->filename);
             channelXml->setAttribute("position", (double)(channelInfo->startPos));  //As long as the file doesnt exceed 2^53 bytes, this will have integer precission. Better than limiting to 32bits.
+
+            if (channelInfo->packedIndex >= 0)
+                channelXml->setAttribute("packed_index", channelInfo->packedIndex);
+
+            if (channelInfo->summaryFilename.length() > 0)
+            {
+                channelXml->setAttribute("summary", channelInfo->summaryFilename);
+                channelXml->setAttribute("summary_position", (double)(channelInfo->summaryStartPos));
+            }
+
             streamXml->addChildElement(channelXml);
 		}
         
@@ -869,6 +1024,31 @@ void OpenEphysFormat::writeXml()
             timestampChannelXml->setAttribute("filename", streamInfo->timestampFileName);
             streamXml->addChildElement(timestampChannelXml);
         }
+
+        if (streamInfo->packedFileName.length() > 0)
+        {
+            XmlElement* packedXml = new XmlElement("PACKED");
+            packedXml->setAttribute("filename", streamInfo->packedFileName);
+            packedXml->setAttribute("index", streamInfo->packedIndexFileName);
+            packedXml->setAttribute("num_channels", streamInfo->channels.size());
+            packedXml->setAttribute("position", (double)(streamInfo->packedStartPos));
+            streamXml->addChildElement(packedXml);
+        }
+
+        if (streamInfo->npyTimestampFileName.length() > 0)
+        {
+            XmlElement* npyXml = new XmlElement("NPY_TIMESTAMPS");
+            npyXml->setAttribute("filename", streamInfo->npyTimestampFileName);
+            streamXml->addChildElement(npyXml);
+        }
+
+        if (streamInfo->npyContinuousFileName.length() > 0)
+        {
+            XmlElement* npyXml = new XmlElement("NPY_CONTINUOUS");
+            npyXml->setAttribute("filename", streamInfo->npyContinuousFileName);
+            npyXml->setAttribute("num_channels", streamInfo->channels.size());
+            streamXml->addChildElement(npyXml);
+        }
         
         
         recordingXml->addChildElement(streamXml);
@@ -881,6 +1061,11 @@ void OpenEphysFormat::writeXml()
 
 void OpenEphysFormat::setParameter(EngineParameter& parameter)
 {
-    //NOT USED
-    
+    boolParameter(0, writeNpyTimestamps);
+    boolParameter(1, writeNpyContinuousData);
+    boolParameter(2, writeRecordSummaries);
+    boolParameter(3, writePackedStreams);
+    boolParameter(4, eventGated);
+    floatParameter(5, gatePreSeconds);
+    floatParameter(6, gatePostSeconds);
 }
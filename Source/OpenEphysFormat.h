@@ -30,6 +30,7 @@
 #include <map>
 
 #include "Definitions.h"
+#include "StreamWriter.h"
 
 class OpenEphysFormat : public RecordEngine
 {
@@ -72,7 +73,7 @@ public:
 								float sourceSampleRate, 
 								String text);
     
-    /** Sets an engine parameter (in this case TTL word writing bool) */
+    /** Sets an engine parameter (NPY export, record summary and packed stream options) */
     void setParameter(EngineParameter& parameter);
 
 private:
@@ -81,13 +82,28 @@ private:
 	String getFileName(int channelIndex);
 
 	/** Opens a continuous channel file for writing */
-	String openContinuousFile(File rootFolder, const ChannelInfoObject* ch, int channelIndex);
+	FILE* openContinuousFile(File rootFolder, const ChannelInfoObject* ch, String fileName);
+
+	/** Opens the packed data, index and summary files for one stream */
+	void openPackedStream(File rootFolder, int firstChannel, int numChannels);
+
+	/** Opens the record summary file that accompanies a continuous channel file */
+	FILE* openSummaryFile(File rootFolder, const ChannelInfoObject* ch, String fileName);
+
+	/** Opens the record index of a stream, next to the continuous file of its first channel */
+	FILE* openIndexFile(File rootFolder, const ChannelInfoObject* ch, String fileName);
     
     /** Opens an event file for writing */
     String openEventFile(File rootFolder, const ChannelInfoObject* ch);
     
-    /** Opens a spike file for writing */
-    String openTimestampFile(File rootFolder, const ChannelInfoObject* channel);
+    /** Opens the record timestamps file of a stream for writing */
+    FILE* openTimestampFile(File rootFolder, String fileName);
+
+    /** Opens the NPY sidecar files (timestamps and/or sample matrix) for one stream */
+    void openNpyFiles(File rootFolder, const ChannelInfoObject* channel, int numChannels);
+
+    /** Returns the common file name prefix for all per-stream files */
+    String getStreamBaseName(const ChannelInfoObject* channel);
 
 	/** Opens a spike file for writing */
 	String openSpikeFile(File rootFolder, const SpikeChannel* elec, int channelIndex);
@@ -95,20 +111,8 @@ private:
 	/** Opens messages.events for writing */
 	void openMessageFile(File rootFolder);
 	
-	/** Writes a block of continuous data*/
-    void writeContinuousBuffer(const float* data, const double* timestamps, int nSamples, int channel);
-
-	/** Writes the timestamp sync texts info */
-	void writeSampleNumberAndCount(FILE* file, int channel);
-    
-    /** Writes the synchronized timestamp for one stream / block combo */
-    void writeSynchronizedTimestamp(FILE* file, const double* ts);
-    
-    /** Writes the synchronized timestamp for one stream / block combo */
-    void writeNpyTimestamp(NpyFile* file, const double* ts);
-
-	/** Write a 10-byte marker indicating the end of a record */
-	void writeRecordMarker(FILE* file);
+	/** Opens (or extends) the recording window of a stream around an event */
+	void openGate(uint16 streamId, int64 sampleNumber);
 
 	/** Writes a TTL event from an EventPacket */
 	void writeTTLEvent(const EventChannel* info, const EventPacket& packet);
@@ -119,39 +123,49 @@ private:
 	/** Writes the channel metadata XML*/
 	void writeXml();
 
-	Array<int> blockIndex;
-	Array<int> samplesSinceLastRecord;
 	uint16 recordingNumber;
 	int experimentNumber;
 
-	/** Holds data that has been converted from float to int16 before saving. */
-	HeapBlock<int16> continuousDataIntegerBuffer;
-
-	/** Holds data that has been converted from float to int16 before saving. */
-	HeapBlock<float> continuousDataFloatBuffer;
-
-	/** Used to indicate the end of each record */
-	HeapBlock<uint8> recordMarker;
-
-    /** Stores zeros to pad the final block of data */
-	AudioBuffer<float> zeroBuffer;
-    AudioBuffer<double> zeroBufferDouble;
-
     /** Global message file */
 	FILE* messageFile;
     
-    /** Array of continuous channel files (one per recorded channel) */
-	Array<FILE*> fileArray;
+    /** Writes the continuous data, record index and timestamps of each stream */
+    OwnedArray<StreamWriter> streamWriters;
     
     /** Array of event channel files (one per stream) */
     Array<FILE*> eventFileArray;
     
-    /** Array of timestamps files (one per stream) */
-    Array<FILE*> timestampFileArray;
-    
     /** Pointer to first channel in each stream */
     Array<const ContinuousChannel*> firstChannelsInStream;
     
+    /** Stream index of each recorded channel */
+    Array<int> channelStreamIndex;
+
+    /** Index of each recorded channel within its stream */
+    Array<int> channelIndexInStream;
+
+    /** Engine parameter: write per-sample timestamps as NPY */
+    bool writeNpyTimestamps;
+
+    /** Engine parameter: write the interleaved sample matrix as NPY */
+    bool writeNpyContinuousData;
+
+    /** Engine parameter: write per-record statistics to .summary files */
+    bool writeRecordSummaries;
+
+    /** Engine parameter: write one packed file per stream instead of one file per channel */
+    bool writePackedStreams;
+
+    /** Engine parameter: only write records around events */
+    bool eventGated;
+
+    /** Engine parameters: seconds of data kept before / after each event in gated mode */
+    float gatePreSeconds;
+    float gatePostSeconds;
+
+    /** True between openFiles and closeFiles */
+    bool filesAreOpen;
+
     /** Map between stream IDs and event files*/
     std::map<uint16, FILE*> eventFileMap;
     
@@ -169,7 +183,7 @@ private:
         int num_channels;
         int num_samples;
         float bitVolts;
-        long int startPos;
+        int64 startPos;
     };
 
     /** Stores info about a continuous channel (written to XML)*/
@@ -178,7 +192,10 @@ private:
 		String name;
 		String filename;
 		float bitVolts;
-		long int startPos;
+		int64 startPos;
+		String summaryFilename;
+		int64 summaryStartPos;
+		int packedIndex;
 	};
     
     /** Stores info about a data stream (written to XML) */
@@ -187,6 +204,13 @@ private:
         uint16 streamId;
         String eventFileName;
         String timestampFileName;
+        String npyTimestampFileName;
+        String npyContinuousFileName;
+        String packedFileName;
+        String packedIndexFileName;
+        String packedSummaryFileName;
+        int64 packedStartPos;
+        int64 packedSummaryStartPos;
         String name;
         int sourceNodeId;
         String sourceNodeName;
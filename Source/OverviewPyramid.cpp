@@ -0,0 +1,282 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "OverviewPyramid.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "Definitions.h"
+
+namespace
+{
+	const char overviewMagic[8] = { 'O', 'E', 'O', 'V', 'R', 'V', '0', '1' };
+	const uint32_t byteOrderMarker = 0x01020304;
+}
+
+int64_t OverviewPyramid::getBinSize(int level)
+{
+	int64_t size = BASE_BIN;
+
+	for (int i = 0; i < level; i++)
+		size *= FACTOR;
+
+	return size;
+}
+
+void OverviewPyramid::layout()
+{
+	levelBins.clear();
+	levelOffsets.clear();
+	binsPerChannel = 0;
+
+	int64_t numBins = std::max<int64_t>(1, (numSamples + BASE_BIN - 1) / BASE_BIN);
+
+	while (true)
+	{
+		levelBins.push_back(numBins);
+		levelOffsets.push_back(binsPerChannel);
+		binsPerChannel += numBins;
+
+		if (numBins == 1)
+			break;
+
+		numBins = (numBins + FACTOR - 1) / FACTOR;
+	}
+
+	data.assign((size_t) (2 * binsPerChannel * numChannels), 0);
+}
+
+void OverviewPyramid::reset(int channels, int64_t samples)
+{
+	numChannels = std::max(0, channels);
+	numSamples = std::max<int64_t>(0, samples);
+
+	layout();
+
+	// empty bins start inverted, so the first sample sets both ends
+	for (int c = 0; c < numChannels; c++)
+	{
+		int16_t* level0 = bins(c, 0);
+
+		for (int64_t i = 0; i < levelBins[0]; i++)
+		{
+			level0[2 * i] = INT16_MAX;
+			level0[2 * i + 1] = INT16_MIN;
+		}
+	}
+
+	coverage.assign((size_t) (levelBins[0] * numChannels), 0);
+}
+
+void OverviewPyramid::add(int channel, int64_t position, int64_t count, int16_t minimum, int16_t maximum)
+{
+	if (channel < 0 || channel >= numChannels)
+		return;
+
+	int16_t* level0 = bins(channel, 0);
+	uint16_t* covered = coverage.data() + channel * levelBins[0];
+
+	// a run of samples can straddle bins when records aren't aligned to them
+	for (int64_t end = std::min(position + count, numSamples); position < end;)
+	{
+		const int64_t bin = position / BASE_BIN;
+		const int64_t inBin = std::min(end, (bin + 1) * BASE_BIN) - position;
+
+		level0[2 * bin] = std::min(level0[2 * bin], minimum);
+		level0[2 * bin + 1] = std::max(level0[2 * bin + 1], maximum);
+		covered[bin] = (uint16_t) std::min<int64_t>(BASE_BIN, covered[bin] + inBin);
+
+		position += inBin;
+	}
+}
+
+void OverviewPyramid::finish()
+{
+	for (int c = 0; c < numChannels; c++)
+	{
+		int16_t* level0 = bins(c, 0);
+		const uint16_t* covered = coverage.data() + c * levelBins[0];
+
+		// Bins with samples that weren't recorded also contain zeros
+		for (int64_t i = 0; i < levelBins[0]; i++)
+		{
+			const int64_t binSamples = std::min<int64_t>(BASE_BIN, numSamples - i * BASE_BIN);
+
+			if (covered[i] < binSamples)
+			{
+				level0[2 * i] = std::min<int16_t>(level0[2 * i], 0);
+				level0[2 * i + 1] = std::max<int16_t>(level0[2 * i + 1], 0);
+			}
+		}
+
+		for (int level = 1; level < getNumLevels(); level++)
+		{
+			const int16_t* below = bins(c, level - 1);
+			int16_t* above = bins(c, level);
+
+			for (int64_t i = 0; i < levelBins[level]; i++)
+			{
+				const int64_t first = i * FACTOR;
+				const int64_t last = std::min(first + FACTOR, levelBins[level - 1]);
+
+				int16_t minimum = below[2 * first];
+				int16_t maximum = below[2 * first + 1];
+
+				for (int64_t j = first + 1; j < last; j++)
+				{
+					minimum = std::min(minimum, below[2 * j]);
+					maximum = std::max(maximum, below[2 * j + 1]);
+				}
+
+				above[2 * i] = minimum;
+				above[2 * i + 1] = maximum;
+			}
+		}
+	}
+
+	coverage.clear();
+	coverage.shrink_to_fit();
+}
+
+bool OverviewPyramid::load(const std::string& path, uint64_t signature)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (file == nullptr)
+		return false;
+
+	OverviewFileHeader header;
+
+	bool ok = fseek(file, HEADER_SIZE, SEEK_SET) == 0
+		&& fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, overviewMagic, sizeof(overviewMagic)) == 0
+		&& header.byteOrder == byteOrderMarker
+		&& header.signature == signature
+		&& header.baseBin == BASE_BIN
+		&& header.factor == FACTOR;
+
+	if (ok)
+	{
+		numChannels = (int) header.numChannels;
+		numSamples = header.numSamples;
+
+		layout();
+
+		ok = fread(data.data(), sizeof(int16_t), data.size(), file) == data.size();
+	}
+
+	fclose(file);
+
+	if (!ok)
+		reset(0, 0);
+
+	coverage.clear();
+
+	return ok;
+}
+
+bool OverviewPyramid::save(const std::string& path, const std::string& header, uint64_t signature) const
+{
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if (file == nullptr)
+		return false;
+
+	std::string paddedHeader = header.substr(0, HEADER_SIZE);
+	paddedHeader.resize(HEADER_SIZE, ' ');
+
+	OverviewFileHeader binaryHeader;
+	memcpy(binaryHeader.magic, overviewMagic, sizeof(overviewMagic));
+	binaryHeader.byteOrder = byteOrderMarker;
+	binaryHeader.numChannels = (uint32_t) numChannels;
+	binaryHeader.numSamples = numSamples;
+	binaryHeader.signature = signature;
+	binaryHeader.baseBin = BASE_BIN;
+	binaryHeader.factor = FACTOR;
+
+	bool ok = fwrite(paddedHeader.data(), 1, HEADER_SIZE, file) == HEADER_SIZE
+		&& fwrite(&binaryHeader, sizeof(binaryHeader), 1, file) == 1
+		&& fwrite(data.data(), sizeof(int16_t), data.size(), file) == data.size();
+
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok)
+		remove(path.c_str());
+
+	return ok;
+}
+
+void OverviewPyramid::getEnvelope(int channel, int64_t start, int64_t end, int numPixels, int16_t* minimums, int16_t* maximums) const
+{
+	if (numPixels <= 0)
+		return;
+
+	if (channel < 0 || channel >= numChannels || end <= start)
+	{
+		std::fill(minimums, minimums + numPixels, int16_t(0));
+		std::fill(maximums, maximums + numPixels, int16_t(0));
+		return;
+	}
+
+	// coarsest level with bins no larger than a pixel
+	const int64_t samplesPerPixel = (end - start) / numPixels;
+	int level = 0;
+
+	while (level + 1 < getNumLevels() && getBinSize(level + 1) <= samplesPerPixel)
+		level++;
+
+	const int64_t binSize = getBinSize(level);
+	const int16_t* levelData = bins(channel, level);
+	const int64_t numBins = levelBins[level];
+
+	for (int i = 0; i < numPixels; i++)
+	{
+		const int64_t pixelStart = start + (end - start) * i / numPixels;
+		const int64_t pixelEnd = std::max(pixelStart + 1, start + (end - start) * (i + 1) / numPixels);
+
+		if (pixelStart < 0 || pixelStart >= numSamples)
+		{
+			minimums[i] = 0;
+			maximums[i] = 0;
+			continue;
+		}
+
+		const int64_t firstBin = pixelStart / binSize;
+		const int64_t lastBin = std::min(numBins - 1, (pixelEnd - 1) / binSize);
+
+		int16_t minimum = levelData[2 * firstBin];
+		int16_t maximum = levelData[2 * firstBin + 1];
+
+		for (int64_t j = firstBin + 1; j <= lastBin; j++)
+		{
+			minimum = std::min(minimum, levelData[2 * j]);
+			maximum = std::max(maximum, levelData[2 * j + 1]);
+		}
+
+		minimums[i] = minimum;
+		maximums[i] = maximum;
+	}
+}
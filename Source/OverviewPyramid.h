@@ -0,0 +1,117 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OVERVIEWPYRAMID_H_DEFINED
+#define OVERVIEWPYRAMID_H_DEFINED
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+	Minimum and maximum of every channel of a stream at several resolutions.
+
+	Level 0 has one bin per BASE_BIN samples, and each level above it merges
+	FACTOR bins of the one below, up to a level with a single bin. Samples that
+	were not recorded count as zeros, as the File Source plays them back.
+
+	Overview files start with a 1024-byte text header, followed by an
+	OverviewFileHeader and then, for each channel and each level in turn, one
+	int16 minimum and one int16 maximum per bin (in the byte order of the machine
+	that wrote them; the header has a byte order marker).
+*/
+class OverviewPyramid
+{
+public:
+
+	static const int BASE_BIN = 1024;
+	static const int FACTOR = 16;
+
+	/** Clears all bins, for a stream with numChannels channels of numSamples samples */
+	void reset(int numChannels, int64_t numSamples);
+
+	/** Adds the minimum and maximum of 'count' consecutive recorded samples of a channel, starting at 'position' */
+	void add(int channel, int64_t position, int64_t count, int16_t minimum, int16_t maximum);
+
+	/** Accounts for the samples that weren't recorded and computes the levels above level 0 */
+	void finish();
+
+	/** Reads an overview file; fails if it wasn't built from source files with this signature */
+	bool load(const std::string& path, uint64_t signature);
+
+	/** Writes a header (padded to HEADER_SIZE) followed by all levels */
+	bool save(const std::string& path, const std::string& header, uint64_t signature) const;
+
+	/** Fills one minimum and maximum per pixel for samples [start, end) of a channel, from the
+		coarsest level whose bins are no larger than a pixel (level 0 if pixels are smaller than its
+		bins). Reads at most FACTOR + 1 bins per pixel. Pixels past the end of the stream are zero. */
+	void getEnvelope(int channel, int64_t start, int64_t end, int numPixels, int16_t* minimums, int16_t* maximums) const;
+
+	/** Number of channels */
+	int getNumChannels() const { return numChannels; }
+
+	/** Number of samples per channel */
+	int64_t getNumSamples() const { return numSamples; }
+
+	/** Number of levels */
+	int getNumLevels() const { return (int) levelBins.size(); }
+
+	/** Number of samples per bin of a level */
+	static int64_t getBinSize(int level);
+
+private:
+
+	/** Sets up the levels for the current channel and sample counts */
+	void layout();
+
+	/** Minimum (even) and maximum (odd) of bin 0 of a level of a channel */
+	int16_t* bins(int channel, int level) { return data.data() + 2 * (channel * binsPerChannel + levelOffsets[level]); }
+	const int16_t* bins(int channel, int level) const { return data.data() + 2 * (channel * binsPerChannel + levelOffsets[level]); }
+
+	int numChannels = 0;
+	int64_t numSamples = 0;
+
+	std::vector<int64_t> levelBins;
+	std::vector<int64_t> levelOffsets;
+	int64_t binsPerChannel = 0;
+
+	std::vector<int16_t> data;
+
+	/** Recorded samples in each level 0 bin, while building */
+	std::vector<uint16_t> coverage;
+};
+
+/** Binary header of an overview file, after the text header */
+struct OverviewFileHeader
+{
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t numChannels;
+	int64_t numSamples;
+	uint64_t signature;
+	int32_t baseBin;
+	int32_t factor;
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RecordIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "Definitions.h"
+
+namespace
+{
+	int seekTo(FILE* file, int64_t position)
+	{
+#ifdef _WIN32
+		return _fseeki64(file, position, SEEK_SET);
+#else
+		return fseeko(file, (off_t) position, SEEK_SET);
+#endif
+	}
+
+	int64_t getSize(FILE* file)
+	{
+#ifdef _WIN32
+		_fseeki64(file, 0, SEEK_END);
+		return _ftelli64(file);
+#else
+		fseeko(file, 0, SEEK_END);
+		return (int64_t) ftello(file);
+#endif
+	}
+}
+
+bool RecordIndex::load(const std::string& indexPath)
+{
+	entries.clear();
+
+	FILE* file = fopen(indexPath.c_str(), "rb");
+
+	if (file == nullptr)
+		return false;
+
+	int64_t numEntries = (getSize(file) - HEADER_SIZE) / (int64_t) sizeof(RecordIndexEntry);
+
+	bool ok = numEntries >= 0 && seekTo(file, HEADER_SIZE) == 0;
+
+	if (ok)
+	{
+		entries.resize((size_t) numEntries);
+		ok = fread(entries.data(), sizeof(RecordIndexEntry), entries.size(), file) == entries.size();
+	}
+
+	fclose(file);
+
+	if (!ok)
+		entries.clear();
+
+	return ok;
+}
+
+bool RecordIndex::build(const std::string& dataPath, int64_t firstOffset, int64_t recordBytes)
+{
+	entries.clear();
+
+	FILE* file = fopen(dataPath.c_str(), "rb");
+
+	if (file == nullptr)
+		return false;
+
+	const int64_t numRecords = (getSize(file) - firstOffset) / recordBytes;
+
+	if (numRecords > 0)
+		entries.reserve((size_t) numRecords);
+
+	// Only the 12-byte header of each record is needed; reading in large chunks
+	// keeps this sequential for per-channel files
+	const int64_t recordsPerChunk = std::max<int64_t>(1, (int64_t(4) << 20) / recordBytes);
+	std::vector<uint8_t> chunk((size_t) (recordsPerChunk * recordBytes));
+
+	bool ok = seekTo(file, firstOffset) == 0;
+
+	for (int64_t record = 0; ok && record < numRecords; record += recordsPerChunk)
+	{
+		const int64_t count = std::min(recordsPerChunk, numRecords - record);
+
+		ok = fread(chunk.data(), (size_t) recordBytes, (size_t) count, file) == (size_t) count;
+
+		for (int64_t i = 0; ok && i < count; i++)
+		{
+			const uint8_t* header = chunk.data() + i * recordBytes;
+
+			RecordIndexEntry entry;
+			entry.offset = firstOffset + (record + i) * recordBytes;
+			memcpy(&entry.sampleNumber, header, 8);
+			memcpy(&entry.numSamples, header + 8, 2);
+			memcpy(&entry.recordingNumber, header + 10, 2);
+			entry.flags = 0;
+
+			entries.push_back(entry);
+		}
+	}
+
+	fclose(file);
+
+	return ok;
+}
+
+bool RecordIndex::save(const std::string& indexPath, const std::string& header) const
+{
+	FILE* file = fopen(indexPath.c_str(), "wb");
+
+	if (file == nullptr)
+		return false;
+
+	std::string paddedHeader = header.substr(0, HEADER_SIZE);
+	paddedHeader.resize(HEADER_SIZE, ' ');
+
+	bool ok = fwrite(paddedHeader.data(), 1, HEADER_SIZE, file) == HEADER_SIZE
+		&& fwrite(entries.data(), sizeof(RecordIndexEntry), entries.size(), file) == entries.size();
+
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok)
+		remove(indexPath.c_str());
+
+	return ok;
+}
+
+int64_t RecordIndex::findOffset(int64_t offset) const
+{
+	auto it = std::lower_bound(entries.begin(), entries.end(), offset,
+		[](const RecordIndexEntry& entry, int64_t value) { return entry.offset < value; });
+
+	return (int64_t) (it - entries.begin());
+}
+
+void RecordIndex::truncate(int64_t numEntries)
+{
+	if (numEntries >= 0 && numEntries < size())
+		entries.resize((size_t) numEntries);
+}
+
+int64_t RecordIndex::countEntries(const std::string& indexPath)
+{
+	FILE* file = fopen(indexPath.c_str(), "rb");
+
+	if (file == nullptr)
+		return -1;
+
+	int64_t numEntries = std::max<int64_t>(0, (getSize(file) - HEADER_SIZE) / (int64_t) sizeof(RecordIndexEntry));
+
+	fclose(file);
+
+	return numEntries;
+}
+
+bool RecordIndex::readEntry(const std::string& indexPath, int64_t index, RecordIndexEntry& entry)
+{
+	FILE* file = fopen(indexPath.c_str(), "rb");
+
+	if (file == nullptr)
+		return false;
+
+	bool ok = seekTo(file, HEADER_SIZE + index * (int64_t) sizeof(RecordIndexEntry)) == 0
+		&& fread(&entry, sizeof(RecordIndexEntry), 1, file) == 1;
+
+	fclose(file);
+
+	return ok;
+}
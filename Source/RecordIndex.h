@@ -0,0 +1,96 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RECORDINDEX_H_DEFINED
+#define RECORDINDEX_H_DEFINED
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+	One entry of a record index file.
+
+	Index files start with a 1024-byte text header, followed by one entry
+	per record (or, for packed stream files, per frame of records).
+*/
+struct RecordIndexEntry
+{
+	int64_t offset;
+	int64_t sampleNumber;
+	uint16_t recordingNumber;
+	uint16_t numSamples;
+	uint32_t flags;
+};
+
+static_assert(sizeof(RecordIndexEntry) == 24, "RecordIndexEntry must match the on-disk layout");
+
+/**
+	The entries of a record index file, in memory.
+
+	Entries are in file order, one per record of a continuous file or per frame
+	of a packed file, and every record of the data file after the first indexed
+	one has an entry, so entry i describes the record i * recordBytes after it.
+*/
+class RecordIndex
+{
+public:
+
+	/** Reads all entries of an index file; returns false if it can't be read */
+	bool load(const std::string& indexPath);
+
+	/** Rebuilds the entries from the record headers of a data file, starting at firstOffset,
+		with consecutive records (or frames) recordBytes apart. Returns false if the file can't be read. */
+	bool build(const std::string& dataPath, int64_t firstOffset, int64_t recordBytes);
+
+	/** Writes a header (padded to HEADER_SIZE) followed by all entries */
+	bool save(const std::string& indexPath, const std::string& header) const;
+
+	/** Number of entries */
+	int64_t size() const { return (int64_t) entries.size(); }
+
+	/** Returns an entry */
+	const RecordIndexEntry& operator[](int64_t index) const { return entries[(size_t) index]; }
+
+	/** Returns the first entry, for direct access to all of them */
+	const RecordIndexEntry* data() const { return entries.data(); }
+
+	/** Index of the first entry at or after a byte offset of the data file */
+	int64_t findOffset(int64_t offset) const;
+
+	/** Drops the entries past the first numEntries */
+	void truncate(int64_t numEntries);
+
+	/** Number of entries in an index file, without reading them (-1 if it doesn't exist) */
+	static int64_t countEntries(const std::string& indexPath);
+
+	/** Reads a single entry of an index file */
+	static bool readEntry(const std::string& indexPath, int64_t index, RecordIndexEntry& entry);
+
+private:
+
+	std::vector<RecordIndexEntry> entries;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RECORDSUMMARY_H_DEFINED
+#define RECORDSUMMARY_H_DEFINED
+
+#include <stdint.h>
+
+/**
+	Summary statistics of one continuous record, in int16 units.
+
+	Entries are stored back to back (after a 1024-byte text header) in the
+	.summary file that accompanies each .continuous file, one per record,
+	in the same order as the records themselves.
+*/
+struct RecordSummary
+{
+	int64_t sampleNumber;
+	int64_t sum;
+	uint64_t sumOfSquares;
+	int16_t minimum;
+	int16_t maximum;
+	uint16_t numSamples;
+	uint16_t recordingNumber;
+};
+
+static_assert(sizeof(RecordSummary) == 32, "RecordSummary must match the on-disk layout");
+
+#endif
@@ -0,0 +1,341 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SampleKernels.h"
+
+#include <math.h>
+
+#ifdef OE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+void SampleKernels::resetSummary(RecordSummary& summary, int64_t sampleNumber, uint16_t recordingNumber)
+{
+	summary.sampleNumber = sampleNumber;
+	summary.sum = 0;
+	summary.sumOfSquares = 0;
+	summary.minimum = INT16_MAX;
+	summary.maximum = INT16_MIN;
+	summary.numSamples = 0;
+	summary.recordingNumber = recordingNumber;
+}
+
+void SampleKernels::convertToInt16BE(const float* source, int16_t* dest, int numSamples, float bitVolts, RecordSummary& summary)
+{
+	int16_t minimum = summary.minimum;
+	int16_t maximum = summary.maximum;
+	int64_t sum = summary.sum;
+	uint64_t sumOfSquares = summary.sumOfSquares;
+
+	int n = 0;
+
+#ifdef OE_USE_SSE2
+	const __m128 divisor = _mm_set1_ps(bitVolts);
+	const __m128 lowerLimit = _mm_set1_ps(-32767.0f);
+	const __m128 upperLimit = _mm_set1_ps(32767.0f);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i vMin = _mm_set1_epi16(minimum);
+	__m128i vMax = _mm_set1_epi16(maximum);
+	__m128i vSquares = zero;
+
+	while (n + 8 <= numSamples)
+	{
+		// 32-bit partial sums are flushed every 4096 samples so they cannot overflow
+		__m128i vSum = zero;
+		const int end = (numSamples - n < 4096) ? numSamples - 7 : n + 4096;
+
+		for (; n < end; n += 8)
+		{
+			__m128 lo = _mm_div_ps(_mm_loadu_ps(source + n), divisor);
+			__m128 hi = _mm_div_ps(_mm_loadu_ps(source + n + 4), divisor);
+
+			lo = _mm_min_ps(_mm_max_ps(lo, lowerLimit), upperLimit);
+			hi = _mm_min_ps(_mm_max_ps(hi, lowerLimit), upperLimit);
+
+			const __m128i samples = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+
+			vMin = _mm_min_epi16(vMin, samples);
+			vMax = _mm_max_epi16(vMax, samples);
+			vSum = _mm_add_epi32(vSum, _mm_madd_epi16(samples, ones));
+
+			// a pair of squared int16 values always fits in an unsigned 32-bit lane
+			const __m128i squares = _mm_madd_epi16(samples, samples);
+			vSquares = _mm_add_epi64(vSquares, _mm_unpacklo_epi32(squares, zero));
+			vSquares = _mm_add_epi64(vSquares, _mm_unpackhi_epi32(squares, zero));
+
+			const __m128i swapped = _mm_or_si128(_mm_slli_epi16(samples, 8), _mm_srli_epi16(samples, 8));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), swapped);
+		}
+
+		int32_t partialSums[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(partialSums), vSum);
+		sum += (int64_t) partialSums[0] + partialSums[1] + partialSums[2] + partialSums[3];
+	}
+
+	int16_t mins[8], maxs[8];
+	uint64_t squares[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vMin);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vMax);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(squares), vSquares);
+
+	for (int i = 0; i < 8; i++)
+	{
+		if (mins[i] < minimum) minimum = mins[i];
+		if (maxs[i] > maximum) maximum = maxs[i];
+	}
+
+	sumOfSquares += squares[0] + squares[1];
+#endif
+
+	for (; n < numSamples; n++)
+	{
+		float value = source[n] / bitVolts;
+
+		if (!(value > -32767.0f))
+			value = -32767.0f;
+		else if (value > 32767.0f)
+			value = 32767.0f;
+
+		const int16_t sample = (int16_t) lrintf(value);
+
+		if (sample < minimum) minimum = sample;
+		if (sample > maximum) maximum = sample;
+		sum += sample;
+		sumOfSquares += (uint64_t) ((int32_t) sample * sample);
+
+		const uint16_t bits = (uint16_t) sample;
+		dest[n] = (int16_t) (uint16_t) ((bits << 8) | (bits >> 8));
+	}
+
+	summary.minimum = minimum;
+	summary.maximum = maximum;
+	summary.sum = sum;
+	summary.sumOfSquares = sumOfSquares;
+	summary.numSamples = (uint16_t) (summary.numSamples + numSamples);
+}
+
+#ifdef OE_USE_SSE2
+/** Transposes 8 vectors of 8 int16 values in place (row k, element j becomes row j, element k) */
+static inline void transpose8x8(__m128i* r)
+{
+	__m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+	__m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+	__m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+	__m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+	__m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+	__m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+	__m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+	__m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	r[0] = _mm_unpacklo_epi64(b0, b4);
+	r[1] = _mm_unpackhi_epi64(b0, b4);
+	r[2] = _mm_unpacklo_epi64(b1, b5);
+	r[3] = _mm_unpackhi_epi64(b1, b5);
+	r[4] = _mm_unpacklo_epi64(b2, b6);
+	r[5] = _mm_unpackhi_epi64(b2, b6);
+	r[6] = _mm_unpacklo_epi64(b3, b7);
+	r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+#endif
+
+void SampleKernels::interleave(const int16_t* const* sources, int numChannels, int numSamples, int16_t* dest, int destStride)
+{
+	// Samples are processed in tiles, so the output rows being filled stay in cache
+	// while the channel groups are walked
+	const int tileSamples = 64;
+
+	for (int tileStart = 0; tileStart < numSamples; tileStart += tileSamples)
+	{
+		const int tileEnd = tileStart + tileSamples < numSamples ? tileStart + tileSamples : numSamples;
+
+		int c = 0;
+
+#ifdef OE_USE_SSE2
+		for (; c + 8 <= numChannels; c += 8)
+		{
+			int n = tileStart;
+
+			for (; n + 8 <= tileEnd; n += 8)
+			{
+				__m128i r[8];
+
+				for (int k = 0; k < 8; k++)
+					r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[c + k] + n));
+
+				transpose8x8(r);
+
+				for (int k = 0; k < 8; k++)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + int64_t(n + k) * destStride + c), r[k]);
+			}
+
+			for (; n < tileEnd; n++)
+				for (int k = c; k < c + 8; k++)
+					dest[int64_t(n) * destStride + k] = sources[k][n];
+		}
+#endif
+
+		for (; c < numChannels; c++)
+		{
+			const int16_t* source = sources[c];
+			int16_t* out = dest + c;
+
+			for (int n = tileStart; n < tileEnd; n++)
+				out[int64_t(n) * destStride] = source[n];
+		}
+	}
+}
+
+void SampleKernels::convertFromInt16BE(const int16_t* source, int numChannels, int sourceStride, int numSamples, const float* scales, float* const* dest)
+{
+	// Same tiling as interleave, in the other direction
+	const int tileSamples = 64;
+
+	for (int tileStart = 0; tileStart < numSamples; tileStart += tileSamples)
+	{
+		const int tileEnd = tileStart + tileSamples < numSamples ? tileStart + tileSamples : numSamples;
+
+		int c = 0;
+
+#ifdef OE_USE_SSE2
+		for (; c + 8 <= numChannels; c += 8)
+		{
+			int n = tileStart;
+
+			for (; n + 8 <= tileEnd; n += 8)
+			{
+				__m128i r[8];
+
+				for (int k = 0; k < 8; k++)
+					r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + int64_t(n + k) * sourceStride + c));
+
+				transpose8x8(r);
+
+				for (int k = 0; k < 8; k++)
+				{
+					// swap bytes, then sign-extend each half to 32 bits
+					__m128i v = _mm_or_si128(_mm_slli_epi16(r[k], 8), _mm_srli_epi16(r[k], 8));
+					__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+					__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+					const __m128 scale = _mm_set1_ps(scales[c + k]);
+
+					_mm_storeu_ps(dest[c + k] + n, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+					_mm_storeu_ps(dest[c + k] + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+				}
+			}
+
+			for (; n < tileEnd; n++)
+				for (int k = c; k < c + 8; k++)
+				{
+					uint16_t value = uint16_t(source[int64_t(n) * sourceStride + k]);
+					dest[k][n] = int16_t(uint16_t(value << 8) | (value >> 8)) * scales[k];
+				}
+		}
+#endif
+
+		for (; c < numChannels; c++)
+		{
+			const float scale = scales[c];
+			float* out = dest[c];
+
+			for (int n = tileStart; n < tileEnd; n++)
+			{
+				uint16_t value = uint16_t(source[int64_t(n) * sourceStride + c]);
+				out[n] = int16_t(uint16_t(value << 8) | (value >> 8)) * scale;
+			}
+		}
+	}
+}
+
+void SampleKernels::swapBytes(int16_t* data, size_t count)
+{
+	size_t i = 0;
+
+#ifdef OE_USE_SSE2
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i* block = reinterpret_cast<__m128i*>(data + i);
+		__m128i value = _mm_loadu_si128(block);
+		_mm_storeu_si128(block, _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		uint16_t value = uint16_t(data[i]);
+		data[i] = int16_t(uint16_t(value << 8) | (value >> 8));
+	}
+}
+
+namespace
+{
+	const size_t markerSize = 10;
+
+	bool isRecordMarker(const uint8_t* bytes)
+	{
+		for (size_t k = 0; k + 1 < markerSize; k++)
+			if (bytes[k] != k)
+				return false;
+
+		return bytes[markerSize - 1] == 255;
+	}
+}
+
+size_t SampleKernels::findRecordMarker(const uint8_t* data, size_t length)
+{
+	if (length < markerSize)
+		return length;
+
+	// i is where the last byte (255) of a marker would be; only those are compared in full
+	size_t i = markerSize - 1;
+
+#ifdef OE_USE_SSE2
+	const __m128i last = _mm_set1_epi8((char) 255);
+
+	for (; i + 16 <= length; i += 16)
+	{
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), last));
+
+		for (size_t k = 0; mask != 0; k++, mask >>= 1)
+			if ((mask & 1) != 0 && isRecordMarker(data + i + k - (markerSize - 1)))
+				return i + k - (markerSize - 1);
+	}
+#endif
+
+	for (; i < length; i++)
+		if (data[i] == 255 && isRecordMarker(data + i - (markerSize - 1)))
+			return i - (markerSize - 1);
+
+	return length;
+}
@@ -0,0 +1,77 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SAMPLEKERNELS_H_DEFINED
+#define SAMPLEKERNELS_H_DEFINED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RecordSummary.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define OE_USE_SSE2 1
+#endif
+
+/**
+	Conversion routines for Open Ephys sample data.
+*/
+namespace SampleKernels
+{
+	/** Resets a summary before the first sample of a new record */
+	void resetSummary(RecordSummary& summary, int64_t sampleNumber, uint16_t recordingNumber);
+
+	/** Scales float samples to int16 (value / bitVolts, rounded and clipped to +/-32767),
+		writes them big-endian to dest, and accumulates min, max, sum and sum of squares */
+	void convertToInt16BE(const float* source, int16_t* dest, int numSamples, float bitVolts, RecordSummary& summary);
+
+	/** Interleaves numSamples consecutive samples of each channel into dest
+		(sample-major, consecutive samples destStride values apart), without changing byte order.
+		A range of channels of a wider buffer can be written by offsetting dest. */
+	void interleave(const int16_t* const* sources, int numChannels, int numSamples, int16_t* dest, int destStride);
+
+	/** Interleaves into a buffer holding exactly numChannels values per sample */
+	inline void interleave(const int16_t* const* sources, int numChannels, int numSamples, int16_t* dest)
+	{
+		interleave(sources, numChannels, numSamples, dest, numChannels);
+	}
+
+	/** Splits an interleaved buffer of big-endian int16 samples (consecutive samples sourceStride values apart)
+		into one float buffer per channel, multiplying each channel by its scale (bitVolts) */
+	void convertFromInt16BE(const int16_t* source, int numChannels, int sourceStride, int numSamples, const float* scales, float* const* dest);
+
+	/** Converts a buffer holding exactly numChannels values per sample */
+	inline void convertFromInt16BE(const int16_t* source, int numChannels, int numSamples, const float* scales, float* const* dest)
+	{
+		convertFromInt16BE(source, numChannels, numChannels, numSamples, scales, dest);
+	}
+
+	/** Reverses the byte order of count int16 values in place (big-endian record samples to little-endian and back) */
+	void swapBytes(int16_t* data, size_t count);
+
+	/** Returns the offset of the first record marker (bytes 0, 1, ..., 8, 255) in data,
+		or length if there is none */
+	size_t findRecordMarker(const uint8_t* data, size_t length);
+}
+
+#endif
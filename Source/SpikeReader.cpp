@@ -0,0 +1,176 @@
+/*
+------------------------------------------------------------------
+
+This file is part of the Open Ephys GUI
+Copyright (C) 2021 Open Ephys
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SpikeReader.h"
+
+#include "Definitions.h"
+
+#include <algorithm>
+#include <numeric>
+
+SpikeReader::SpikeReader(const String& name_, const File& file_, int64 startPos_, int numChannels_, int numSamples_, double bitVolts_) :
+	name(name_),
+	file(file_),
+	startPos(startPos_),
+	numChannels(numChannels_),
+	numSamples(numSamples_),
+	bitVolts(bitVolts_),
+	indexed(false)
+{
+	recordSize = getRecordSize(numChannels, numSamples);
+}
+
+int64 SpikeReader::getRecordSize(int channels, int samples)
+{
+	// header, waveforms, gains, thresholds, recording number
+	return 42 + int64(channels) * samples * 2 + int64(channels) * 4 + int64(channels) * 2 + 2;
+}
+
+void SpikeReader::readHeader()
+{
+	const char* text = static_cast<const char*>(map->getData());
+	String header = String::fromUTF8(text, (int) jmin(int64(HEADER_SIZE), (int64) map->getSize()));
+
+	int headerChannels = header.fromFirstOccurrenceOf("header.num_channels = ", false, false).upToFirstOccurrenceOf(";", false, false).getIntValue();
+	int headerSamples = header.fromFirstOccurrenceOf("header.samplesPerSpike = ", false, false).upToFirstOccurrenceOf(";", false, false).getIntValue();
+
+	if (headerChannels > 0 && headerSamples > 0)
+	{
+		if (headerChannels != numChannels || headerSamples != numSamples)
+			LOGC("Spike file ", file.getFileName(), " has ", headerChannels, " x ", headerSamples, " samples per spike, not ",
+				numChannels, " x ", numSamples, "; using the file header");
+
+		numChannels = headerChannels;
+		numSamples = headerSamples;
+		recordSize = getRecordSize(numChannels, numSamples);
+	}
+}
+
+bool SpikeReader::buildIndex(const std::vector<int64_t>& recordingOffsets)
+{
+	if (indexed)
+		return true;
+
+	map.reset(new MemoryMappedFile(file, MemoryMappedFile::readOnly));
+
+	if (map->getData() == nullptr)
+	{
+		map.reset();
+		return false;
+	}
+
+	readHeader();
+
+	const uint8* data = static_cast<const uint8*>(map->getData());
+	const int64 numSpikes = jmax(int64(0), ((int64) map->getSize() - startPos) / recordSize);
+
+	spikePositions.resize((size_t) numSpikes);
+	spikeRecords.resize((size_t) numSpikes);
+
+	bool sorted = true;
+
+	for (int64 i = 0; i < numSpikes; i++)
+	{
+		const uint8* record = data + startPos + i * recordSize;
+
+		int64_t sampleNumber;
+		uint16 recordingNumber;
+		memcpy(&sampleNumber, record + 1, sizeof(sampleNumber));
+		memcpy(&recordingNumber, record + recordSize - 2, sizeof(recordingNumber));
+
+		int64_t offset = recordingNumber < recordingOffsets.size() ? recordingOffsets[recordingNumber]
+			: (recordingOffsets.empty() ? 0 : recordingOffsets.back());
+
+		spikePositions[i] = sampleNumber - offset;
+		spikeRecords[i] = i;
+
+		sorted = sorted && (i == 0 || spikePositions[i - 1] <= spikePositions[i]);
+	}
+
+	// Spikes are written as they arrive, which is almost always in order already
+	if (!sorted)
+	{
+		std::vector<int64_t> order(spikePositions.size());
+		std::iota(order.begin(), order.end(), int64_t(0));
+		std::stable_sort(order.begin(), order.end(), [this](int64_t a, int64_t b) { return spikePositions[a] < spikePositions[b]; });
+
+		std::vector<int64_t> positions(order.size());
+
+		for (size_t i = 0; i < order.size(); i++)
+			positions[i] = spikePositions[order[i]];
+
+		spikePositions.swap(positions);
+		spikeRecords.swap(order);
+	}
+
+	indexed = true;
+
+	return true;
+}
+
+int64 SpikeReader::countSpikes(int64 start, int64 stop) const
+{
+	auto first = std::lower_bound(spikePositions.begin(), spikePositions.end(), start);
+	auto last = std::upper_bound(first, spikePositions.end(), stop);
+
+	return (int64) (last - first);
+}
+
+int64 SpikeReader::readSpikes(int64 start, int64 stop, int64 maxSpikes, int64* positions, uint16* sortedIds, float* waveforms) const
+{
+	if (!indexed)
+		return 0;
+
+	const int64 first = std::lower_bound(spikePositions.begin(), spikePositions.end(), start) - spikePositions.begin();
+	const int64 count = jmin(maxSpikes, countSpikes(start, stop));
+
+	const uint8* data = static_cast<const uint8*>(map->getData());
+	const int64 waveformSize = int64(numChannels) * numSamples;
+	const float scale = (float) bitVolts;
+
+	for (int64 i = 0; i < count; i++)
+	{
+		const uint8* record = data + startPos + spikeRecords[first + i] * recordSize;
+
+		if (positions != nullptr)
+			positions[i] = spikePositions[first + i];
+
+		if (sortedIds != nullptr)
+			memcpy(sortedIds + i, record + 23, sizeof(uint16));
+
+		if (waveforms != nullptr)
+		{
+			const uint8* samples = record + 42;
+			float* dest = waveforms + i * waveformSize;
+
+			for (int64 j = 0; j < waveformSize; j++)
+			{
+				uint16 value;
+				memcpy(&value, samples + 2 * j, sizeof(value));
+				dest[j] = (int(value) - 32768) * scale;
+			}
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,100 @@
+/*
+------------------------------------------------------------------
+
+This file is part of the Open Ephys GUI
+Copyright (C) 2021 Open Ephys
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKEREADER_H_INCLUDED
+#define SPIKEREADER_H_INCLUDED
+
+#include <FileSourceHeaders.h>
+
+/**
+
+Reads the spikes of one electrode from a .spikes file, by time.
+
+Each spike record holds a 42-byte header (event type, int64 sample number,
+int64 unused, uint16 processor id, uint16 channel count, uint16 samples per
+channel, uint16 sorted id, ...), the waveform of every channel (uint16,
+offset by 32768), one float gain and one int16 threshold per channel, and
+the uint16 recording number. Every record of a file has the same size.
+
+The file is memory-mapped, and the first query builds an index of the spikes
+sorted by their position in the concatenated recordings.
+
+*/
+class SpikeReader
+{
+public:
+
+    /** Constructor; 'startPos' is where the first spike of the first recording starts */
+    SpikeReader(const String& name, const File& file, int64 startPos, int numChannels, int numSamples, double bitVolts);
+
+    /** Size in bytes of a spike record with this many channels and samples per channel */
+    static int64 getRecordSize(int numChannels, int numSamples);
+
+    /** Maps the file and indexes its spikes, if that hasn't been done yet. 'recordingOffsets' are subtracted
+        from the sample numbers of each recording number, as for events. Returns false if the file can't be read. */
+    bool buildIndex(const std::vector<int64_t>& recordingOffsets);
+
+    /** Number of spikes with start <= position <= stop */
+    int64 countSpikes(int64 start, int64 stop) const;
+
+    /** Copies up to 'maxSpikes' of the spikes with start <= position <= stop, in time order, into caller-owned
+        buffers: their positions, sorted ids, and waveforms (numChannels x numSamples floats per spike, channel
+        by channel, scaled by bitVolts). Any of the buffers can be nullptr. Returns the number of spikes copied. */
+    int64 readSpikes(int64 start, int64 stop, int64 maxSpikes, int64* positions, uint16* sortedIds, float* waveforms) const;
+
+    /** Name of the electrode */
+    const String& getName() const { return name; }
+
+    /** Channels per spike */
+    int getNumChannels() const { return numChannels; }
+
+    /** Samples per channel of each spike */
+    int getNumSamples() const { return numSamples; }
+
+    /** Total number of spikes (once indexed) */
+    int64 getNumSpikes() const { return (int64) spikePositions.size(); }
+
+private:
+
+    /** Reads the channel and sample counts from the file's text header, where they're present */
+    void readHeader();
+
+    String name;
+    File file;
+    int64 startPos;
+    int numChannels;
+    int numSamples;
+    double bitVolts;
+    int64 recordSize;
+
+    std::unique_ptr<MemoryMappedFile> map;
+
+    /** Positions of all spikes in time order, and the record each one is stored in */
+    std::vector<int64_t> spikePositions;
+    std::vector<int64_t> spikeRecords;
+
+    bool indexed;
+
+};
+
+#endif
@@ -0,0 +1,693 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "StreamWriter.h"
+#include "RecordIndex.h"
+#include "SampleKernels.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	/** Ends every record */
+	const uint8_t recordMarker[RECORD_MARKER_SIZE] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 255 };
+}
+
+StreamWriter::StreamWriter(int numChannels_) :
+	numChannels(numChannels_),
+	recordingNumber(0),
+	channels((size_t) numChannels_),
+	samples(BLOCK_LENGTH),
+	indexFile(nullptr),
+	indexNextOffset(0),
+	timestampFile(nullptr),
+	packedFile(nullptr),
+	packedSummaryFile(nullptr),
+	packedNextOffset(0),
+	frameCapacity(0),
+	firstFrame(0),
+	numFrames(0),
+	gatePreSamples(-1),
+	gatePostSamples(0),
+	windowStart(-1),
+	windowEnd(-1),
+	lastCommitted(-1)
+{
+	for (auto& state : channels)
+	{
+		state.file = nullptr;
+		state.summaryFile = nullptr;
+		state.bitVolts = 1.0f;
+		state.fill = 0;
+		state.nextSampleNumber = 0;
+		SampleKernels::resetSummary(state.summary, 0, 0);
+	}
+}
+
+StreamWriter::~StreamWriter()
+{
+	close();
+}
+
+void StreamWriter::setBitVolts(int channel, float bitVolts)
+{
+	channels[channel].bitVolts = bitVolts;
+}
+
+void StreamWriter::setRecordingNumber(uint16_t number)
+{
+	recordingNumber = number;
+}
+
+void StreamWriter::setChannelFile(int channel, FILE* file, FILE* summaryFile)
+{
+	channels[channel].file = file;
+	channels[channel].summaryFile = summaryFile;
+}
+
+void StreamWriter::setIndexFile(FILE* file, int64_t firstOffset)
+{
+	indexFile = file;
+	indexNextOffset = firstOffset;
+}
+
+void StreamWriter::setPackedFiles(FILE* file, FILE* indexFile_, FILE* summaryFile, int64_t firstOffset)
+{
+	packedFile = file;
+	packedSummaryFile = summaryFile;
+	packedNextOffset = firstOffset;
+	indexFile = indexFile_;
+
+	growFrames();
+}
+
+void StreamWriter::setTimestampFile(FILE* file)
+{
+	timestampFile = file;
+}
+
+void StreamWriter::setNpyTargets(std::unique_ptr<NpyTarget> timestamps, std::unique_ptr<NpyTarget> samples_)
+{
+	npyTimestamps = std::move(timestamps);
+	npySamples = std::move(samples_);
+
+	if (npySamples != nullptr)
+	{
+		npyBuffer.resize(size_t(2 * BLOCK_LENGTH) * numChannels);
+		npyFill.assign((size_t) numChannels, 0);
+	}
+}
+
+void StreamWriter::setGate(int64_t preSamples, int64_t postSamples)
+{
+	gatePreSamples = std::max<int64_t>(preSamples, 0);
+	gatePostSamples = std::max<int64_t>(postSamples, 0);
+}
+
+void StreamWriter::write(int channel, const float* data, const double* timestamps, int64_t firstSampleNumber, int numSamples)
+{
+	if (gatePreSamples >= 0)
+	{
+		writeRing(channel, data, timestamps, firstSampleNumber, numSamples);
+
+		// once every channel has this buffer, write whatever falls inside the current window
+		if (channel == numChannels - 1 && windowEnd >= 0)
+			commitRingRecords(windowStart, windowEnd);
+
+		return;
+	}
+
+	if (channel == 0 && npyTimestamps != nullptr)
+		npyTimestamps->write(timestamps, numSamples * sizeof(double), numSamples);
+
+	if (npySamples != nullptr)
+		writeNpySamples(channel, data, numSamples);
+
+	int samplesWritten = 0;
+
+	while (samplesWritten < numSamples)
+	{
+		int numSamplesToWrite = std::min(numSamples - samplesWritten, BLOCK_LENGTH - channels[channel].fill);
+
+		writeRecordPart(channel,
+			data + samplesWritten,
+			timestamps + samplesWritten,
+			firstSampleNumber + samplesWritten,
+			numSamplesToWrite);
+
+		samplesWritten += numSamplesToWrite;
+	}
+
+	channels[channel].nextSampleNumber = firstSampleNumber + numSamples;
+}
+
+void StreamWriter::writeRecordPart(int channel, const float* data, const double* timestamps, int64_t sampleNumber, int numSamples)
+{
+	ChannelState& state = channels[channel];
+	const bool newRecord = (state.fill == 0);
+
+	if (newRecord)
+	{
+		SampleKernels::resetSummary(state.summary, sampleNumber, recordingNumber);
+
+		if (channel == 0 && timestampFile != nullptr)
+			fwrite(timestamps, sizeof(double), 1, timestampFile);
+	}
+
+	if (packedFile != nullptr)
+	{
+		// packed records are assembled in place, in the frame of their first sample number
+		int slot = getFrame(state.summary.sampleNumber);
+		uint8_t* record = getFrameRecord(slot, channel);
+
+		if (newRecord)
+			setRecordHeader(record, sampleNumber);
+
+		SampleKernels::convertToInt16BE(data,
+			reinterpret_cast<int16_t*>(record + RECORD_HEADER_SIZE) + state.fill,
+			numSamples,
+			state.bitVolts,
+			state.summary);
+
+		state.fill += numSamples;
+
+		if (state.fill == BLOCK_LENGTH)
+		{
+			state.fill = 0;
+			frameSummaries[size_t(slot) * numChannels + channel] = state.summary;
+			completeFrameRecord(slot);
+		}
+
+		return;
+	}
+
+	state.fill += numSamples;
+
+	if (state.file == nullptr)
+	{
+		state.fill %= BLOCK_LENGTH;
+		return;
+	}
+
+	if (newRecord)
+	{
+		uint8_t header[RECORD_HEADER_SIZE];
+		setRecordHeader(header, sampleNumber);
+
+		if (channel == 0)
+			writeIndexEntry(sampleNumber);
+
+		fwrite(header, 1, RECORD_HEADER_SIZE, state.file);
+	}
+
+	// scale the data back into the range of int16, collecting the record statistics on the way
+	SampleKernels::convertToInt16BE(data, samples.data(), numSamples, state.bitVolts, state.summary);
+
+	fwrite(samples.data(), 2, numSamples, state.file);
+
+	if (state.fill == BLOCK_LENGTH)
+	{
+		state.fill = 0;
+
+		fwrite(recordMarker, 1, RECORD_MARKER_SIZE, state.file);
+
+		if (state.summaryFile != nullptr)
+			fwrite(&state.summary, sizeof(RecordSummary), 1, state.summaryFile);
+	}
+}
+
+int StreamWriter::getFrame(int64_t sampleNumber)
+{
+	// the frame being filled is almost always one of the newest
+	for (int i = numFrames - 1; i >= 0; i--)
+	{
+		int slot = (firstFrame + i) % frameCapacity;
+
+		if (frameSampleNumbers[slot] == sampleNumber)
+			return slot;
+	}
+
+	if (numFrames == frameCapacity)
+		growFrames();
+
+	int slot = (firstFrame + numFrames) % frameCapacity;
+
+	frameSampleNumbers[slot] = sampleNumber;
+	frameRecords[slot] = 0;
+	numFrames++;
+
+	return slot;
+}
+
+void StreamWriter::completeFrameRecord(int slot)
+{
+	if (++frameRecords[slot] < numChannels)
+		return;
+
+	// Frames complete in record order, so an older frame that is still pending is missing the record
+	// of a channel that skipped its sample number, and is dropped rather than written incomplete
+	while (numFrames > 0)
+	{
+		int oldest = firstFrame;
+
+		firstFrame = (firstFrame + 1) % frameCapacity;
+		numFrames--;
+
+		if (oldest == slot)
+		{
+			writeFrame(slot);
+			break;
+		}
+	}
+}
+
+void StreamWriter::writeFrame(int slot)
+{
+	RecordIndexEntry entry;
+	entry.offset = packedNextOffset;
+	entry.sampleNumber = frameSampleNumbers[slot];
+	entry.recordingNumber = recordingNumber;
+	entry.numSamples = BLOCK_LENGTH;
+	entry.flags = 0;
+
+	// every channel has filled its record, so the whole frame goes out in one write
+	fwrite(getFrameRecord(slot, 0), RECORD_SIZE, numChannels, packedFile);
+
+	if (indexFile != nullptr)
+		fwrite(&entry, sizeof(RecordIndexEntry), 1, indexFile);
+
+	if (packedSummaryFile != nullptr)
+		fwrite(&frameSummaries[size_t(slot) * numChannels], sizeof(RecordSummary), numChannels, packedSummaryFile);
+
+	packedNextOffset += int64_t(RECORD_SIZE) * numChannels;
+}
+
+void StreamWriter::growFrames()
+{
+	int newCapacity = std::max(2, frameCapacity * 2);
+	size_t frameBytes = size_t(numChannels) * RECORD_SIZE;
+
+	std::vector<uint8_t> newFrames(newCapacity * frameBytes);
+	std::vector<RecordSummary> newSummaries(size_t(newCapacity) * numChannels);
+	std::vector<int64_t> newSampleNumbers((size_t) newCapacity);
+	std::vector<int> newRecords((size_t) newCapacity);
+
+	for (size_t r = 0; r < size_t(newCapacity) * numChannels; r++)
+		memcpy(&newFrames[r * RECORD_SIZE + RECORD_SIZE - RECORD_MARKER_SIZE], recordMarker, RECORD_MARKER_SIZE);
+
+	// pending frames move to the start of the new ring, in order
+	for (int i = 0; i < numFrames; i++)
+	{
+		int slot = (firstFrame + i) % frameCapacity;
+
+		memcpy(&newFrames[i * frameBytes], &frames[slot * frameBytes], frameBytes);
+		std::copy_n(&frameSummaries[size_t(slot) * numChannels], numChannels, &newSummaries[size_t(i) * numChannels]);
+		newSampleNumbers[i] = frameSampleNumbers[slot];
+		newRecords[i] = frameRecords[slot];
+	}
+
+	frames.swap(newFrames);
+	frameSummaries.swap(newSummaries);
+	frameSampleNumbers.swap(newSampleNumbers);
+	frameRecords.swap(newRecords);
+
+	frameCapacity = newCapacity;
+	firstFrame = 0;
+}
+
+uint8_t* StreamWriter::getFrameRecord(int slot, int channel)
+{
+	return &frames[(size_t(slot) * numChannels + channel) * RECORD_SIZE];
+}
+
+void StreamWriter::writeIndexEntry(int64_t sampleNumber)
+{
+	if (indexFile == nullptr)
+		return;
+
+	RecordIndexEntry entry;
+	entry.offset = indexNextOffset;
+	entry.sampleNumber = sampleNumber;
+	entry.recordingNumber = recordingNumber;
+	entry.numSamples = BLOCK_LENGTH;
+	entry.flags = 0;
+
+	fwrite(&entry, sizeof(RecordIndexEntry), 1, indexFile);
+
+	indexNextOffset += RECORD_SIZE;
+}
+
+void StreamWriter::writeRing(int channel, const float* data, const double* timestamps, int64_t firstSampleNumber, int numSamples)
+{
+	if (rings.empty())
+	{
+		rings.resize((size_t) numChannels);
+
+		for (auto& ring : rings)
+		{
+			ring.capacity = 0;
+			ring.head = 0;
+			ring.numComplete = 0;
+			ring.fill = 0;
+		}
+	}
+
+	RecordRing& ring = rings[channel];
+
+	// Records are only committed once every channel has the buffer (or when an event arrives after it),
+	// so the ring has to hold the whole buffer as well as the pre-window before it. The extra slots hold
+	// the record that is still being filled, and the partial records at either end of the buffer.
+	const int capacity = int((gatePreSamples + BLOCK_LENGTH - 1) / BLOCK_LENGTH)
+		+ (numSamples + BLOCK_LENGTH - 1) / BLOCK_LENGTH + 3;
+
+	if (ring.capacity < capacity)
+		growRing(ring, capacity, channel == 0);
+
+	const float bitVolts = channels[channel].bitVolts;
+
+	int samplesWritten = 0;
+
+	while (samplesWritten < numSamples)
+	{
+		uint8_t* record = &ring.records[size_t(ring.head) * RECORD_SIZE];
+		RecordSummary& summary = ring.summaries[ring.head];
+
+		if (ring.fill == 0)
+		{
+			int64_t sampleNumber = firstSampleNumber + samplesWritten;
+
+			setRecordHeader(record, sampleNumber);
+			SampleKernels::resetSummary(summary, sampleNumber, recordingNumber);
+		}
+
+		int numSamplesToWrite = std::min(numSamples - samplesWritten, BLOCK_LENGTH - ring.fill);
+
+		if (channel == 0)
+			std::copy_n(timestamps + samplesWritten, numSamplesToWrite, &ring.timestamps[size_t(ring.head) * BLOCK_LENGTH + ring.fill]);
+
+		SampleKernels::convertToInt16BE(data + samplesWritten,
+			reinterpret_cast<int16_t*>(record + RECORD_HEADER_SIZE) + ring.fill,
+			numSamplesToWrite,
+			bitVolts,
+			summary);
+
+		ring.fill += numSamplesToWrite;
+		samplesWritten += numSamplesToWrite;
+
+		if (ring.fill == BLOCK_LENGTH)
+		{
+			// the oldest record is overwritten once the ring is full
+			ring.head = (ring.head + 1) % ring.capacity;
+			ring.numComplete = std::min(ring.numComplete + 1, ring.capacity - 1);
+			ring.fill = 0;
+		}
+	}
+
+	channels[channel].nextSampleNumber = firstSampleNumber + numSamples;
+}
+
+void StreamWriter::growRing(RecordRing& ring, int capacity, bool withTimestamps)
+{
+	std::vector<uint8_t> records(size_t(capacity) * RECORD_SIZE);
+	std::vector<RecordSummary> summaries((size_t) capacity);
+	std::vector<double> timestamps(withTimestamps ? size_t(capacity) * BLOCK_LENGTH : 0);
+
+	for (int r = 0; r < capacity; r++)
+		memcpy(&records[size_t(r) * RECORD_SIZE + RECORD_SIZE - RECORD_MARKER_SIZE], recordMarker, RECORD_MARKER_SIZE);
+
+	// the complete records, followed by the one being filled, move to the start of the new ring in order
+	if (ring.capacity > 0)
+	{
+		const int oldest = (ring.head - ring.numComplete + ring.capacity) % ring.capacity;
+
+		for (int i = 0; i <= ring.numComplete; i++)
+		{
+			const int slot = (oldest + i) % ring.capacity;
+
+			memcpy(&records[size_t(i) * RECORD_SIZE], &ring.records[size_t(slot) * RECORD_SIZE], RECORD_SIZE);
+			summaries[i] = ring.summaries[slot];
+
+			if (withTimestamps)
+				std::copy_n(&ring.timestamps[size_t(slot) * BLOCK_LENGTH], BLOCK_LENGTH, &timestamps[size_t(i) * BLOCK_LENGTH]);
+		}
+	}
+
+	ring.records.swap(records);
+	ring.summaries.swap(summaries);
+	ring.timestamps.swap(timestamps);
+
+	ring.head = ring.numComplete;
+	ring.capacity = capacity;
+}
+
+void StreamWriter::commitRingRecords(int64_t fromSample, int64_t toSample)
+{
+	if ((int) rings.size() != numChannels)
+		return;
+
+	// Channels can be one record apart if this is called between channels,
+	// so their rings are lined up on the newest record they all have
+	int64_t commonNewest = INT64_MAX;
+	std::vector<int64_t> newest((size_t) numChannels);
+
+	for (int c = 0; c < numChannels; c++)
+	{
+		const RecordRing& ring = rings[c];
+
+		if (ring.numComplete == 0)
+			return;
+
+		memcpy(&newest[c], &ring.records[size_t((ring.head - 1 + ring.capacity) % ring.capacity) * RECORD_SIZE], 8);
+		commonNewest = std::min(commonNewest, newest[c]);
+	}
+
+	std::vector<int> newestSlot((size_t) numChannels);
+	int numRecords = INT_MAX;
+
+	for (int c = 0; c < numChannels; c++)
+	{
+		const RecordRing& ring = rings[c];
+		int shift = int((newest[c] - commonNewest) / BLOCK_LENGTH);
+
+		newestSlot[c] = (ring.head - 1 - shift + 2 * ring.capacity) % ring.capacity;
+		numRecords = std::min(numRecords, ring.numComplete - shift);
+	}
+
+	std::vector<const int16_t*> npySources((size_t) numChannels);
+
+	for (int r = numRecords - 1; r >= 0; r--)
+	{
+		const RecordRing& first = rings[0];
+		int firstSlot = (newestSlot[0] - r + first.capacity) % first.capacity;
+
+		int64_t sampleNumber;
+		memcpy(&sampleNumber, &first.records[size_t(firstSlot) * RECORD_SIZE], 8);
+
+		if (sampleNumber <= lastCommitted || sampleNumber + BLOCK_LENGTH <= fromSample || sampleNumber > toSample)
+			continue;
+
+		lastCommitted = sampleNumber;
+
+		const double* recordTimestamps = &first.timestamps[size_t(firstSlot) * BLOCK_LENGTH];
+
+		if (timestampFile != nullptr)
+			fwrite(recordTimestamps, sizeof(double), 1, timestampFile);
+
+		if (npyTimestamps != nullptr)
+			npyTimestamps->write(recordTimestamps, BLOCK_LENGTH * sizeof(double), BLOCK_LENGTH);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const RecordRing& ring = rings[c];
+			int slot = (newestSlot[c] - r + ring.capacity) % ring.capacity;
+			const uint8_t* record = &ring.records[size_t(slot) * RECORD_SIZE];
+			const RecordSummary& summary = ring.summaries[slot];
+
+			npySources[c] = reinterpret_cast<const int16_t*>(record + RECORD_HEADER_SIZE);
+
+			if (packedFile != nullptr)
+			{
+				int frame = getFrame(sampleNumber);
+
+				memcpy(getFrameRecord(frame, c), record, RECORD_SIZE);
+				frameSummaries[size_t(frame) * numChannels + c] = summary;
+				completeFrameRecord(frame);
+				continue;
+			}
+
+			if (c == 0)
+				writeIndexEntry(sampleNumber);
+
+			if (channels[c].file != nullptr)
+				fwrite(record, 1, RECORD_SIZE, channels[c].file);
+
+			if (channels[c].summaryFile != nullptr)
+				fwrite(&summary, sizeof(RecordSummary), 1, channels[c].summaryFile);
+		}
+
+		// the NPY matrix gets the written records back to back, in native byte order
+		if (npySamples != nullptr)
+		{
+			SampleKernels::interleave(npySources.data(), numChannels, BLOCK_LENGTH, npyBuffer.data());
+			SampleKernels::swapBytes(npyBuffer.data(), size_t(BLOCK_LENGTH) * numChannels);
+
+			npySamples->write(npyBuffer.data(), size_t(BLOCK_LENGTH) * numChannels * sizeof(int16_t), BLOCK_LENGTH);
+		}
+	}
+}
+
+void StreamWriter::openGate(int64_t sampleNumber)
+{
+	if (gatePreSamples < 0)
+		return;
+
+	int64_t start = sampleNumber - gatePreSamples;
+	int64_t end = sampleNumber + gatePostSamples;
+
+	// overlapping windows are merged, so records between two close events aren't skipped
+	if (start > windowEnd)
+		windowStart = start;
+
+	windowEnd = std::max(windowEnd, end);
+
+	commitRingRecords(windowStart, windowEnd);
+}
+
+void StreamWriter::writeNpySamples(int channel, const float* data, int numSamples)
+{
+	int fill = npyFill[channel];
+
+	if (size_t(fill + numSamples) * numChannels > npyBuffer.size())
+		npyBuffer.resize(size_t(fill + numSamples) * numChannels);
+
+	const float bitVolts = channels[channel].bitVolts;
+
+	// Same scaling and clipping as the records, but native (little-endian) byte order
+	int16_t* dest = &npyBuffer[size_t(fill) * numChannels + channel];
+
+	for (int n = 0; n < numSamples; n++)
+	{
+		float value = data[n] / bitVolts;
+
+		if (!(value > -32767.0f))
+			value = -32767.0f;
+		else if (value > 32767.0f)
+			value = 32767.0f;
+
+		*dest = (int16_t) lrintf(value);
+		dest += numChannels;
+	}
+
+	npyFill[channel] = fill + numSamples;
+
+	// Once the last channel has arrived, the rows are complete
+	if (channel == numChannels - 1)
+		flushNpySamples();
+}
+
+void StreamWriter::flushNpySamples()
+{
+	int rows = *std::min_element(npyFill.begin(), npyFill.end());
+
+	if (rows == 0)
+		return;
+
+	npySamples->write(npyBuffer.data(), size_t(rows) * numChannels * sizeof(int16_t), rows);
+
+	// Keep any samples from channels that are ahead of the others
+	int remaining = 0;
+
+	for (auto& fill : npyFill)
+	{
+		fill -= rows;
+		remaining = std::max(remaining, fill);
+	}
+
+	if (remaining > 0)
+		memmove(npyBuffer.data(), &npyBuffer[size_t(rows) * numChannels], size_t(remaining) * numChannels * sizeof(int16_t));
+}
+
+void StreamWriter::setRecordHeader(uint8_t* record, int64_t sampleNumber)
+{
+	uint16_t numSamples = BLOCK_LENGTH;
+
+	memcpy(record, &sampleNumber, 8);
+	memcpy(record + 8, &numSamples, 2);
+	memcpy(record + 10, &recordingNumber, 2);
+}
+
+void StreamWriter::finish()
+{
+	// gated recordings end with the last window that was written
+	if (gatePreSamples < 0)
+	{
+		const std::vector<float> zeros(BLOCK_LENGTH, 0.0f);
+		const std::vector<double> zeroTimestamps(BLOCK_LENGTH, 0.0);
+
+		// fill out the rest of the current record of every channel
+		for (int c = 0; c < numChannels; c++)
+		{
+			writeRecordPart(c,
+				zeros.data(),
+				zeroTimestamps.data(),
+				channels[c].nextSampleNumber,
+				BLOCK_LENGTH - channels[c].fill);
+		}
+	}
+
+	if (npySamples != nullptr)
+		flushNpySamples();
+}
+
+void StreamWriter::close()
+{
+	for (auto& state : channels)
+	{
+		if (state.file != nullptr)
+			fclose(state.file);
+
+		if (state.summaryFile != nullptr)
+			fclose(state.summaryFile);
+
+		state.file = nullptr;
+		state.summaryFile = nullptr;
+	}
+
+	FILE** files[] = { &indexFile, &timestampFile, &packedFile, &packedSummaryFile };
+
+	for (auto file : files)
+	{
+		if (*file != nullptr)
+			fclose(*file);
+
+		*file = nullptr;
+	}
+
+	// NPY targets finish their files when destroyed
+	npyTimestamps.reset();
+	npySamples.reset();
+}
@@ -0,0 +1,230 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef STREAMWRITER_H_DEFINED
+#define STREAMWRITER_H_DEFINED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <vector>
+
+#include "Definitions.h"
+#include "RecordSummary.h"
+
+/**
+	Turns the continuous data of one stream into Open Ephys records.
+
+	Channels are delivered one buffer at a time, each channel's whole buffer before
+	the next channel's, as the Record Engine receives them. Records go either to one
+	file per channel, with a record index of the first channel, or to a single packed
+	file with frames of one record per channel and an index of the frames. The
+	timestamp of every record, the record summaries and NPY copies of the samples
+	and per-sample timestamps are optional.
+
+	Packed frames are assembled in a small ring keyed by record sample number, so a
+	channel can start the next record (or several, for long buffers) before the other
+	channels have finished the current one. A frame is only reused once it has been
+	written.
+
+	In gated mode, complete records are kept in a ring per channel and only written
+	if they overlap the window around an event (see openGate). The NPY files then
+	hold the written records back to back, and the NPY timestamps show the gaps.
+
+	The writer owns the files it is given, and closes them in close(). It does no
+	locking of its own.
+*/
+class StreamWriter
+{
+public:
+
+	/** Receives the rows of an NPY file; the plugin writes them through the GUI's NpyFile */
+	class NpyTarget
+	{
+	public:
+		virtual ~NpyTarget() {}
+
+		/** Appends numRows rows, numBytes in total */
+		virtual void write(const void* data, size_t numBytes, int numRows) = 0;
+	};
+
+	/** Creates a writer for a stream of numChannels channels, with no files */
+	explicit StreamWriter(int numChannels);
+
+	/** Closes all files */
+	~StreamWriter();
+
+	/** Sets the scaling of a channel's samples (value / bitVolts gives the int16 value) */
+	void setBitVolts(int channel, float bitVolts);
+
+	/** Sets the recording number written into record headers, index entries and summaries */
+	void setRecordingNumber(uint16_t number);
+
+	/** Writes a channel's records to its own file, and their summaries to summaryFile (may be null) */
+	void setChannelFile(int channel, FILE* file, FILE* summaryFile);
+
+	/** Writes an index entry for every record of the first channel, the first at firstOffset */
+	void setIndexFile(FILE* file, int64_t firstOffset);
+
+	/** Writes frames of one record per channel to a single file instead, with an index entry for every
+		frame and all summaries of a frame together (summaryFile may be null) */
+	void setPackedFiles(FILE* file, FILE* indexFile, FILE* summaryFile, int64_t firstOffset);
+
+	/** Writes the first timestamp of every record to a file */
+	void setTimestampFile(FILE* file);
+
+	/** Writes the timestamp of every sample and/or the interleaved int16 sample matrix (either may be null) */
+	void setNpyTargets(std::unique_ptr<NpyTarget> timestamps, std::unique_ptr<NpyTarget> samples);
+
+	/** Only writes records that overlap [event - preSamples, event + postSamples] around the events passed
+		to openGate, keeping complete records until then */
+	void setGate(int64_t preSamples, int64_t postSamples);
+
+	/** Writes a buffer of one channel, whose first sample has the given sample number */
+	void write(int channel, const float* data, const double* timestamps, int64_t firstSampleNumber, int numSamples);
+
+	/** Opens (or extends) the gate window around an event, and writes the records in it that have
+		already been received */
+	void openGate(int64_t sampleNumber);
+
+	/** Pads the current record of every channel with zeros and writes out everything still pending */
+	void finish();
+
+	/** Closes all files */
+	void close();
+
+	/** Number of channels */
+	int getNumChannels() const { return numChannels; }
+
+private:
+
+	/** Record being filled for one channel */
+	struct ChannelState
+	{
+		FILE* file;
+		FILE* summaryFile;
+		float bitVolts;
+		int fill;
+		int64_t nextSampleNumber;
+		RecordSummary summary;
+	};
+
+	/** Ring of complete records (header, samples and marker) for one channel,
+		and the timestamp of each sample (first channel only) */
+	struct RecordRing
+	{
+		std::vector<uint8_t> records;
+		std::vector<double> timestamps;
+		std::vector<RecordSummary> summaries;
+		int capacity;
+		int head;
+		int numComplete;
+		int fill;
+	};
+
+	/** Writes up to the end of a channel's current record */
+	void writeRecordPart(int channel, const float* data, const double* timestamps, int64_t sampleNumber, int numSamples);
+
+	/** Returns the ring slot of the packed frame for a record sample number, starting a new frame if needed */
+	int getFrame(int64_t sampleNumber);
+
+	/** Counts a complete record of a frame, and writes the frame once it has all of them */
+	void completeFrameRecord(int slot);
+
+	/** Writes a frame and its index entry and summaries */
+	void writeFrame(int slot);
+
+	/** Doubles the number of frames that can be pending, keeping the pending ones in order */
+	void growFrames();
+
+	/** Returns the start of a record in a packed frame */
+	uint8_t* getFrameRecord(int slot, int channel);
+
+	/** Writes an index entry for a record of the first channel (per-channel files only) */
+	void writeIndexEntry(int64_t sampleNumber);
+
+	/** Converts data into complete records in a channel's ring, without writing anything */
+	void writeRing(int channel, const float* data, const double* timestamps, int64_t firstSampleNumber, int numSamples);
+
+	/** Grows a channel's ring to capacity records, keeping the records it holds in order */
+	void growRing(RecordRing& ring, int capacity, bool withTimestamps);
+
+	/** Writes the ring records that overlap [fromSample, toSample] and haven't been written yet */
+	void commitRingRecords(int64_t fromSample, int64_t toSample);
+
+	/** Copies one channel's buffer into the interleaved NPY matrix */
+	void writeNpySamples(int channel, const float* data, int numSamples);
+
+	/** Writes all rows of the NPY matrix that every channel has filled */
+	void flushNpySamples();
+
+	/** Fills in the header of a record (sample number, sample count and recording number) */
+	void setRecordHeader(uint8_t* record, int64_t sampleNumber);
+
+	const int numChannels;
+	uint16_t recordingNumber;
+
+	std::vector<ChannelState> channels;
+
+	/** Conversion buffer for records written to per-channel files */
+	std::vector<int16_t> samples;
+
+	FILE* indexFile;
+	int64_t indexNextOffset;
+
+	FILE* timestampFile;
+
+	/** Packed files (null unless packed) */
+	FILE* packedFile;
+	FILE* packedSummaryFile;
+	int64_t packedNextOffset;
+
+	/** Ring of frames being assembled: frameCapacity frames of one record per channel,
+		numFrames of them pending from firstFrame on, in record order */
+	std::vector<uint8_t> frames;
+	std::vector<RecordSummary> frameSummaries;
+	std::vector<int64_t> frameSampleNumbers;
+	std::vector<int> frameRecords;
+	int frameCapacity;
+	int firstFrame;
+	int numFrames;
+
+	std::unique_ptr<NpyTarget> npyTimestamps;
+	std::unique_ptr<NpyTarget> npySamples;
+
+	/** Interleaved NPY rows waiting for the remaining channels */
+	std::vector<int16_t> npyBuffer;
+	std::vector<int> npyFill;
+
+	/** Gating (gatePreSamples < 0 if not gated) */
+	int64_t gatePreSamples;
+	int64_t gatePostSamples;
+	int64_t windowStart;
+	int64_t windowEnd;
+	int64_t lastCommitted;
+
+	/** Record rings (one per channel, allocated when gated data arrives, and grown for longer buffers) */
+	std::vector<RecordRing> rings;
+};
+
+#endif
@@ -0,0 +1,496 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "StructureReader.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	/** An attribute of the element being read; name and value point into the text */
+	struct Attribute
+	{
+		const char* name;
+		size_t nameLength;
+		const char* value;
+		size_t valueLength;
+	};
+
+	/** What an open element is, as far as the tables are concerned */
+	enum ElementKind
+	{
+		EXPERIMENT_ELEMENT,
+		RECORDING_ELEMENT,
+		STREAM_ELEMENT,
+		OTHER_ELEMENT
+	};
+
+	bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	bool isNameChar(char c)
+	{
+		return isalnum((unsigned char) c) || c == '_' || c == ':' || c == '-' || c == '.';
+	}
+
+	bool equals(const char* text, size_t length, const char* literal)
+	{
+		return strlen(literal) == length && memcmp(text, literal, length) == 0;
+	}
+
+	const Attribute* findAttribute(const std::vector<Attribute>& attributes, const char* name)
+	{
+		for (const Attribute& attribute : attributes)
+			if (equals(attribute.name, attribute.nameLength, name))
+				return &attribute;
+
+		return nullptr;
+	}
+
+	void appendUtf8(std::string& out, uint32_t code)
+	{
+		if (code < 0x80)
+		{
+			out += char(code);
+		}
+		else if (code < 0x800)
+		{
+			out += char(0xc0 | (code >> 6));
+			out += char(0x80 | (code & 0x3f));
+		}
+		else if (code < 0x10000)
+		{
+			out += char(0xe0 | (code >> 12));
+			out += char(0x80 | ((code >> 6) & 0x3f));
+			out += char(0x80 | (code & 0x3f));
+		}
+		else
+		{
+			out += char(0xf0 | (code >> 18));
+			out += char(0x80 | ((code >> 12) & 0x3f));
+			out += char(0x80 | ((code >> 6) & 0x3f));
+			out += char(0x80 | (code & 0x3f));
+		}
+	}
+
+	/** Copies an attribute value, replacing its character references */
+	void decodeValue(const char* value, size_t length, std::string& out)
+	{
+		if (memchr(value, '&', length) == nullptr)
+		{
+			out.assign(value, length);
+			return;
+		}
+
+		out.clear();
+
+		for (size_t i = 0; i < length; i++)
+		{
+			const char* semicolon = value[i] == '&' ? static_cast<const char*>(memchr(value + i, ';', length - i)) : nullptr;
+
+			if (semicolon == nullptr)
+			{
+				out += value[i];
+				continue;
+			}
+
+			const char* entity = value + i + 1;
+			const size_t entityLength = size_t(semicolon - entity);
+
+			if (equals(entity, entityLength, "amp"))
+				out += '&';
+			else if (equals(entity, entityLength, "lt"))
+				out += '<';
+			else if (equals(entity, entityLength, "gt"))
+				out += '>';
+			else if (equals(entity, entityLength, "quot"))
+				out += '"';
+			else if (equals(entity, entityLength, "apos"))
+				out += '\'';
+			else if (entityLength > 1 && entity[0] == '#')
+				appendUtf8(out, (uint32_t) (entity[1] == 'x' || entity[1] == 'X' ? strtoul(entity + 2, nullptr, 16) : strtoul(entity + 1, nullptr, 10)));
+			else
+				out.append(value + i, size_t(semicolon + 1 - (value + i)));
+
+			i = size_t(semicolon - value);
+		}
+	}
+
+	/** Parses a decimal number the way it's written (positions are written as doubles), whatever the locale */
+	double parseNumber(const char* text, size_t length, double defaultValue)
+	{
+		size_t i = 0;
+
+		while (i < length && isSpace(text[i]))
+			i++;
+
+		bool negative = false;
+
+		if (i < length && (text[i] == '-' || text[i] == '+'))
+			negative = text[i++] == '-';
+
+		uint64_t mantissa = 0;
+		int significantDigits = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+		bool fraction = false;
+
+		for (; i < length; i++)
+		{
+			if (text[i] == '.' && !fraction)
+			{
+				fraction = true;
+				continue;
+			}
+
+			if (!isdigit((unsigned char) text[i]))
+				break;
+
+			anyDigits = true;
+
+			// digits beyond what a double can hold only move the decimal point
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + uint64_t(text[i] - '0');
+				significantDigits += mantissa > 0 ? 1 : 0;
+				exponent -= fraction ? 1 : 0;
+			}
+			else if (!fraction)
+			{
+				exponent++;
+			}
+		}
+
+		if (!anyDigits)
+			return defaultValue;
+
+		if (i < length && (text[i] == 'e' || text[i] == 'E'))
+			exponent += (int) strtol(std::string(text + i + 1, std::min<size_t>(length - i - 1, 8)).c_str(), nullptr, 10);
+
+		double value = (double) mantissa;
+
+		if (exponent > 0)
+			value *= std::pow(10.0, exponent);
+		else if (exponent < 0)
+			value /= std::pow(10.0, -exponent);
+
+		return negative ? -value : value;
+	}
+
+	void getString(const std::vector<Attribute>& attributes, const char* name, std::string& out)
+	{
+		const Attribute* attribute = findAttribute(attributes, name);
+
+		if (attribute != nullptr)
+			decodeValue(attribute->value, attribute->valueLength, out);
+		else
+			out.clear();
+	}
+
+	double getNumber(const std::vector<Attribute>& attributes, const char* name, double defaultValue)
+	{
+		const Attribute* attribute = findAttribute(attributes, name);
+
+		return attribute != nullptr ? parseNumber(attribute->value, attribute->valueLength, defaultValue) : defaultValue;
+	}
+
+	/** Adds whatever an element tells the tables about the stream it's in */
+	void addStreamChild(const char* name, size_t nameLength, const std::vector<Attribute>& attributes, StructureTables& tables)
+	{
+		StructureTables::Stream& stream = tables.streams.back();
+
+		if (equals(name, nameLength, "CHANNEL"))
+		{
+			tables.channels.emplace_back();
+			StructureTables::Channel& channel = tables.channels.back();
+
+			getString(attributes, "name", channel.name);
+			getString(attributes, "filename", channel.filename);
+			getString(attributes, "summary", channel.summaryFilename);
+			channel.bitVolts = getNumber(attributes, "bitVolts", 0.0);
+			channel.position = (int64_t) getNumber(attributes, "position", 0.0);
+			channel.summaryPosition = (int64_t) getNumber(attributes, "summary_position", 0.0);
+			channel.packedIndex = (int) getNumber(attributes, "packed_index", -1.0);
+
+			stream.numChannels++;
+		}
+		else if (equals(name, nameLength, "SPIKECHANNEL"))
+		{
+			tables.spikeChannels.emplace_back();
+			StructureTables::SpikeChannel& channel = tables.spikeChannels.back();
+
+			getString(attributes, "name", channel.name);
+			getString(attributes, "filename", channel.filename);
+			channel.bitVolts = getNumber(attributes, "bitVolts", 0.0);
+			channel.position = (int64_t) getNumber(attributes, "position", 0.0);
+			channel.numChannels = (int) getNumber(attributes, "num_channels", 0.0);
+			channel.numSamples = (int) getNumber(attributes, "num_samples", 0.0);
+
+			stream.numSpikeChannels++;
+		}
+		else if (equals(name, nameLength, "EVENTS"))
+		{
+			getString(attributes, "filename", stream.eventsFilename);
+		}
+		else if (equals(name, nameLength, "TIMESTAMPS"))
+		{
+			getString(attributes, "filename", stream.timestampsFilename);
+		}
+		else if (equals(name, nameLength, "PACKED"))
+		{
+			stream.numPackedChannels = (int) getNumber(attributes, "num_channels", 0.0);
+		}
+	}
+}
+
+void StructureTables::clear()
+{
+	recordings.clear();
+	streams.clear();
+	channels.clear();
+	spikeChannels.clear();
+}
+
+bool StructureReader::parse(const char* text, size_t length, StructureTables& tables, std::string& error)
+{
+	tables.clear();
+
+	// every CHANNEL element takes more than 128 bytes, so the tables are never reallocated
+	tables.channels.reserve(length / 128 + 1);
+	tables.streams.reserve(length / 1024 + 1);
+	tables.recordings.reserve(length / 4096 + 1);
+
+	std::vector<ElementKind> openElements;
+	std::vector<Attribute> attributes;
+	bool foundRoot = false;
+
+	const char* p = text;
+	const char* end = text + length;
+
+	while (p < end)
+	{
+		const char* tag = static_cast<const char*>(memchr(p, '<', size_t(end - p)));
+
+		if (tag == nullptr)
+			break;
+
+		p = tag + 1;
+
+		// declaration, comment or doctype
+		if (p < end && (*p == '?' || *p == '!'))
+		{
+			const char* terminator = end - p >= 3 && memcmp(p, "!--", 3) == 0 ? "-->" : (*p == '?' ? "?>" : ">");
+			const char* close = std::search(p, end, terminator, terminator + strlen(terminator));
+
+			if (close == end)
+			{
+				error = "unterminated comment or declaration";
+				return false;
+			}
+
+			p = close + strlen(terminator);
+			continue;
+		}
+
+		if (p < end && *p == '/')
+		{
+			const char* close = static_cast<const char*>(memchr(p, '>', size_t(end - p)));
+
+			if (close == nullptr || openElements.empty())
+			{
+				error = close == nullptr ? "unterminated closing tag" : "unexpected closing tag";
+				return false;
+			}
+
+			openElements.pop_back();
+			p = close + 1;
+			continue;
+		}
+
+		const char* name = p;
+
+		while (p < end && isNameChar(*p))
+			p++;
+
+		const size_t nameLength = size_t(p - name);
+
+		if (nameLength == 0)
+		{
+			error = "invalid element name";
+			return false;
+		}
+
+		// the attributes stay in the text, only their positions are kept
+		attributes.clear();
+		bool selfClosing = false;
+
+		while (true)
+		{
+			while (p < end && isSpace(*p))
+				p++;
+
+			if (p < end && *p == '>')
+			{
+				p++;
+				break;
+			}
+
+			if (end - p >= 2 && p[0] == '/' && p[1] == '>')
+			{
+				selfClosing = true;
+				p += 2;
+				break;
+			}
+
+			Attribute attribute;
+			attribute.name = p;
+
+			while (p < end && isNameChar(*p))
+				p++;
+
+			attribute.nameLength = size_t(p - attribute.name);
+
+			while (p < end && isSpace(*p))
+				p++;
+
+			if (attribute.nameLength == 0 || p >= end || *p != '=')
+			{
+				error = p >= end ? "unterminated element" : "invalid attribute";
+				return false;
+			}
+
+			p++;
+
+			while (p < end && isSpace(*p))
+				p++;
+
+			const char* close = p < end && (*p == '"' || *p == '\'') ? static_cast<const char*>(memchr(p + 1, *p, size_t(end - p - 1))) : nullptr;
+
+			if (close == nullptr)
+			{
+				error = "invalid attribute value";
+				return false;
+			}
+
+			attribute.value = p + 1;
+			attribute.valueLength = size_t(close - p - 1);
+			attributes.push_back(attribute);
+
+			p = close + 1;
+		}
+
+		ElementKind kind = OTHER_ELEMENT;
+
+		if (!foundRoot)
+		{
+			if (!equals(name, nameLength, "EXPERIMENT"))
+			{
+				error = "the root element is not EXPERIMENT";
+				return false;
+			}
+
+			foundRoot = true;
+			kind = EXPERIMENT_ELEMENT;
+		}
+		else if (openElements.empty())
+		{
+			error = "more than one root element";
+			return false;
+		}
+		else if (openElements.back() == EXPERIMENT_ELEMENT && equals(name, nameLength, "RECORDING"))
+		{
+			StructureTables::Recording recording;
+
+			recording.number = (int) getNumber(attributes, "number", 0.0);
+			recording.firstStream = (int) tables.streams.size();
+			recording.numStreams = 0;
+
+			tables.recordings.push_back(recording);
+			kind = RECORDING_ELEMENT;
+		}
+		else if (openElements.back() == RECORDING_ELEMENT)
+		{
+			tables.streams.emplace_back();
+			StructureTables::Stream& stream = tables.streams.back();
+
+			stream.recording = (int) tables.recordings.size() - 1;
+			stream.sourceNodeId = (int) getNumber(attributes, "source_node_id", 0.0);
+			getString(attributes, "name", stream.name);
+			getString(attributes, "source_node_name", stream.sourceNodeName);
+			stream.sampleRate = getNumber(attributes, "sample_rate", 0.0);
+			stream.firstChannel = (int) tables.channels.size();
+			stream.numChannels = 0;
+			stream.firstSpikeChannel = (int) tables.spikeChannels.size();
+			stream.numSpikeChannels = 0;
+			stream.numPackedChannels = 0;
+
+			tables.recordings.back().numStreams++;
+			kind = STREAM_ELEMENT;
+		}
+		else if (openElements.back() == STREAM_ELEMENT)
+		{
+			addStreamChild(name, nameLength, attributes, tables);
+		}
+
+		if (!selfClosing)
+			openElements.push_back(kind);
+	}
+
+	if (!foundRoot || !openElements.empty())
+	{
+		error = foundRoot ? "unterminated element" : "no root element";
+		return false;
+	}
+
+	return true;
+}
+
+bool StructureReader::read(const std::string& path, StructureTables& tables, std::string& error)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (file == nullptr)
+	{
+		error = "could not open " + path;
+		return false;
+	}
+
+	std::string text;
+	char buffer[1 << 16];
+	size_t numRead;
+
+	while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		text.append(buffer, numRead);
+
+	fclose(file);
+
+	return parse(text.data(), text.size(), tables, error);
+}
@@ -0,0 +1,112 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STRUCTUREREADER_H_DEFINED
+#define STRUCTUREREADER_H_DEFINED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+	Everything the File Source needs from a structure.openephys file, as flat tables
+	in document order. Recordings, streams and channels refer to each other by index
+	into these tables.
+*/
+struct StructureTables
+{
+	struct Recording
+	{
+		int number;
+		int firstStream;
+		int numStreams;
+	};
+
+	struct Stream
+	{
+		int recording;
+		int sourceNodeId;
+		std::string name;
+		std::string sourceNodeName;
+		double sampleRate;
+		int firstChannel;
+		int numChannels;
+		int firstSpikeChannel;
+		int numSpikeChannels;
+		int numPackedChannels;
+		std::string eventsFilename;
+		std::string timestampsFilename;
+	};
+
+	struct Channel
+	{
+		std::string name;
+		double bitVolts;
+		std::string filename;
+		int64_t position;
+		std::string summaryFilename;
+		int64_t summaryPosition;
+		int packedIndex;
+	};
+
+	struct SpikeChannel
+	{
+		std::string name;
+		double bitVolts;
+		std::string filename;
+		int64_t position;
+		int numChannels;
+		int numSamples;
+	};
+
+	std::vector<Recording> recordings;
+	std::vector<Stream> streams;
+	std::vector<Channel> channels;
+	std::vector<SpikeChannel> spikeChannels;
+
+	/** Empties all tables */
+	void clear();
+};
+
+/**
+	Reads structure.openephys in a single pass over its text, without building an
+	element tree: each element's attributes are read in place and go straight into
+	StructureTables, which are reserved up front from the size of the text.
+
+	Only what the Open Ephys format uses is understood: nested elements with
+	attributes, the XML declaration, comments and character references in attribute
+	values. Text content and unknown elements are skipped.
+*/
+namespace StructureReader
+{
+	/** Fills the tables from a document; returns false (with a message in 'error') if
+		it isn't well formed or its root isn't an EXPERIMENT element */
+	bool parse(const char* text, size_t length, StructureTables& tables, std::string& error);
+
+	/** Reads a file and parses it */
+	bool read(const std::string& path, StructureTables& tables, std::string& error);
+}
+
+#endif
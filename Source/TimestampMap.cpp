@@ -0,0 +1,82 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TimestampMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+void TimestampMap::clear(double rate)
+{
+	positions.clear();
+	times.clear();
+	sampleRate = rate > 0 ? rate : 1.0;
+}
+
+void TimestampMap::add(int64_t position, double seconds)
+{
+	if (!std::isfinite(seconds) || (!positions.empty() && double(position) <= positions.back()))
+		return;
+
+	positions.push_back(double(position));
+	times.push_back(seconds);
+}
+
+size_t TimestampMap::findPair(const std::vector<double>& keys, double key) const
+{
+	// last knot at or before the key, but never the last one, so there's always a pair
+	size_t index = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+
+	return std::min(index > 0 ? index - 1 : 0, keys.size() - 2);
+}
+
+double TimestampMap::toSeconds(double position) const
+{
+	if (positions.empty())
+		return position / sampleRate;
+
+	if (positions.size() == 1)
+		return times[0] + (position - positions[0]) / sampleRate;
+
+	const size_t i = findPair(positions, position);
+	const double slope = (times[i + 1] - times[i]) / (positions[i + 1] - positions[i]);
+
+	return times[i] + (position - positions[i]) * slope;
+}
+
+double TimestampMap::toPosition(double seconds) const
+{
+	if (positions.empty())
+		return seconds * sampleRate;
+
+	if (positions.size() == 1)
+		return positions[0] + (seconds - times[0]) * sampleRate;
+
+	const size_t i = findPair(times, seconds);
+	const double span = times[i + 1] - times[i];
+
+	if (span <= 0)
+		return positions[i];
+
+	return positions[i] + (seconds - times[i]) * (positions[i + 1] - positions[i]) / span;
+}
@@ -0,0 +1,71 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef TIMESTAMPMAP_H_DEFINED
+#define TIMESTAMPMAP_H_DEFINED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+	Piecewise-linear mapping between sample positions of a stream and synchronized
+	times in seconds.
+
+	Knots are added in order of position, one per record (the synchronized time of
+	its first sample, from the stream's .timestamps file). Positions between knots
+	are interpolated, and positions outside them are extrapolated from the nearest
+	pair of knots, or from the sample rate if there's only one. Lookups are binary
+	searches.
+*/
+class TimestampMap
+{
+public:
+
+	/** Removes all knots; 'sampleRate' is used where there aren't enough of them */
+	void clear(double sampleRate);
+
+	/** Adds a knot; positions must be increasing. Non-finite times are skipped. */
+	void add(int64_t position, double seconds);
+
+	/** Number of knots */
+	int64_t size() const { return (int64_t) positions.size(); }
+
+	/** Synchronized time of a sample position */
+	double toSeconds(double position) const;
+
+	/** Sample position at a synchronized time (times must be increasing for this to be unique) */
+	double toPosition(double seconds) const;
+
+private:
+
+	/** Index of the first knot of the pair used for a position (or time) */
+	size_t findPair(const std::vector<double>& keys, double key) const;
+
+	std::vector<double> positions;
+	std::vector<double> times;
+	double sampleRate = 1.0;
+};
+
+#endif
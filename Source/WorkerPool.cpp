@@ -0,0 +1,152 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int numThreads) :
+	job(nullptr),
+	numTasks(0),
+	nextTask(0),
+	remainingTasks(0),
+	generation(0),
+	activeWorkers(0),
+	exit(false)
+{
+	for (int i = 1; i < numThreads; i++)
+		workers.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exit = true;
+	}
+
+	started.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void WorkerPool::run(int count, const std::function<void(int)>& task)
+{
+	std::unique_lock<std::mutex> running(runMutex, std::try_to_lock);
+
+	// Small jobs, or jobs submitted while another thread has the pool, run here
+	if (workers.empty() || count <= 1 || !running.owns_lock())
+	{
+		for (int i = 0; i < count; i++)
+			task(i);
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		job = &task;
+		numTasks = count;
+		remainingTasks = count;
+		nextTask = 0;
+		generation++;
+	}
+
+	started.notify_all();
+
+	runTasks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	// workers still leaving the job must be done before the next one is set up
+	finished.wait(lock, [this] { return remainingTasks == 0 && activeWorkers == 0; });
+
+	job = nullptr;
+}
+
+void WorkerPool::runRanges(int count, int minPerRange, int align, const std::function<void(int, int)>& task)
+{
+	const int numRanges = std::max(1, std::min(getNumThreads(), count / std::max(1, minPerRange)));
+
+	// range boundaries are rounded to multiples of 'align', so SIMD groups aren't split
+	auto boundary = [=](int range)
+	{
+		if (range >= numRanges)
+			return count;
+
+		int64_t position = int64_t(count) * range / numRanges;
+		return (int) (position - position % std::max(1, align));
+	};
+
+	run(numRanges, [&](int range)
+	{
+		int begin = boundary(range);
+		int end = boundary(range + 1);
+
+		if (end > begin)
+			task(begin, end);
+	});
+}
+
+void WorkerPool::work()
+{
+	uint64_t seen = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			started.wait(lock, [&] { return exit || generation != seen; });
+
+			if (exit)
+				return;
+
+			seen = generation;
+			activeWorkers++;
+		}
+
+		runTasks();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		activeWorkers--;
+		finished.notify_all();
+	}
+}
+
+void WorkerPool::runTasks()
+{
+	while (true)
+	{
+		const int task = nextTask++;
+
+		if (task >= numTasks)
+			return;
+
+		(*job)(task);
+
+		if (--remainingTasks == 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.notify_all();
+		}
+	}
+}
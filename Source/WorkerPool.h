@@ -0,0 +1,87 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WORKERPOOL_H_DEFINED
+#define WORKERPOOL_H_DEFINED
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+	A fixed set of threads that run the tasks of one job at a time, together with
+	the thread that submitted it.
+
+	Tasks of a job must write to separate outputs; which thread runs which task
+	doesn't change the result. If the pool is already running a job for another
+	thread, the job is run on the calling thread instead.
+*/
+class WorkerPool
+{
+public:
+
+	/** Creates a pool whose jobs run on up to numThreads threads, including the caller's */
+	explicit WorkerPool(int numThreads);
+
+	/** Destructor */
+	~WorkerPool();
+
+	/** Number of threads running each job, including the caller's */
+	int getNumThreads() const { return (int) workers.size() + 1; }
+
+	/** Runs task(0) .. task(numTasks - 1) and returns when all of them have finished */
+	void run(int numTasks, const std::function<void(int)>& task);
+
+	/** Splits [0, count) into ranges of at least minPerRange items (starting at multiples of 'align')
+		and runs task(begin, end) for each of them, one range per thread at most */
+	void runRanges(int count, int minPerRange, int align, const std::function<void(int, int)>& task);
+
+private:
+
+	/** Body of each worker thread */
+	void work();
+
+	/** Runs tasks of the current job until there are none left */
+	void runTasks();
+
+	std::vector<std::thread> workers;
+
+	std::mutex runMutex;
+	std::mutex mutex;
+	std::condition_variable started;
+	std::condition_variable finished;
+
+	const std::function<void(int)>* job;
+	int numTasks;
+	std::atomic<int> nextTask;
+	std::atomic<int> remainingTasks;
+	uint64_t generation;
+	int activeWorkers;
+	bool exit;
+
+};
+
+#endif
@@ -0,0 +1,376 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-archive
+
+	Repacks the continuous data of an experiment for long-term storage: every
+	.continuous and .packed file listed in structure.openephys is compressed into
+	a ChunkArchive (<file>.oea) of independently compressed chunks of whole records,
+	checked by decompressing it again, and then removed. The File Source reads
+	archived files directly, decompressing only the chunks each read touches.
+
+	The File Source finds records through each stream's record index, so any
+	stream without a complete one gets it written before its files are archived.
+	Everything else (events, spikes, summaries, timestamps) is left as it is.
+
+	With -x, archived files are extracted back to the original data files, and the
+	archives removed.
+
+	Usage: oe-archive [-x] [-k] [-c chunk_kb] [-t threads] structure.openephys
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ChunkArchive.h"
+#include "Definitions.h"
+#include "FileUtils.h"
+#include "RecordIndex.h"
+#include "StructureReader.h"
+#include "WorkerPool.h"
+
+namespace
+{
+	/** Bytes compared or extracted at a time */
+	const int64_t copyBlockBytes = int64_t(64) << 20;
+
+	/** A data file to archive, with the size of its records (or packed frames) */
+	struct DataFile
+	{
+		std::string filename;
+		int64_t firstRecord;
+		int64_t recordBytes;
+	};
+
+	double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/** Writes the record index of a stream if it doesn't cover every record, as the File Source would */
+	bool writeIndex(const std::string& dataPath, int64_t firstPosition, int64_t recordBytes, const std::string& streamName, std::string& error)
+	{
+		const std::string indexPath = dataPath + ".index";
+		const int64_t numRecords = std::max<int64_t>(0, (FileUtils::getFileSize(dataPath) - firstPosition) / recordBytes);
+
+		RecordIndex index;
+
+		if (index.load(indexPath) && index.size() > 0 && index[0].offset <= firstPosition
+			&& index.size() >= (firstPosition - index[0].offset) / recordBytes + numRecords)
+			return true;
+
+		if (!index.build(dataPath, firstPosition, recordBytes))
+		{
+			error = "cannot read " + dataPath;
+			return false;
+		}
+
+		std::string header = "header.format = 'Open Ephys Data Format'; \n";
+		header += "header.version = " + std::string(VERSION_STRING) + "; \n";
+		header += "header.header_bytes = " + std::to_string(HEADER_SIZE) + ";\n";
+		header += "header.description = 'each record contains one int64 byte offset into the data file, one int64 sample number, "
+			"one uint16 recordingNumber, one uint16 sample count and one uint32 flags field (written by oe-archive)'; \n";
+		header += "header.stream = '" + streamName + "';\n";
+
+		if (!index.save(indexPath, header))
+		{
+			error = "cannot write " + indexPath;
+			return false;
+		}
+
+		printf("Wrote the record index of %s (%lld records)\n", FileUtils::getFileName(dataPath).c_str(), (long long) index.size());
+		return true;
+	}
+
+	/** Checks that an archive holds exactly the bytes of the original file */
+	bool verifyArchive(const std::string& dataPath, ChunkArchive& archive, WorkerPool& pool, std::string& error)
+	{
+		FILE* original = fopen(dataPath.c_str(), "rb");
+
+		if (original == nullptr)
+		{
+			error = "cannot open " + dataPath;
+			return false;
+		}
+
+		std::vector<uint8_t> expected, decoded;
+		bool ok = archive.getSize() == FileUtils::getFileSize(dataPath);
+
+		for (int64_t offset = 0; ok && offset < archive.getSize(); offset += copyBlockBytes)
+		{
+			const size_t length = (size_t) std::min(copyBlockBytes, archive.getSize() - offset);
+
+			expected.resize(length);
+			decoded.resize(length);
+
+			ok = fread(expected.data(), 1, length, original) == length
+				&& archive.read(offset, (int64_t) length, decoded.data(), &pool)
+				&& expected == decoded;
+		}
+
+		fclose(original);
+
+		if (!ok)
+			error = "the archive of " + dataPath + " doesn't match it";
+
+		return ok;
+	}
+
+	/** Writes the original data file of an archive back */
+	bool extractArchive(const std::string& dataPath, ChunkArchive& archive, WorkerPool& pool, std::string& error)
+	{
+		FILE* out = fopen(dataPath.c_str(), "wb");
+
+		if (out == nullptr)
+		{
+			error = "cannot create " + dataPath;
+			return false;
+		}
+
+		std::vector<uint8_t> buffer;
+		bool ok = true;
+
+		for (int64_t offset = 0; ok && offset < archive.getSize(); offset += copyBlockBytes)
+		{
+			const size_t length = (size_t) std::min(copyBlockBytes, archive.getSize() - offset);
+			buffer.resize(length);
+
+			ok = archive.read(offset, (int64_t) length, buffer.data(), &pool)
+				&& fwrite(buffer.data(), 1, length, out) == length;
+		}
+
+		ok = fclose(out) == 0 && ok;
+
+		if (!ok)
+		{
+			remove(dataPath.c_str());
+			error = "cannot extract " + dataPath;
+		}
+
+		return ok;
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-archive [-x] [-k] [-c chunk_kb] [-t threads] structure.openephys\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string structurePath;
+	bool extract = false;
+	bool keepOriginals = false;
+	int64_t chunkBytes = int64_t(1) << 20;
+	int numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-x")
+			extract = true;
+		else if (arg == "-k")
+			keepOriginals = true;
+		else if (arg == "-c" && i + 1 < argc)
+			chunkBytes = std::max<int64_t>(1, atoll(argv[++i])) << 10;
+		else if (arg == "-t" && i + 1 < argc)
+			numThreads = std::max(1, atoi(argv[++i]));
+		else if (arg[0] != '-' && structurePath.empty())
+			structurePath = arg;
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (structurePath.empty())
+	{
+		printUsage();
+		return 2;
+	}
+
+	StructureTables tables;
+	std::string error;
+
+	if (!StructureReader::read(structurePath, tables, error))
+	{
+		fprintf(stderr, "%s: not a valid structure file (%s)\n", structurePath.c_str(), error.c_str());
+		return 1;
+	}
+
+	const std::string directory = FileUtils::getDirectory(structurePath);
+
+	// Every data file, starting at its first record in any recording
+	std::map<std::string, DataFile> files;
+
+	// The first channel file of each stream (in its first recording), which its record index describes
+	std::map<std::string, std::pair<int, DataFile>> indexedFiles;
+
+	for (const StructureTables::Stream& stream : tables.streams)
+	{
+		const int recording = tables.recordings[(size_t) stream.recording].number;
+		const int64_t recordBytes = int64_t(RECORD_SIZE) * std::max(1, stream.numPackedChannels);
+
+		for (int j = 0; j < stream.numChannels; j++)
+		{
+			const StructureTables::Channel& channel = tables.channels[size_t(stream.firstChannel + j)];
+			DataFile& file = files.insert({ channel.filename, { channel.filename, channel.position, recordBytes } }).first->second;
+
+			file.firstRecord = std::min(file.firstRecord, channel.position);
+
+			if (j == 0)
+			{
+				auto indexed = indexedFiles.find(stream.name);
+
+				if (indexed == indexedFiles.end() || recording < indexed->second.first)
+					indexedFiles[stream.name] = { recording, { channel.filename, channel.position, recordBytes } };
+			}
+		}
+	}
+
+	if (files.empty())
+	{
+		printf("%s does not list any continuous data\n", structurePath.c_str());
+		return 0;
+	}
+
+	WorkerPool pool(numThreads);
+
+	int numFiles = 0;
+	int64_t originalBytes = 0;
+	int64_t archiveBytes = 0;
+	double verifySeconds = 0.0;
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (extract)
+	{
+		for (auto& entry : files)
+		{
+			const std::string dataPath = directory + entry.first;
+			const std::string archivePath = ChunkArchive::getArchivePath(dataPath);
+
+			if (FileUtils::exists(dataPath) || !FileUtils::exists(archivePath))
+				continue;
+
+			ChunkArchive archive;
+
+			if (!archive.open(archivePath) || !extractArchive(dataPath, archive, pool, error))
+			{
+				fprintf(stderr, "%s\n", error.empty() ? ("cannot read " + archivePath).c_str() : error.c_str());
+				return 1;
+			}
+
+			archive.close();
+
+			numFiles++;
+			originalBytes += FileUtils::getFileSize(dataPath);
+
+			if (!keepOriginals)
+				remove(archivePath.c_str());
+		}
+
+		const double seconds = secondsSince(startTime);
+
+		printf("Extracted %d files, %.2f GB in %.2f s (%.2f GB/s, %d threads)\n", numFiles, originalBytes / 1e9, seconds,
+			seconds > 0 ? originalBytes / 1e9 / seconds : 0.0, pool.getNumThreads());
+
+		return 0;
+	}
+
+	// the File Source can't rebuild an index once the data files are archived
+	for (auto& entry : indexedFiles)
+	{
+		const DataFile& file = entry.second.second;
+
+		if (FileUtils::exists(directory + file.filename)
+			&& !writeIndex(directory + file.filename, file.firstRecord, file.recordBytes, entry.first, error))
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+
+	for (auto& entry : files)
+	{
+		const DataFile& file = entry.second;
+		const std::string dataPath = directory + file.filename;
+		const std::string archivePath = ChunkArchive::getArchivePath(dataPath);
+
+		// already archived (or missing)
+		if (!FileUtils::exists(dataPath))
+			continue;
+
+		const int64_t recordsPerChunk = std::max<int64_t>(1, chunkBytes / file.recordBytes);
+
+		if (!ChunkArchive::pack(dataPath, archivePath, file.firstRecord, file.recordBytes, recordsPerChunk, pool, error))
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+
+		auto verifyStart = std::chrono::steady_clock::now();
+
+		ChunkArchive archive;
+
+		if (!archive.open(archivePath) || !verifyArchive(dataPath, archive, pool, error))
+		{
+			fprintf(stderr, "%s\n", error.empty() ? ("cannot read " + archivePath).c_str() : error.c_str());
+			remove(archivePath.c_str());
+			return 1;
+		}
+
+		verifySeconds += secondsSince(verifyStart);
+
+		numFiles++;
+		originalBytes += archive.getSize();
+		archiveBytes += FileUtils::getFileSize(archivePath);
+
+		archive.close();
+
+		if (!keepOriginals)
+			remove(dataPath.c_str());
+	}
+
+	const double seconds = secondsSince(startTime);
+
+	printf("Archived %d files, %.2f GB to %.2f GB (%.2fx) in %.2f s (%.2f GB/s, %d threads)\n", numFiles, originalBytes / 1e9,
+		archiveBytes / 1e9, archiveBytes > 0 ? double(originalBytes) / archiveBytes : 0.0, seconds,
+		seconds > 0 ? originalBytes / 1e9 / seconds : 0.0, pool.getNumThreads());
+
+	if (numFiles > 0)
+		printf("Verified by decompressing at %.2f GB/s\n", verifySeconds > 0 ? originalBytes / 1e9 / verifySeconds : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-bench-decode
+
+	Measures how the File Source's decoding of wide reads scales with the number
+	of threads. Each read interleaves one record of every channel (laid out as in
+	.continuous files) and converts the result back to scaled float channels,
+	with the channels split between the threads of a WorkerPool as the reader does.
+
+	Usage: oe-bench-decode [-c channels] [-s seconds_of_data] [max_threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Definitions.h"
+#include "SampleKernels.h"
+#include "WorkerPool.h"
+
+namespace
+{
+	/** Same split as the File Source */
+	const int minChannelsPerThread = 64;
+
+	/** Decodes every record of every channel, one read per record; returns the time taken in seconds */
+	double decode(WorkerPool& pool, const std::vector<const int16_t*>& channels, int64_t numRecords,
+		const std::vector<float>& scales, std::vector<int16_t>& interleaved, std::vector<float*>& dest)
+	{
+		const int numChannels = (int) channels.size();
+		std::vector<const int16_t*> sources(numChannels);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (int64_t record = 0; record < numRecords; record++)
+		{
+			for (int j = 0; j < numChannels; j++)
+				sources[j] = channels[j] + record * (RECORD_SIZE / 2);
+
+			pool.runRanges(numChannels, minChannelsPerThread, 8, [&](int begin, int end)
+			{
+				SampleKernels::interleave(sources.data() + begin, end - begin, BLOCK_LENGTH, interleaved.data() + begin, numChannels);
+			});
+
+			pool.runRanges(numChannels, minChannelsPerThread, 8, [&](int begin, int end)
+			{
+				SampleKernels::convertFromInt16BE(interleaved.data() + begin, end - begin, numChannels, BLOCK_LENGTH, scales.data() + begin, dest.data() + begin);
+			});
+		}
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-bench-decode [-c channels] [-s seconds_of_data] [max_threads]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int numChannels = 1024;
+	double seconds = 2.0;
+	int maxThreads = (int) std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			numChannels = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seconds = atof(argv[++i]);
+		else if (argv[i][0] != '-' && atoi(argv[i]) > 0)
+			maxThreads = atoi(argv[i]);
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	const int64_t numRecords = std::max<int64_t>(1, int64_t(seconds * 30000.0) / BLOCK_LENGTH);
+
+	// one buffer per channel, like separately mapped .continuous files
+	std::vector<std::vector<int16_t>> files(numChannels, std::vector<int16_t>(numRecords * RECORD_SIZE / 2));
+	std::vector<const int16_t*> channels;
+
+	for (int j = 0; j < numChannels; j++)
+	{
+		for (size_t i = 0; i < files[j].size(); i++)
+			files[j][i] = int16_t(i * 7 + j * 131);
+
+		channels.push_back(files[j].data() + RECORD_HEADER_SIZE / 2);
+	}
+
+	std::vector<float> scales(numChannels, 0.195f);
+	std::vector<int16_t> interleaved(size_t(BLOCK_LENGTH) * numChannels);
+	std::vector<std::vector<float>> reference, output;
+
+	printf("%d channels, %lld records (%.1f s at 30 kHz) per channel\n\n",
+		numChannels, (long long) numRecords, numRecords * BLOCK_LENGTH / 30000.0);
+	printf("%8s %12s %10s %14s\n", "threads", "MS/s", "speedup", "x real time");
+
+	double singleThreaded = 0;
+
+	for (int numThreads = 1; numThreads <= maxThreads; numThreads++)
+	{
+		WorkerPool pool(numThreads);
+
+		std::vector<std::vector<float>>& result = numThreads == 1 ? reference : output;
+		result.assign(numChannels, std::vector<float>(BLOCK_LENGTH));
+
+		std::vector<float*> dest;
+
+		for (auto& channel : result)
+			dest.push_back(channel.data());
+
+		double elapsed = decode(pool, channels, numRecords, scales, interleaved, dest);
+
+		// the split must not change a single sample
+		if (numThreads > 1 && output != reference)
+		{
+			fprintf(stderr, "%d threads: output does not match the single-threaded result\n", numThreads);
+			return 1;
+		}
+
+		if (numThreads == 1)
+			singleThreaded = elapsed;
+
+		const double totalSamples = double(numRecords) * BLOCK_LENGTH * numChannels;
+
+		printf("%8d %12.1f %9.2fx %13.1fx\n", numThreads, totalSamples / elapsed / 1e6, singleThreaded / elapsed,
+			totalSamples / numChannels / 30000.0 / elapsed);
+	}
+
+	return 0;
+}
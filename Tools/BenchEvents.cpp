@@ -0,0 +1,220 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-bench-events
+
+	Measures how long the File Source takes to load the events of one stream
+	as the number of events grows. Compares the per-event loop the reader used
+	to run (which walked and copied the recording table for every event) with
+	EventStore::decode and a precomputed table of recording offsets.
+
+	Usage: oe-bench-events [-r recordings] [-c channels_per_stream] [event_count ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EventStore.h"
+
+namespace
+{
+	/** What the reader used to keep for every stream of every recording */
+	struct ChannelInfo
+	{
+		std::string name;
+		double bitVolts;
+		std::string filename;
+		int64_t startPos;
+	};
+
+	struct StreamInfo
+	{
+		std::vector<ChannelInfo> channels;
+		int64_t startTimestamp;
+		int64_t numSamples;
+	};
+
+	struct Recording
+	{
+		std::map<std::string, StreamInfo> streams;
+	};
+
+	/** The reader's old per-event loop */
+	void loadLegacy(const uint8_t* records, size_t numEvents, std::map<int, Recording>& recordings, const std::string& streamName,
+		std::vector<int64_t>& timestamps, std::vector<int16_t>& channels, std::vector<int16_t>& states)
+	{
+		for (size_t i = 0; i < numEvents; i++)
+		{
+			const int64_t* timestamp = reinterpret_cast<const int64_t*>(records + i * 16);
+			const uint8_t* channelState = records + i * 16 + 12;
+			const uint8_t* channel = records + i * 16 + 13;
+			const uint16_t* recordingNum = reinterpret_cast<const uint16_t*>(channel + 1);
+
+			channels.push_back(*channel);
+			states.push_back(*channelState);
+
+			int64_t offset = recordings[1].streams[streamName].startTimestamp;
+
+			if (*recordingNum > 0)
+			{
+				int numRecordings = *recordingNum + 1;
+
+				while (numRecordings > 1)
+				{
+					Recording curr = recordings[numRecordings];
+					Recording prev = recordings[numRecordings - 1];
+					offset += curr.streams[streamName].startTimestamp - (prev.streams[streamName].numSamples + prev.streams[streamName].startTimestamp);
+					numRecordings--;
+				}
+			}
+
+			timestamps.push_back(*timestamp - offset);
+		}
+	}
+
+	double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-bench-events [-r recordings] [-c channels_per_stream] [event_count ...]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int numRecordings = 4;
+	int numChannels = 64;
+	std::vector<long long> eventCounts;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			numRecordings = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			numChannels = std::max(1, atoi(argv[++i]));
+		else if (argv[i][0] != '-' && atoll(argv[i]) > 0)
+			eventCounts.push_back(atoll(argv[i]));
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (eventCounts.empty())
+		eventCounts = { 1000, 10000, 100000, 1000000, 10000000 };
+
+	// two streams per recording, each with the usual per-channel metadata
+	const std::string streamName = "100_example_data";
+	const int64_t samplesPerRecording = 30000 * 600;
+
+	std::map<int, Recording> recordings;
+	std::vector<int64_t> offsets;
+	int64_t samplesBefore = 0;
+
+	for (int r = 1; r <= numRecordings; r++)
+	{
+		for (const std::string& name : { streamName, std::string("101_other_data") })
+		{
+			StreamInfo& stream = recordings[r].streams[name];
+			stream.startTimestamp = (r - 1) * samplesPerRecording * 2 + 1000;
+			stream.numSamples = samplesPerRecording;
+
+			for (int c = 0; c < numChannels; c++)
+				stream.channels.push_back({ "CH" + std::to_string(c + 1), 0.195, name + "_CH" + std::to_string(c + 1) + ".continuous", 1024 });
+		}
+
+		offsets.push_back(recordings[r].streams[streamName].startTimestamp - samplesBefore);
+		samplesBefore += samplesPerRecording;
+	}
+
+	printf("%d recordings, %d channels per stream\n\n", numRecordings, numChannels);
+	printf("%12s %14s %14s %10s\n", "events", "legacy (ms)", "columnar (ms)", "speedup");
+
+	for (long long numEvents : eventCounts)
+	{
+		// events spread evenly over the recordings, like an .events file
+		std::vector<uint8_t> records((size_t) numEvents * 16);
+
+		for (long long i = 0; i < numEvents; i++)
+		{
+			uint16_t recording = uint16_t(i * numRecordings / numEvents);
+			int64_t timestamp = recordings[recording + 1].streams[streamName].startTimestamp + (i * 97) % samplesPerRecording;
+			uint8_t* record = records.data() + i * 16;
+
+			memset(record, 0, 16);
+			memcpy(record, &timestamp, 8);
+			record[10] = 3;
+			record[12] = uint8_t(i & 1);
+			record[13] = uint8_t(i % 8);
+			memcpy(record + 14, &recording, 2);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		EventStore store;
+		store.decode(records.data(), (size_t) numEvents, offsets);
+
+		double columnar = secondsSince(start);
+
+		// the old loader is quadratic in practice, so it's only run where it finishes in reasonable time
+		if (numEvents <= 1000000)
+		{
+			std::vector<int64_t> timestamps;
+			std::vector<int16_t> channels, states;
+
+			start = std::chrono::steady_clock::now();
+			loadLegacy(records.data(), (size_t) numEvents, recordings, streamName, timestamps, channels, states);
+			double legacy = secondsSince(start);
+
+			std::sort(timestamps.begin(), timestamps.end());
+
+			EventSpan all = store.getAll();
+
+			if (all.size != timestamps.size() || memcmp(all.timestamps, timestamps.data(), all.size * sizeof(int64_t)) != 0)
+			{
+				fprintf(stderr, "%lld events: columnar timestamps do not match\n", numEvents);
+				return 1;
+			}
+
+			printf("%12lld %14.2f %14.2f %9.1fx\n", numEvents, legacy * 1e3, columnar * 1e3, legacy / columnar);
+		}
+		else
+		{
+			printf("%12lld %14s %14.2f %10s\n", numEvents, "-", columnar * 1e3, "-");
+		}
+	}
+
+	return 0;
+}
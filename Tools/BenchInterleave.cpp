@@ -0,0 +1,218 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-bench-interleave
+
+	Measures how fast the File Source can turn per-channel records into the
+	interleaved sample buffer it hands to the File Reader, for a range of
+	channel counts. Compares the per-sample gather the reader used to do with
+	SampleKernels::interleave, on records laid out as in .continuous files.
+
+	Also compares converting that buffer back to scaled float channels one
+	channel at a time (strided, as processChannelData used to) with
+	SampleKernels::convertFromInt16BE.
+
+	Usage: oe-bench-interleave [-s seconds_of_data] [channel_count ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "Definitions.h"
+#include "SampleKernels.h"
+
+namespace
+{
+	/** Reads 'blockSize' samples at a time from every channel, sample by sample */
+	void gatherPerSample(const std::vector<const int16_t*>& channels, int64_t numRecords, int blockSize, int16_t* dest)
+	{
+		const int numChannels = (int) channels.size();
+		const int64_t recordStride = RECORD_SIZE / 2;
+
+		for (int64_t record = 0; record < numRecords; record++)
+			for (int start = 0; start < BLOCK_LENGTH; start += blockSize)
+				for (int i = start; i < start + blockSize; i++)
+					for (int j = 0; j < numChannels; j++)
+						dest[(i - start) * numChannels + j] = channels[j][record * recordStride + i];
+	}
+
+	/** Reads 'blockSize' samples at a time from every channel, with the transposing kernel */
+	void gatherInterleaved(const std::vector<const int16_t*>& channels, int64_t numRecords, int blockSize, int16_t* dest)
+	{
+		const int numChannels = (int) channels.size();
+		const int64_t recordStride = RECORD_SIZE / 2;
+
+		std::vector<const int16_t*> sources(numChannels);
+
+		for (int64_t record = 0; record < numRecords; record++)
+			for (int start = 0; start < BLOCK_LENGTH; start += blockSize)
+			{
+				for (int j = 0; j < numChannels; j++)
+					sources[j] = channels[j] + record * recordStride + start;
+
+				SampleKernels::interleave(sources.data(), numChannels, blockSize, dest);
+			}
+	}
+
+	/** Converts each channel with its own strided pass over the interleaved buffer */
+	void convertPerChannel(const int16_t* source, int numChannels, int numSamples, const float* scales, float* const* dest)
+	{
+		for (int channel = 0; channel < numChannels; channel++)
+			for (int i = 0; i < numSamples; i++)
+			{
+				int16_t hibyte = (source[numChannels * i + channel] & 0x00ff) << 8;
+				int16_t lobyte = (source[numChannels * i + channel] & 0xff00) >> 8;
+				dest[channel][i] = (lobyte | hibyte) * scales[channel];
+			}
+	}
+
+	/** Times 'repeats' conversions of one read buffer, in seconds */
+	template <typename Function>
+	double timeConversion(Function convert, const std::vector<int16_t>& source, int numChannels, int numSamples,
+		const std::vector<float>& scales, std::vector<float*>& dest, int repeats)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < repeats; i++)
+			convert(source.data(), numChannels, numSamples, scales.data(), dest.data());
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-bench-interleave [-s seconds_of_data] [channel_count ...]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	double seconds = 2.0;
+	std::vector<int> channelCounts;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seconds = atof(argv[++i]);
+		else if (argv[i][0] != '-' && atoi(argv[i]) > 0)
+			channelCounts.push_back(atoi(argv[i]));
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (channelCounts.empty())
+		channelCounts = { 8, 16, 32, 64, 128, 256, 384, 768 };
+
+	// The File Reader asks for a few ms of data at a time
+	const int blockSize = 512;
+	const int64_t numRecords = std::max<int64_t>(1, int64_t(seconds * 30000.0) / BLOCK_LENGTH);
+
+	printf("%lld records (%.1f s at 30 kHz) per channel, %d samples per read\n\n",
+		(long long) numRecords, numRecords * BLOCK_LENGTH / 30000.0, blockSize);
+	printf("%9s %18s %18s %8s\n", "channels", "per-sample (MS/s)", "interleave (MS/s)", "speedup");
+
+	for (int numChannels : channelCounts)
+	{
+		// one buffer per channel, like separately mapped .continuous files
+		std::vector<std::vector<int16_t>> files(numChannels, std::vector<int16_t>(numRecords * RECORD_SIZE / 2));
+		std::vector<const int16_t*> channels;
+
+		for (int j = 0; j < numChannels; j++)
+		{
+			for (size_t i = 0; i < files[j].size(); i++)
+				files[j][i] = int16_t(i * 7 + j);
+
+			channels.push_back(files[j].data() + RECORD_HEADER_SIZE / 2);
+		}
+
+		std::vector<int16_t> reference(size_t(blockSize) * numChannels);
+		std::vector<int16_t> output(size_t(blockSize) * numChannels);
+
+		auto t0 = std::chrono::steady_clock::now();
+		gatherPerSample(channels, numRecords, blockSize, reference.data());
+		auto t1 = std::chrono::steady_clock::now();
+		gatherInterleaved(channels, numRecords, blockSize, output.data());
+		auto t2 = std::chrono::steady_clock::now();
+
+		if (reference != output)
+		{
+			fprintf(stderr, "%d channels: interleaved output does not match\n", numChannels);
+			return 1;
+		}
+
+		const double totalSamples = double(numRecords) * BLOCK_LENGTH * numChannels;
+		const double perSample = totalSamples / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+		const double interleaved = totalSamples / std::chrono::duration<double>(t2 - t1).count() / 1e6;
+
+		printf("%9d %18.1f %18.1f %7.1fx\n", numChannels, perSample, interleaved, interleaved / perSample);
+	}
+
+	printf("\n%9s %18s %18s %8s\n", "channels", "per-channel (MS/s)", "batched (MS/s)", "speedup");
+
+	for (int numChannels : channelCounts)
+	{
+		std::vector<int16_t> source(size_t(blockSize) * numChannels);
+
+		for (size_t i = 0; i < source.size(); i++)
+			source[i] = int16_t(i * 131);
+
+		std::vector<float> scales(numChannels, 0.195f);
+		std::vector<std::vector<float>> reference(numChannels, std::vector<float>(blockSize));
+		std::vector<std::vector<float>> output(numChannels, std::vector<float>(blockSize));
+		std::vector<float*> referencePointers, outputPointers;
+
+		for (int j = 0; j < numChannels; j++)
+		{
+			referencePointers.push_back(reference[j].data());
+			outputPointers.push_back(output[j].data());
+		}
+
+		const int repeats = int(std::max<int64_t>(1, numRecords * BLOCK_LENGTH / blockSize));
+
+		double perChannel = timeConversion(convertPerChannel, source, numChannels, blockSize, scales, referencePointers, repeats);
+		double batched = timeConversion([](const int16_t* in, int count, int length, const float* channelScales, float* const* out)
+			{
+				SampleKernels::convertFromInt16BE(in, count, length, channelScales, out);
+			}, source, numChannels, blockSize, scales, outputPointers, repeats);
+
+		if (reference != output)
+		{
+			fprintf(stderr, "%d channels: batched conversion does not match\n", numChannels);
+			return 1;
+		}
+
+		const double totalSamples = double(repeats) * blockSize * numChannels;
+
+		printf("%9d %18.1f %18.1f %7.1fx\n", numChannels, totalSamples / perChannel / 1e6, totalSamples / batched / 1e6, perChannel / batched);
+	}
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-bench-open
+
+	Measures how long the File Source takes to read structure.openephys as the
+	number of recordings and channels grows. Compares what open() used to do
+	(build an element tree of the whole document, walk it once for channels and
+	once for events, and copy each recording's streams into the recording table)
+	with StructureReader's single pass into flat tables.
+
+	Usage: oe-bench-open [-s streams_per_recording] [recordings x channels ...]
+	e.g. oe-bench-open 10x64 100x384 500x1024
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "StructureFile.h"
+#include "StructureReader.h"
+
+namespace
+{
+	/** What the reader keeps for every stream of every recording */
+	struct ChannelInfo
+	{
+		std::string name;
+		double bitVolts;
+		std::string filename;
+		int64_t startPos;
+		std::string summaryFilename;
+		int64_t summaryPos;
+		int packedIndex;
+	};
+
+	struct StreamInfo
+	{
+		float sampleRate;
+		std::vector<ChannelInfo> channels;
+		int64_t startPos;
+		int numPackedChannels;
+	};
+
+	struct Recording
+	{
+		int id;
+		std::map<std::string, StreamInfo> streams;
+	};
+
+	/** A document laid out as the record engine writes it */
+	std::string makeDocument(int numRecordings, int numStreams, int numChannels)
+	{
+		std::string text = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n<EXPERIMENT format_version=\"0.6\" number=\"1\">\n";
+
+		for (int r = 1; r <= numRecordings; r++)
+		{
+			text += "  <RECORDING number=\"" + std::to_string(r) + "\">\n";
+
+			for (int s = 0; s < numStreams; s++)
+			{
+				const std::string id = std::to_string(100 + s);
+				const std::string position = std::to_string(1024 + int64_t(r - 1) * 2070 * 30000);
+
+				text += "    <STREAM name=\"example_data\" source_node_id=\"" + id + "\" source_node_name=\"File Reader\" sample_rate=\"30000.0\">\n";
+
+				for (int c = 1; c <= numChannels; c++)
+				{
+					const std::string channel = "CH" + std::to_string(c);
+
+					text += "      <CHANNEL name=\"" + channel + "\" bitVolts=\"0.1949999928474426\" filename=\"" + id + "_" + channel
+						+ ".continuous\" position=\"" + position + "\" summary=\"" + id + "_" + channel + ".summary\" summary_position=\""
+						+ std::to_string(1024 + int64_t(r - 1) * 40 * 30) + "\"/>\n";
+				}
+
+				text += "      <EVENTS filename=\"" + id + "_example_data.events\"/>\n";
+				text += "      <TIMESTAMPS filename=\"" + id + "_example_data.timestamps\"/>\n";
+				text += "    </STREAM>\n";
+			}
+
+			text += "  </RECORDING>\n";
+		}
+
+		return text + "</EXPERIMENT>\n";
+	}
+
+	/** The reader's old open(): element tree, two walks, recordings copied into the table */
+	size_t openLegacy(const std::string& text, std::map<int, Recording>& recordings)
+	{
+		std::string error;
+		std::unique_ptr<XmlNode> xml = XmlNode::parse(text, error);
+
+		if (xml == nullptr || !xml->hasTagName("EXPERIMENT"))
+			return 0;
+
+		for (auto& recordTag : xml->getChildren())
+		{
+			if (!recordTag->hasTagName("RECORDING"))
+				continue;
+
+			Recording recording;
+			recording.id = (int) recordTag->getIntAttribute("number");
+
+			for (auto& streamTag : recordTag->getChildren())
+			{
+				std::string streamName = std::to_string(streamTag->getIntAttribute("source_node_id")) + "_" + streamTag->getAttribute("name");
+				float sampleRate = streamTag->getIntAttribute("sample_rate") * 1.0f;
+
+				for (auto& channel : streamTag->getChildren())
+				{
+					if (!channel->hasTagName("CHANNEL"))
+						continue;
+
+					ChannelInfo info;
+
+					info.filename = channel->getAttribute("filename");
+					info.name = channel->getAttribute("name");
+					info.bitVolts = channel->getDoubleAttribute("bitVolts");
+					info.startPos = (int64_t) channel->getDoubleAttribute("position");
+					info.summaryFilename = channel->getAttribute("summary");
+					info.summaryPos = (int64_t) channel->getDoubleAttribute("summary_position");
+					info.packedIndex = (int) channel->getIntAttribute("packed_index", -1);
+
+					if (!recording.streams.count(streamName))
+					{
+						StreamInfo streamInfo;
+
+						streamInfo.sampleRate = sampleRate;
+						streamInfo.startPos = info.startPos;
+						streamInfo.numPackedChannels = 0;
+
+						if (XmlNode* packedTag = streamTag->getChildByName("PACKED"))
+							streamInfo.numPackedChannels = (int) packedTag->getIntAttribute("num_channels");
+
+						recording.streams[streamName] = streamInfo;
+					}
+
+					recording.streams[streamName].channels.push_back(info);
+				}
+			}
+
+			recordings[recording.id] = recording;
+		}
+
+		std::map<std::string, std::string> eventFiles;
+
+		for (auto& recordTag : xml->getChildren())
+		{
+			if (!recordTag->hasTagName("RECORDING"))
+				continue;
+
+			for (auto& streamTag : recordTag->getChildren())
+			{
+				std::string streamName = std::to_string(streamTag->getIntAttribute("source_node_id")) + "_" + streamTag->getAttribute("name");
+
+				if (XmlNode* eventsTag = streamTag->getChildByName("EVENTS"))
+					if (!eventFiles.count(streamName))
+						eventFiles[streamName] = eventsTag->getAttribute("filename");
+			}
+		}
+
+		return eventFiles.size();
+	}
+
+	/** The reader's open() now: one pass into flat tables, recordings filled in place */
+	size_t openStreaming(const std::string& text, std::map<int, Recording>& recordings)
+	{
+		StructureTables tables;
+		std::string error;
+
+		if (!StructureReader::parse(text.data(), text.size(), tables, error))
+			return 0;
+
+		std::map<std::string, std::string> eventFiles;
+
+		for (const StructureTables::Recording& recordingEntry : tables.recordings)
+		{
+			Recording& recording = recordings[recordingEntry.number];
+			recording.id = recordingEntry.number;
+
+			for (int s = recordingEntry.firstStream; s < recordingEntry.firstStream + recordingEntry.numStreams; s++)
+			{
+				const StructureTables::Stream& streamEntry = tables.streams[s];
+				const std::string streamName = std::to_string(streamEntry.sourceNodeId) + "_" + streamEntry.name;
+
+				if (streamEntry.numChannels > 0)
+				{
+					StreamInfo& streamInfo = recording.streams[streamName];
+
+					streamInfo.sampleRate = (float) streamEntry.sampleRate;
+					streamInfo.startPos = tables.channels[streamEntry.firstChannel].position;
+					streamInfo.numPackedChannels = streamEntry.numPackedChannels;
+					streamInfo.channels.resize(streamEntry.numChannels);
+
+					for (int c = 0; c < streamEntry.numChannels; c++)
+					{
+						const StructureTables::Channel& channel = tables.channels[streamEntry.firstChannel + c];
+						ChannelInfo& info = streamInfo.channels[c];
+
+						info.name = channel.name;
+						info.bitVolts = channel.bitVolts;
+						info.filename = channel.filename;
+						info.startPos = channel.position;
+						info.summaryFilename = channel.summaryFilename;
+						info.summaryPos = channel.summaryPosition;
+						info.packedIndex = channel.packedIndex;
+					}
+				}
+
+				if (!streamEntry.eventsFilename.empty() && !eventFiles.count(streamName))
+					eventFiles[streamName] = streamEntry.eventsFilename;
+			}
+		}
+
+		return eventFiles.size();
+	}
+
+	/** True if both readers found the same channels in the same places */
+	bool sameTables(std::map<int, Recording>& a, std::map<int, Recording>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+
+		for (auto& recording : a)
+		{
+			for (auto& stream : recording.second.streams)
+			{
+				const std::vector<ChannelInfo>& channelsA = stream.second.channels;
+				const std::vector<ChannelInfo>& channelsB = b[recording.first].streams[stream.first].channels;
+
+				if (channelsA.size() != channelsB.size())
+					return false;
+
+				for (size_t i = 0; i < channelsA.size(); i++)
+					if (channelsA[i].filename != channelsB[i].filename || channelsA[i].startPos != channelsB[i].startPos
+						|| channelsA[i].summaryPos != channelsB[i].summaryPos || channelsA[i].bitVolts != channelsB[i].bitVolts)
+						return false;
+			}
+		}
+
+		return true;
+	}
+
+	double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-bench-open [-s streams_per_recording] [recordings x channels ...]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int numStreams = 2;
+	std::vector<std::pair<int, int>> sizes;
+
+	for (int i = 1; i < argc; i++)
+	{
+		int numRecordings, numChannels;
+
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			numStreams = std::max(1, atoi(argv[++i]));
+		else if (sscanf(argv[i], "%dx%d", &numRecordings, &numChannels) == 2 && numRecordings > 0 && numChannels > 0)
+			sizes.push_back({ numRecordings, numChannels });
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (sizes.empty())
+		sizes = { { 1, 64 }, { 10, 64 }, { 10, 384 }, { 100, 384 }, { 100, 1024 }, { 500, 1024 } };
+
+	printf("%d streams per recording\n\n", numStreams);
+	printf("%11s %9s %10s %12s %15s %8s\n", "recordings", "channels", "size (MB)", "legacy (ms)", "streaming (ms)", "speedup");
+
+	for (auto size : sizes)
+	{
+		const std::string text = makeDocument(size.first, numStreams, size.second);
+
+		std::map<int, Recording> legacyTables, streamingTables;
+
+		auto start = std::chrono::steady_clock::now();
+		size_t legacyStreams = openLegacy(text, legacyTables);
+		double legacy = secondsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		size_t streamingStreams = openStreaming(text, streamingTables);
+		double streaming = secondsSince(start);
+
+		if (legacyStreams != streamingStreams || !sameTables(legacyTables, streamingTables))
+		{
+			fprintf(stderr, "%dx%d: the tables do not match\n", size.first, size.second);
+			return 1;
+		}
+
+		printf("%11d %9d %10.1f %12.1f %15.1f %7.1fx\n", size.first, size.second, text.size() / 1048576.0,
+			legacy * 1e3, streaming * 1e3, legacy / streaming);
+	}
+
+	return 0;
+}
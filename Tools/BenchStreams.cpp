@@ -0,0 +1,243 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-bench-streams
+
+	Measures the aggregate throughput of playing several streams back together,
+	as the File Source does when other streams are read along with the active one.
+	Each stream is a file of 1024-sample frames with one record per channel (the
+	packed layout), read a frame at a time from every stream in turn and
+	interleaved as the reader does.
+
+	Every run starts from cold caches (where the OS lets the files be dropped from
+	the page cache) and is done twice: with the frames read as they are reached,
+	and with the following frames of all streams requested from an IoScheduler
+	after each read, as the reader's read-ahead does.
+
+	Usage: oe-bench-streams [-c channels_per_stream] [-s seconds_of_data] [-d directory] [max_streams]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Definitions.h"
+#include "FileUtils.h"
+#include "IoScheduler.h"
+#include "SampleKernels.h"
+
+namespace
+{
+	/** Frames requested ahead of each read, as in the File Source */
+	const int64_t readAheadFrames = 16;
+
+	/** Writes a stream file of 'numFrames' frames of 'numChannels' records; returns false if it can't */
+	bool writeStream(const std::string& path, int numChannels, int64_t numFrames)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+
+		if (file == nullptr)
+			return false;
+
+		std::vector<uint8_t> frame(size_t(numChannels) * RECORD_SIZE);
+
+		for (size_t i = 0; i < frame.size(); i++)
+			frame[i] = uint8_t(i * 31);
+
+		bool written = true;
+
+		for (int64_t i = 0; i < numFrames && written; i++)
+			written = fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+
+		return fclose(file) == 0 && written;
+	}
+
+	/** Drops a file from the page cache where the OS allows it; returns false if it can't */
+	bool evict(const std::string& path)
+	{
+#if defined(__linux__)
+		int descriptor = open(path.c_str(), O_RDONLY);
+
+		if (descriptor < 0)
+			return false;
+
+		bool evicted = fdatasync(descriptor) == 0 && posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(descriptor);
+
+		return evicted;
+#else
+		(void) path;
+		return false;
+#endif
+	}
+
+	/** Plays the first 'numStreams' streams in lockstep, one frame at a time; returns the time taken in seconds */
+	double play(const std::vector<std::string>& paths, int numStreams, int numChannels, int64_t numFrames, IoScheduler* scheduler)
+	{
+		const int64_t frameBytes = int64_t(numChannels) * RECORD_SIZE;
+
+		std::vector<FILE*> files;
+		std::vector<int> handles;
+
+		for (int i = 0; i < numStreams; i++)
+		{
+			files.push_back(fopen(paths[i].c_str(), "rb"));
+
+			if (scheduler != nullptr)
+				handles.push_back(scheduler->addFile(paths[i]));
+		}
+
+		std::vector<uint8_t> frame((size_t) frameBytes);
+		std::vector<int16_t> interleaved(size_t(BLOCK_LENGTH) * numChannels);
+		std::vector<const int16_t*> sources(numChannels);
+
+		for (int j = 0; j < numChannels; j++)
+			sources[j] = reinterpret_cast<const int16_t*>(frame.data() + size_t(j) * RECORD_SIZE + RECORD_HEADER_SIZE);
+
+		auto start = std::chrono::steady_clock::now();
+
+		if (scheduler != nullptr)
+			for (int i = 0; i < numStreams; i++)
+				scheduler->request(handles[i], 0, readAheadFrames * frameBytes);
+
+		for (int64_t f = 0; f < numFrames; f++)
+		{
+			for (int i = 0; i < numStreams; i++)
+			{
+				if (files[i] == nullptr || !FileUtils::seek(files[i], f * frameBytes)
+					|| fread(frame.data(), 1, frame.size(), files[i]) != frame.size())
+					continue;
+
+				SampleKernels::interleave(sources.data(), numChannels, BLOCK_LENGTH, interleaved.data());
+			}
+
+			// the frame entering the read-ahead window, of every stream at once
+			if (scheduler != nullptr)
+				for (int i = 0; i < numStreams; i++)
+					scheduler->request(handles[i], (f + readAheadFrames) * frameBytes, frameBytes);
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (FILE* file : files)
+			if (file != nullptr)
+				fclose(file);
+
+		for (int handle : handles)
+			scheduler->removeFile(handle);
+
+		return seconds;
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-bench-streams [-c channels_per_stream] [-s seconds_of_data] [-d directory] [max_streams]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int numChannels = 64;
+	double seconds = 20.0;
+	std::string directory = ".";
+	int maxStreams = 4;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			numChannels = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			directory = argv[++i];
+		else if (argv[i][0] != '-' && atoi(argv[i]) > 0)
+			maxStreams = atoi(argv[i]);
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	const int64_t numFrames = std::max<int64_t>(1, int64_t(seconds * 30000.0) / BLOCK_LENGTH);
+	const double streamBytes = double(numFrames) * numChannels * RECORD_SIZE;
+
+	std::vector<std::string> paths;
+
+	for (int i = 0; i < maxStreams; i++)
+	{
+		paths.push_back(directory + "/oe-bench-stream" + std::to_string(i) + ".packed");
+
+		if (!writeStream(paths.back(), numChannels, numFrames))
+		{
+			fprintf(stderr, "Could not write %s\n", paths.back().c_str());
+			return 1;
+		}
+	}
+
+	bool cold = true;
+
+	printf("%d channels per stream, %lld frames (%.1f s at 30 kHz, %.0f MB) per stream\n\n",
+		numChannels, (long long) numFrames, numFrames * BLOCK_LENGTH / 30000.0, streamBytes / (1 << 20));
+	printf("%8s %16s %16s %8s %14s\n", "streams", "faults (MB/s)", "scheduled (MB/s)", "speedup", "x real time");
+
+	for (int numStreams = 1; numStreams <= maxStreams; numStreams++)
+	{
+		double times[2];
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			for (int i = 0; i < numStreams; i++)
+				cold = evict(paths[i]) && cold;
+
+			IoScheduler scheduler;
+
+			times[mode] = play(paths, numStreams, numChannels, numFrames, mode == 1 ? &scheduler : nullptr);
+		}
+
+		const double totalBytes = streamBytes * numStreams;
+		const double recordedSeconds = numFrames * BLOCK_LENGTH / 30000.0;
+
+		printf("%8d %16.1f %16.1f %7.2fx %14.1f\n", numStreams, totalBytes / times[0] / (1 << 20), totalBytes / times[1] / (1 << 20),
+			times[0] / times[1], recordedSeconds / times[1]);
+	}
+
+	if (!cold)
+		printf("\nThe files could not be dropped from the page cache, so reads were (at least partly) served from memory.\n");
+
+	for (const std::string& path : paths)
+		remove(path.c_str());
+
+	return 0;
+}
@@ -0,0 +1,800 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-check-recording
+
+	Checks the data files of an experiment, e.g. after a crash or a power loss
+	while recording. Every .continuous, .packed, .spikes and .events file listed
+	in structure.openephys is memory-mapped and scanned on its own thread:
+
+	- continuous records must end with the record marker and hold 1024 samples,
+	  the records of a packed frame must share their sample number, and sample
+	  numbers must not go backwards within a recording (gaps are only counted,
+	  since event-gated recording leaves them on purpose)
+	- spike records must keep the channel and sample counts of their electrode
+	- the recording number of every record must match the recording that
+	  structure.openephys places it in, and every recording found in the files
+	  must be listed in it, at the offset of its first record
+
+	With -r, incomplete records at the end of files are truncated, and
+	structure.openephys is rewritten (keeping the original as
+	structure.openephys.bak) with any missing RECORDING elements regenerated from
+	the previous recording, and positions moved to the first record of each
+	recording. Everything else is only reported.
+
+	Usage: oe-check-recording [-r] [-t threads] structure.openephys
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Definitions.h"
+#include "FileUtils.h"
+#include "SampleKernels.h"
+#include "StructureFile.h"
+#include "WorkerPool.h"
+
+namespace
+{
+	const uint8_t recordMarker[RECORD_MARKER_SIZE] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 255 };
+
+	const int64_t eventSize = 16;
+	const int64_t spikeHeaderSize = 42;
+
+	/** Problems reported for each check of a file */
+	const int maxReportedOffsets = 5;
+
+	enum FileKind
+	{
+		CONTINUOUS_FILE,
+		SPIKES_FILE,
+		EVENTS_FILE
+	};
+
+	/** Records that failed one check: how many, and where the first ones are */
+	struct Finding
+	{
+		int64_t count = 0;
+		std::vector<int64_t> offsets;
+
+		void add(int64_t offset)
+		{
+			if (count++ < maxReportedOffsets)
+				offsets.push_back(offset);
+		}
+	};
+
+	/** A data file listed in structure.openephys, and what the scan found in it */
+	struct DataFile
+	{
+		std::string filename;
+		FileKind kind;
+
+		int recordsPerFrame = 1;
+		int spikeChannels = 0;
+		int spikeSamples = 0;
+
+		/** Position of each recording (RECORDING number) given by structure.openephys */
+		std::map<int, int64_t> positions;
+
+		bool readable = false;
+		int64_t size = 0;
+		int64_t firstRecord = HEADER_SIZE;
+		int64_t numRecords = 0;
+
+		/** End of the last complete record; everything after it can be truncated if 'tornTail' is set */
+		int64_t validEnd = HEADER_SIZE;
+		bool tornTail = false;
+
+		/** Offset of the first record of each recording (RECORDING number) */
+		std::map<int, int64_t> firstOffsets;
+
+		Finding badHeader;
+		Finding badMarkers;
+		Finding badCounts;
+		Finding badFrames;
+		Finding backwards;
+		Finding wrongRecording;
+		Finding lostFraming;
+
+		int64_t numGaps = 0;
+		int64_t skippedSamples = 0;
+
+		int64_t getRecordSize() const
+		{
+			if (kind == CONTINUOUS_FILE)
+				return RECORD_SIZE;
+
+			if (kind == EVENTS_FILE)
+				return eventSize;
+
+			return spikeHeaderSize + 2 * int64_t(spikeSamples) * spikeChannels + 6 * int64_t(spikeChannels) + 2;
+		}
+	};
+
+	/** Follows the recording structure.openephys places each offset of a file in, as offsets increase */
+	class RecordingCursor
+	{
+	public:
+		explicit RecordingCursor(const std::map<int, int64_t>& positions)
+		{
+			for (auto& entry : positions)
+				starts.push_back({ entry.second, entry.first });
+
+			std::sort(starts.begin(), starts.end());
+		}
+
+		/** RECORDING number for a record at 'offset', or 0 if it is before all of them */
+		int getRecording(int64_t offset)
+		{
+			while (next < starts.size() && starts[next].first <= offset)
+				next++;
+
+			return next > 0 ? starts[next - 1].second : 0;
+		}
+
+		/** True if structure.openephys lists a recording with that number */
+		bool isListed(int recording) const
+		{
+			for (auto& start : starts)
+				if (start.second == recording)
+					return true;
+
+			return false;
+		}
+
+	private:
+		std::vector<std::pair<int64_t, int>> starts;
+		size_t next = 0;
+	};
+
+	bool isMarker(const uint8_t* data)
+	{
+		return memcmp(data, recordMarker, RECORD_MARKER_SIZE) == 0;
+	}
+
+	bool isAllZero(const uint8_t* data, int64_t length)
+	{
+		for (int64_t i = 0; i < length; i++)
+			if (data[i] != 0)
+				return false;
+
+		return true;
+	}
+
+	/** Checks the recording number of a record against structure.openephys */
+	void checkRecording(DataFile& file, RecordingCursor& cursor, int recording, int64_t offset)
+	{
+		if (!file.firstOffsets.count(recording))
+			file.firstOffsets[recording] = offset;
+
+		// records of recordings missing from structure.openephys are reported for the whole experiment
+		if (cursor.isListed(recording) && cursor.getRecording(offset) != recording)
+			file.wrongRecording.add(offset);
+	}
+
+	/** Scans the records (or packed frames) of a .continuous or .packed file */
+	void scanContinuous(DataFile& file, const uint8_t* data)
+	{
+		const int64_t frameSize = int64_t(RECORD_SIZE) * file.recordsPerFrame;
+		const int64_t numFrames = std::max<int64_t>(0, (file.size - file.firstRecord) / frameSize);
+
+		RecordingCursor cursor(file.positions);
+
+		int lastRecording = -1;
+		int64_t nextSample = 0;
+
+		// damaged records are only reported once a complete frame follows them; otherwise they're part of the torn tail
+		Finding pendingMarkers;
+		Finding pendingFraming;
+
+		file.validEnd = std::min(file.size, file.firstRecord);
+
+		for (int64_t frame = 0; frame < numFrames; frame++)
+		{
+			const int64_t frameOffset = file.firstRecord + frame * frameSize;
+
+			bool complete = true;
+			bool hasFrameSample = false;
+			int64_t frameSample = 0;
+			int frameRecording = 0;
+
+			for (int k = 0; k < file.recordsPerFrame; k++)
+			{
+				const int64_t offset = frameOffset + int64_t(k) * RECORD_SIZE;
+				const uint8_t* record = data + offset;
+
+				if (!isMarker(record + RECORD_SIZE - RECORD_MARKER_SIZE))
+				{
+					// the header of a record that didn't end where it should can't be trusted
+					complete = false;
+					pendingMarkers.add(offset);
+
+					// see whether the records after it are still on the grid
+					size_t marker = SampleKernels::findRecordMarker(record, size_t(file.size - offset));
+
+					if (marker < size_t(file.size - offset)
+						&& (offset + int64_t(marker) + RECORD_MARKER_SIZE - file.firstRecord) % RECORD_SIZE != 0)
+						pendingFraming.add(offset + int64_t(marker));
+
+					continue;
+				}
+
+				int64_t sampleNumber;
+				uint16_t count, recordingNumber;
+
+				memcpy(&sampleNumber, record, 8);
+				memcpy(&count, record + 8, 2);
+				memcpy(&recordingNumber, record + 10, 2);
+
+				if (count != BLOCK_LENGTH)
+					file.badCounts.add(offset);
+
+				checkRecording(file, cursor, recordingNumber + 1, offset);
+
+				if (!hasFrameSample)
+				{
+					hasFrameSample = true;
+					frameSample = sampleNumber;
+					frameRecording = recordingNumber + 1;
+				}
+				else if (sampleNumber != frameSample)
+				{
+					file.badFrames.add(offset);
+				}
+			}
+
+			if (complete)
+			{
+				file.validEnd = frameOffset + frameSize;
+
+				for (int64_t offset : pendingMarkers.offsets)
+					file.badMarkers.add(offset);
+
+				for (int64_t offset : pendingFraming.offsets)
+					file.lostFraming.add(offset);
+
+				file.badMarkers.count += pendingMarkers.count - (int64_t) pendingMarkers.offsets.size();
+				file.lostFraming.count += pendingFraming.count - (int64_t) pendingFraming.offsets.size();
+
+				pendingMarkers = Finding();
+				pendingFraming = Finding();
+			}
+
+			if (!hasFrameSample)
+				continue;
+
+			file.numRecords += file.recordsPerFrame;
+
+			if (frameRecording == lastRecording)
+			{
+				if (frameSample < nextSample)
+				{
+					file.backwards.add(frameOffset);
+				}
+				else if (frameSample > nextSample)
+				{
+					file.numGaps++;
+					file.skippedSamples += frameSample - nextSample;
+				}
+			}
+
+			lastRecording = frameRecording;
+			nextSample = frameSample + BLOCK_LENGTH;
+		}
+
+		if (file.validEnd == file.size)
+			return;
+
+		// what follows the last complete frame is a torn tail, unless records still end in it (e.g. after bytes
+		// were lost in the middle of the file), which truncating would throw away
+		const size_t tailLength = size_t(file.size - file.validEnd);
+		const size_t marker = SampleKernels::findRecordMarker(data + file.validEnd, tailLength);
+
+		if (marker == tailLength)
+		{
+			file.tornTail = true;
+		}
+		else
+		{
+			for (int64_t offset : pendingMarkers.offsets)
+				file.badMarkers.add(offset);
+
+			file.badMarkers.count += pendingMarkers.count - (int64_t) pendingMarkers.offsets.size();
+			file.lostFraming.add(file.validEnd + int64_t(marker));
+		}
+	}
+
+	/** Scans the records of an .events file */
+	void scanEvents(DataFile& file, const uint8_t* data)
+	{
+		const int64_t numEvents = std::max<int64_t>(0, (file.size - file.firstRecord) / eventSize);
+
+		int lastRecording = 0;
+
+		for (int64_t i = 0; i < numEvents; i++)
+		{
+			const int64_t offset = file.firstRecord + i * eventSize;
+
+			uint16_t recordingNumber;
+			memcpy(&recordingNumber, data + offset + 14, 2);
+
+			if (!file.firstOffsets.count(recordingNumber + 1))
+				file.firstOffsets[recordingNumber + 1] = offset;
+
+			if (recordingNumber + 1 < lastRecording)
+				file.wrongRecording.add(offset);
+
+			lastRecording = std::max(lastRecording, recordingNumber + 1);
+		}
+
+		file.numRecords = numEvents;
+		file.validEnd = file.firstRecord + numEvents * eventSize;
+		file.tornTail = file.validEnd < file.size;
+	}
+
+	/** Scans the records of a .spikes file, which must all have the electrode's channel and sample counts */
+	void scanSpikes(DataFile& file, const uint8_t* data)
+	{
+		const int64_t recordSize = file.getRecordSize();
+
+		RecordingCursor cursor(file.positions);
+		int64_t offset = file.firstRecord;
+
+		while (offset + recordSize <= file.size)
+		{
+			const uint8_t* record = data + offset;
+
+			uint16_t numChannels, numSamples, recordingNumber;
+			memcpy(&numChannels, record + 19, 2);
+			memcpy(&numSamples, record + 21, 2);
+			memcpy(&recordingNumber, record + recordSize - 2, 2);
+
+			if (numChannels != file.spikeChannels || numSamples != file.spikeSamples)
+				break;
+
+			checkRecording(file, cursor, recordingNumber + 1, offset);
+
+			file.numRecords++;
+			offset += recordSize;
+		}
+
+		file.validEnd = std::min(file.size, offset);
+
+		// spike records can't be found again once their framing is lost, so a damaged record is
+		// only a torn tail if nothing but zeros (or less than a record) follows it
+		if (file.validEnd < file.size)
+		{
+			if (file.size - file.validEnd < recordSize || isAllZero(data + file.validEnd, file.size - file.validEnd))
+				file.tornTail = true;
+			else
+				file.lostFraming.add(file.validEnd);
+		}
+	}
+
+	void scanFile(DataFile& file, const std::string& path)
+	{
+		FileUtils::MappedFile mapped;
+
+		if (!mapped.open(path))
+			return;
+
+		file.readable = true;
+		file.size = mapped.getSize();
+
+		if (file.size < HEADER_SIZE || memcmp(mapped.getData(), "header.", 7) != 0)
+			file.badHeader.add(0);
+
+		if (file.size < file.firstRecord)
+		{
+			file.validEnd = file.size;
+			return;
+		}
+
+		if (file.kind == CONTINUOUS_FILE)
+			scanContinuous(file, mapped.getData());
+		else if (file.kind == EVENTS_FILE)
+			scanEvents(file, mapped.getData());
+		else
+			scanSpikes(file, mapped.getData());
+	}
+
+	/** Adds the data files of one stream of one recording */
+	void collectFiles(XmlNode* stream, int recording, std::map<std::string, DataFile>& files)
+	{
+		for (auto& child : stream->getChildren())
+		{
+			XmlNode* element = child.get();
+			const std::string filename = element->getAttribute("filename");
+
+			if (filename.empty())
+				continue;
+
+			DataFile file;
+			file.filename = filename;
+
+			if (element->hasTagName("CHANNEL") && !element->hasAttribute("packed_index"))
+			{
+				file.kind = CONTINUOUS_FILE;
+			}
+			else if (element->hasTagName("PACKED"))
+			{
+				file.kind = CONTINUOUS_FILE;
+				file.recordsPerFrame = (int) std::max<int64_t>(1, element->getIntAttribute("num_channels", 1));
+			}
+			else if (element->hasTagName("SPIKECHANNEL"))
+			{
+				file.kind = SPIKES_FILE;
+				file.spikeChannels = (int) element->getIntAttribute("num_channels");
+				file.spikeSamples = (int) element->getIntAttribute("num_samples");
+			}
+			else if (element->hasTagName("EVENTS"))
+			{
+				file.kind = EVENTS_FILE;
+			}
+			else
+			{
+				continue;
+			}
+
+			DataFile& entry = files.insert({ filename, file }).first->second;
+
+			if (element->hasAttribute("position"))
+				entry.positions[recording] = element->getIntAttribute("position");
+		}
+	}
+
+	std::string describeOffsets(const Finding& finding)
+	{
+		std::string text;
+
+		for (int64_t offset : finding.offsets)
+			text += (text.empty() ? "" : ", ") + std::to_string(offset);
+
+		if (finding.count > (int64_t) finding.offsets.size())
+			text += ", ...";
+
+		return text;
+	}
+
+	/** Prints one check of a file, and returns the number of records that failed it */
+	int64_t report(const DataFile& file, const Finding& finding, const char* what)
+	{
+		if (finding.count > 0)
+			printf("  %s: %lld %s (at %s)\n", file.filename.c_str(), (long long) finding.count, what, describeOffsets(finding).c_str());
+
+		return finding.count;
+	}
+
+	/** Returns the position of a recording's first record in a file, or the end of its records if it has none */
+	int64_t getRecordingPosition(const DataFile& file, int recording)
+	{
+		auto first = file.firstOffsets.find(recording);
+
+		if (first != file.firstOffsets.end())
+			return first->second;
+
+		auto next = file.firstOffsets.upper_bound(recording);
+
+		return next != file.firstOffsets.end() ? next->second : file.validEnd;
+	}
+
+	/** Points every data file element of a recording at the recording's first record */
+	int updatePositions(XmlNode* recording, int number, const std::map<std::string, DataFile>& files)
+	{
+		int numChanged = 0;
+
+		for (XmlNode* stream : recording->getChildrenByName("STREAM"))
+		{
+			for (auto& child : stream->getChildren())
+			{
+				auto file = files.find(child->getAttribute("filename"));
+
+				// recordings without records of their own are left where the recorder put them
+				if (file == files.end() || !file->second.firstOffsets.count(number) || !child->hasAttribute("position"))
+					continue;
+
+				int64_t position = file->second.firstOffsets.at(number);
+
+				if (child->getIntAttribute("position") != position)
+				{
+					child->setAttribute("position", position);
+					numChanged++;
+				}
+			}
+		}
+
+		return numChanged;
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-check-recording [-r] [-t threads] structure.openephys\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string structurePath;
+	bool repair = false;
+	int numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-r")
+			repair = true;
+		else if (arg == "-t" && i + 1 < argc)
+			numThreads = std::max(1, atoi(argv[++i]));
+		else if (arg[0] != '-' && structurePath.empty())
+			structurePath = arg;
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (structurePath.empty())
+	{
+		printUsage();
+		return 2;
+	}
+
+	std::string error;
+	std::unique_ptr<XmlNode> experiment = XmlNode::parseFile(structurePath, error);
+
+	if (experiment == nullptr || !experiment->hasTagName("EXPERIMENT"))
+	{
+		fprintf(stderr, "%s: not a valid structure file (%s)\n", structurePath.c_str(), error.c_str());
+		return 1;
+	}
+
+	const std::string directory = FileUtils::getDirectory(structurePath);
+
+	std::map<std::string, DataFile> files;
+	std::set<int> listedRecordings;
+
+	for (XmlNode* recording : experiment->getChildrenByName("RECORDING"))
+	{
+		const int number = (int) recording->getIntAttribute("number");
+		listedRecordings.insert(number);
+
+		for (XmlNode* stream : recording->getChildrenByName("STREAM"))
+			collectFiles(stream, number, files);
+	}
+
+	std::vector<DataFile*> scanned;
+
+	for (auto& entry : files)
+	{
+		DataFile& file = entry.second;
+
+		if (!file.positions.empty())
+		{
+			file.firstRecord = file.positions.begin()->second;
+
+			for (auto& position : file.positions)
+				file.firstRecord = std::min(file.firstRecord, position.second);
+		}
+
+		scanned.push_back(&file);
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	WorkerPool pool(numThreads);
+
+	pool.run((int) scanned.size(), [&](int i)
+		{
+			scanFile(*scanned[i], directory + scanned[i]->filename);
+		});
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	int64_t totalBytes = 0;
+
+	for (DataFile* file : scanned)
+		totalBytes += file->size;
+
+	printf("Scanned %zu files, %.2f GB in %.2f s (%.2f GB/s, %d threads)\n", scanned.size(), totalBytes / 1e9, seconds,
+		seconds > 0 ? totalBytes / 1e9 / seconds : 0.0, pool.getNumThreads());
+
+	int64_t numProblems = 0;
+	int64_t numRepairable = 0;
+	std::set<int> missingRecordings;
+
+	for (DataFile* file : scanned)
+	{
+		if (!file->readable)
+		{
+			printf("  %s: cannot be read\n", file->filename.c_str());
+			numProblems++;
+			continue;
+		}
+
+		numProblems += report(*file, file->badHeader, "file is too short or has no header");
+		numProblems += report(*file, file->badMarkers, "records without a record marker");
+		numProblems += report(*file, file->lostFraming, "places where the record framing is lost");
+		numProblems += report(*file, file->badCounts, "records without 1024 samples");
+		numProblems += report(*file, file->badFrames, "records with a different sample number than their frame");
+		numProblems += report(*file, file->backwards, "records whose sample number goes backwards");
+		numProblems += report(*file, file->wrongRecording, "records with the wrong recording number");
+
+		if (file->tornTail)
+		{
+			printf("  %s: %lld bytes of incomplete records at the end\n", file->filename.c_str(), (long long) (file->size - file->validEnd));
+			numProblems++;
+			numRepairable++;
+		}
+
+		if (file->numGaps > 0)
+			printf("  %s: %lld gaps in sample numbers (%lld samples; expected with event-gated recording)\n",
+				file->filename.c_str(), (long long) file->numGaps, (long long) file->skippedSamples);
+
+		for (auto& first : file->firstOffsets)
+		{
+			if (!listedRecordings.count(first.first))
+			{
+				missingRecordings.insert(first.first);
+			}
+			else if (file->positions.count(first.first) && file->positions[first.first] != first.second)
+			{
+				printf("  %s: structure.openephys puts recording %d at %lld, but its first record is at %lld\n", file->filename.c_str(),
+					first.first, (long long) file->positions[first.first], (long long) first.second);
+				numProblems++;
+				numRepairable++;
+			}
+		}
+	}
+
+	for (int number : missingRecordings)
+	{
+		printf("  recording %d has records but is not listed in %s\n", number, FileUtils::getFileName(structurePath).c_str());
+		numProblems++;
+
+		// regenerating it needs another recording to copy the streams from
+		if (!listedRecordings.empty())
+			numRepairable++;
+	}
+
+	if (numProblems == 0)
+	{
+		printf("No problems found\n");
+		return 0;
+	}
+
+	printf("%lld problems found (%lld repairable with -r)\n", (long long) numProblems, (long long) numRepairable);
+
+	if (!repair || numRepairable == 0)
+		return 1;
+
+	bool failed = false;
+
+	for (DataFile* file : scanned)
+	{
+		if (!file->readable || !file->tornTail)
+			continue;
+
+		if (FileUtils::truncate(directory + file->filename, file->validEnd))
+		{
+			printf("Truncated %s to %lld bytes\n", file->filename.c_str(), (long long) file->validEnd);
+		}
+		else
+		{
+			fprintf(stderr, "cannot truncate %s\n", file->filename.c_str());
+			failed = true;
+		}
+	}
+
+	int numPositions = 0;
+
+	for (XmlNode* recording : experiment->getChildrenByName("RECORDING"))
+		numPositions += updatePositions(recording, (int) recording->getIntAttribute("number"), files);
+
+	for (int number : missingRecordings)
+	{
+		if (listedRecordings.empty())
+			break;
+
+		// the closest earlier recording has the same streams and channels, unless the signal chain changed
+		auto source = listedRecordings.lower_bound(number);
+		int sourceNumber = source == listedRecordings.begin() ? *source : *std::prev(source);
+
+		size_t index = 0;
+		XmlNode* sourceElement = nullptr;
+
+		for (auto& child : experiment->getChildren())
+		{
+			if (child->hasTagName("RECORDING") && child->getIntAttribute("number") == sourceNumber)
+				sourceElement = child.get();
+
+			if (!child->hasTagName("RECORDING") || child->getIntAttribute("number") < number)
+				index++;
+			else
+				break;
+		}
+
+		std::unique_ptr<XmlNode> copy = sourceElement->clone();
+		copy->setAttribute("number", (int64_t) number);
+
+		// summaries of the missing recording can't be located without its structure entry
+		for (XmlNode* stream : copy->getChildrenByName("STREAM"))
+			for (XmlNode* channel : stream->getChildrenByName("CHANNEL"))
+			{
+				channel->removeAttribute("summary");
+				channel->removeAttribute("summary_position");
+			}
+
+		XmlNode* inserted = experiment->insertChild(std::move(copy), index);
+
+		// every file of the copied streams gets a position, even if it has no records of this recording
+		for (XmlNode* stream : inserted->getChildrenByName("STREAM"))
+			for (auto& child : stream->getChildren())
+			{
+				auto file = files.find(child->getAttribute("filename"));
+
+				if (file != files.end() && file->second.readable && child->hasAttribute("position"))
+					child->setAttribute("position", getRecordingPosition(file->second, number));
+			}
+
+		printf("Regenerated recording %d from recording %d\n", number, sourceNumber);
+		listedRecordings.insert(number);
+	}
+
+	if (numPositions > 0 || !missingRecordings.empty())
+	{
+		const std::string backupPath = structurePath + ".bak";
+
+		if (FileUtils::exists(backupPath))
+		{
+			fprintf(stderr, "%s already exists; not rewriting %s\n", backupPath.c_str(), structurePath.c_str());
+			return 1;
+		}
+
+		if (rename(structurePath.c_str(), backupPath.c_str()) != 0 || !experiment->writeToFile(structurePath))
+		{
+			fprintf(stderr, "cannot rewrite %s\n", structurePath.c_str());
+			return 1;
+		}
+
+		if (numPositions > 0)
+			printf("Updated %d positions\n", numPositions);
+
+		printf("Rewrote %s (the original is kept as %s)\n", structurePath.c_str(), backupPath.c_str());
+	}
+
+	return failed || numProblems > numRepairable ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "FileUtils.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::string FileUtils::getDirectory(const std::string& path)
+{
+	size_t separator = path.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+}
+
+std::string FileUtils::getFileName(const std::string& path)
+{
+	size_t separator = path.find_last_of("/\\");
+	return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+bool FileUtils::exists(const std::string& path)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	return _stat64(path.c_str(), &info) == 0;
+#else
+	struct stat info;
+	return stat(path.c_str(), &info) == 0;
+#endif
+}
+
+int64_t FileUtils::getFileSize(const std::string& path)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+
+	if (_stat64(path.c_str(), &info) != 0)
+		return -1;
+#else
+	struct stat info;
+
+	if (stat(path.c_str(), &info) != 0)
+		return -1;
+#endif
+
+	return (int64_t) info.st_size;
+}
+
+bool FileUtils::seek(FILE* file, int64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+int64_t FileUtils::tell(FILE* file)
+{
+#ifdef _WIN32
+	return _ftelli64(file);
+#else
+	return (int64_t) ftello(file);
+#endif
+}
+
+bool FileUtils::truncate(const std::string& path, int64_t size)
+{
+#ifdef _WIN32
+	int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+
+	if (fd < 0)
+		return false;
+
+	bool ok = _chsize_s(fd, size) == 0;
+	_close(fd);
+	return ok;
+#else
+	return ::truncate(path.c_str(), (off_t) size) == 0;
+#endif
+}
+
+FileUtils::MappedFile::MappedFile() : data(nullptr), size(0)
+{
+#ifdef _WIN32
+	mapping = nullptr;
+#endif
+}
+
+FileUtils::MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool FileUtils::MappedFile::open(const std::string& path)
+{
+	close();
+
+	size = getFileSize(path);
+
+	if (size < 0)
+	{
+		size = 0;
+		return false;
+	}
+
+	// there's nothing to map in an empty file
+	if (size == 0)
+		return true;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+
+	if (mapping != nullptr)
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+
+	if (descriptor < 0)
+		return false;
+
+	void* address = mmap(nullptr, (size_t) size, PROT_READ, MAP_SHARED, descriptor, 0);
+	::close(descriptor);
+
+	if (address != MAP_FAILED)
+	{
+		// files are read from start to end, so the OS can read well ahead
+		madvise(address, (size_t) size, MADV_SEQUENTIAL);
+		data = static_cast<const uint8_t*>(address);
+	}
+#endif
+
+	if (data == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void FileUtils::MappedFile::close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+
+	mapping = nullptr;
+#else
+	if (data != nullptr)
+		munmap(const_cast<uint8_t*>(data), (size_t) size);
+#endif
+
+	data = nullptr;
+	size = 0;
+}
@@ -0,0 +1,93 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef FILEUTILS_H_DEFINED
+#define FILEUTILS_H_DEFINED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+/** Small portable file helpers shared by the command line tools */
+namespace FileUtils
+{
+	/** Returns the directory part of a path (including the trailing separator) */
+	std::string getDirectory(const std::string& path);
+
+	/** Returns the file name part of a path */
+	std::string getFileName(const std::string& path);
+
+	/** Returns true if the path exists */
+	bool exists(const std::string& path);
+
+	/** Returns the size of a file in bytes, or -1 if it does not exist */
+	int64_t getFileSize(const std::string& path);
+
+	/** Seeks to an absolute 64-bit offset */
+	bool seek(FILE* file, int64_t offset);
+
+	/** Returns the current 64-bit offset */
+	int64_t tell(FILE* file);
+
+	/** Truncates a file to the given size */
+	bool truncate(const std::string& path, int64_t size);
+
+	/** A read-only mapping of a whole file */
+	class MappedFile
+	{
+	public:
+
+		/** Constructor */
+		MappedFile();
+
+		/** Unmaps the file */
+		~MappedFile();
+
+		/** Maps a file, unmapping the previous one; returns false if it can't be mapped */
+		bool open(const std::string& path);
+
+		/** Unmaps the file */
+		void close();
+
+		/** First byte of the file (nullptr if it's empty or not mapped) */
+		const uint8_t* getData() const { return data; }
+
+		/** Size of the mapped file in bytes */
+		int64_t getSize() const { return size; }
+
+	private:
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const uint8_t* data;
+		int64_t size;
+
+#ifdef _WIN32
+		void* mapping;
+#endif
+	};
+}
+
+#endif
@@ -0,0 +1,515 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "StructureFile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	/** Recursive-descent parser over the whole document text */
+	class Parser
+	{
+	public:
+		Parser(const std::string& t) : text(t), pos(0) { }
+
+		std::unique_ptr<XmlNode> parseDocument(std::string& error)
+		{
+			skipMisc();
+
+			std::unique_ptr<XmlNode> root = parseElement();
+
+			if (root == nullptr)
+				error = message.empty() ? "no root element" : message;
+
+			return root;
+		}
+
+	private:
+
+		bool startsWith(const char* s) const
+		{
+			return text.compare(pos, strlen(s), s) == 0;
+		}
+
+		void skipWhitespace()
+		{
+			while (pos < text.size() && isspace((unsigned char) text[pos]))
+				pos++;
+		}
+
+		/** Skips whitespace, declarations, processing instructions and comments */
+		void skipMisc()
+		{
+			for (;;)
+			{
+				skipWhitespace();
+
+				if (startsWith("<?"))
+					skipPast("?>");
+				else if (startsWith("<!--"))
+					skipPast("-->");
+				else if (startsWith("<!"))
+					skipPast(">");
+				else
+					return;
+			}
+		}
+
+		void skipPast(const char* terminator)
+		{
+			size_t end = text.find(terminator, pos);
+			pos = (end == std::string::npos) ? text.size() : end + strlen(terminator);
+		}
+
+		std::string parseName()
+		{
+			size_t start = pos;
+
+			while (pos < text.size() && (isalnum((unsigned char) text[pos]) || strchr("_-.:", text[pos]) != nullptr))
+				pos++;
+
+			return text.substr(start, pos - start);
+		}
+
+		static std::string decode(const std::string& s)
+		{
+			std::string out;
+			out.reserve(s.size());
+
+			for (size_t i = 0; i < s.size(); i++)
+			{
+				if (s[i] != '&')
+				{
+					out += s[i];
+					continue;
+				}
+
+				size_t end = s.find(';', i);
+
+				if (end == std::string::npos)
+				{
+					out += s[i];
+					continue;
+				}
+
+				std::string entity = s.substr(i + 1, end - i - 1);
+
+				if (entity == "amp") out += '&';
+				else if (entity == "lt") out += '<';
+				else if (entity == "gt") out += '>';
+				else if (entity == "quot") out += '"';
+				else if (entity == "apos") out += '\'';
+				else if (!entity.empty() && entity[0] == '#')
+				{
+					long code = (entity.size() > 1 && (entity[1] == 'x' || entity[1] == 'X'))
+						? strtol(entity.c_str() + 2, nullptr, 16)
+						: strtol(entity.c_str() + 1, nullptr, 10);
+
+					// structure files only contain ASCII, anything else is kept as UTF-8
+					if (code < 0x80)
+						out += (char) code;
+					else if (code < 0x800)
+					{
+						out += (char) (0xc0 | (code >> 6));
+						out += (char) (0x80 | (code & 0x3f));
+					}
+					else
+					{
+						out += (char) (0xe0 | (code >> 12));
+						out += (char) (0x80 | ((code >> 6) & 0x3f));
+						out += (char) (0x80 | (code & 0x3f));
+					}
+				}
+				else
+				{
+					out += s.substr(i, end - i + 1);
+				}
+
+				i = end;
+			}
+
+			return out;
+		}
+
+		std::unique_ptr<XmlNode> parseElement()
+		{
+			if (pos >= text.size() || text[pos] != '<')
+			{
+				message = "expected an element at offset " + std::to_string(pos);
+				return nullptr;
+			}
+
+			pos++;
+
+			std::unique_ptr<XmlNode> node(new XmlNode(parseName()));
+
+			if (node->getTagName().empty())
+			{
+				message = "missing tag name at offset " + std::to_string(pos);
+				return nullptr;
+			}
+
+			// attributes
+			for (;;)
+			{
+				skipWhitespace();
+
+				if (pos >= text.size())
+				{
+					message = "unterminated element <" + node->getTagName() + ">";
+					return nullptr;
+				}
+
+				if (startsWith("/>"))
+				{
+					pos += 2;
+					return node;
+				}
+
+				if (text[pos] == '>')
+				{
+					pos++;
+					break;
+				}
+
+				std::string name = parseName();
+				skipWhitespace();
+
+				if (name.empty() || pos >= text.size() || text[pos] != '=')
+				{
+					message = "malformed attribute in <" + node->getTagName() + ">";
+					return nullptr;
+				}
+
+				pos++;
+				skipWhitespace();
+
+				char quote = pos < text.size() ? text[pos] : 0;
+
+				if (quote != '"' && quote != '\'')
+				{
+					message = "unquoted attribute value in <" + node->getTagName() + ">";
+					return nullptr;
+				}
+
+				size_t end = text.find(quote, pos + 1);
+
+				if (end == std::string::npos)
+				{
+					message = "unterminated attribute value in <" + node->getTagName() + ">";
+					return nullptr;
+				}
+
+				node->setAttribute(name, decode(text.substr(pos + 1, end - pos - 1)));
+				pos = end + 1;
+			}
+
+			// children, until the matching end tag
+			for (;;)
+			{
+				while (pos < text.size() && text[pos] != '<')
+					pos++;
+
+				if (pos >= text.size())
+				{
+					message = "missing end tag for <" + node->getTagName() + ">";
+					return nullptr;
+				}
+
+				if (startsWith("</"))
+				{
+					pos += 2;
+					std::string name = parseName();
+					skipPast(">");
+
+					if (name != node->getTagName())
+					{
+						message = "mismatched end tag </" + name + "> for <" + node->getTagName() + ">";
+						return nullptr;
+					}
+
+					return node;
+				}
+
+				if (startsWith("<!--") || startsWith("<?") || startsWith("<!"))
+				{
+					skipMisc();
+					continue;
+				}
+
+				std::unique_ptr<XmlNode> child = parseElement();
+
+				if (child == nullptr)
+					return nullptr;
+
+				node->addChild(std::move(child));
+			}
+		}
+
+		const std::string& text;
+		size_t pos;
+		std::string message;
+	};
+
+	std::string escape(const std::string& s)
+	{
+		std::string out;
+		out.reserve(s.size());
+
+		for (char c : s)
+		{
+			switch (c)
+			{
+			case '&': out += "&amp;"; break;
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			case '"': out += "&quot;"; break;
+			case '\n': out += "&#10;"; break;
+			case '\r': out += "&#13;"; break;
+			default: out += c; break;
+			}
+		}
+
+		return out;
+	}
+}
+
+bool XmlNode::hasAttribute(const std::string& name) const
+{
+	for (auto& attribute : attributes)
+		if (attribute.first == name)
+			return true;
+
+	return false;
+}
+
+std::string XmlNode::getAttribute(const std::string& name, const std::string& defaultValue) const
+{
+	for (auto& attribute : attributes)
+		if (attribute.first == name)
+			return attribute.second;
+
+	return defaultValue;
+}
+
+int64_t XmlNode::getIntAttribute(const std::string& name, int64_t defaultValue) const
+{
+	if (!hasAttribute(name))
+		return defaultValue;
+
+	return (int64_t) strtod(getAttribute(name).c_str(), nullptr);
+}
+
+double XmlNode::getDoubleAttribute(const std::string& name, double defaultValue) const
+{
+	if (!hasAttribute(name))
+		return defaultValue;
+
+	return strtod(getAttribute(name).c_str(), nullptr);
+}
+
+void XmlNode::setAttribute(const std::string& name, const std::string& value)
+{
+	for (auto& attribute : attributes)
+	{
+		if (attribute.first == name)
+		{
+			attribute.second = value;
+			return;
+		}
+	}
+
+	attributes.emplace_back(name, value);
+}
+
+void XmlNode::setAttribute(const std::string& name, int64_t value)
+{
+	setAttribute(name, std::to_string(value));
+}
+
+void XmlNode::removeAttribute(const std::string& name)
+{
+	attributes.erase(std::remove_if(attributes.begin(), attributes.end(),
+		[&name](const std::pair<std::string, std::string>& a) { return a.first == name; }),
+		attributes.end());
+}
+
+std::unique_ptr<XmlNode> XmlNode::clone() const
+{
+	std::unique_ptr<XmlNode> copy(new XmlNode(tagName));
+	copy->attributes = attributes;
+
+	for (const auto& child : children)
+		copy->children.push_back(child->clone());
+
+	return copy;
+}
+
+XmlNode* XmlNode::addChild(std::unique_ptr<XmlNode> child)
+{
+	children.push_back(std::move(child));
+	return children.back().get();
+}
+
+XmlNode* XmlNode::insertChild(std::unique_ptr<XmlNode> child, size_t index)
+{
+	index = std::min(index, children.size());
+	children.insert(children.begin() + index, std::move(child));
+	return children[index].get();
+}
+
+void XmlNode::removeChild(const XmlNode* child)
+{
+	children.erase(std::remove_if(children.begin(), children.end(),
+		[child](const std::unique_ptr<XmlNode>& c) { return c.get() == child; }),
+		children.end());
+}
+
+XmlNode* XmlNode::getChildByName(const std::string& tag) const
+{
+	for (auto& child : children)
+		if (child->hasTagName(tag))
+			return child.get();
+
+	return nullptr;
+}
+
+std::vector<XmlNode*> XmlNode::getChildrenByName(const std::string& tag) const
+{
+	std::vector<XmlNode*> result;
+
+	for (auto& child : children)
+		if (child->hasTagName(tag))
+			result.push_back(child.get());
+
+	return result;
+}
+
+std::unique_ptr<XmlNode> XmlNode::parse(const std::string& text, std::string& error)
+{
+	Parser parser(text);
+	return parser.parseDocument(error);
+}
+
+std::unique_ptr<XmlNode> XmlNode::parseFile(const std::string& path, std::string& error)
+{
+	std::ifstream in(path, std::ios::binary);
+
+	if (!in)
+	{
+		error = "cannot open " + path;
+		return nullptr;
+	}
+
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+
+	return parse(buffer.str(), error);
+}
+
+void XmlNode::write(std::string& out, int indent) const
+{
+	out.append(indent, ' ');
+	out += "<" + tagName;
+
+	for (auto& attribute : attributes)
+		out += " " + attribute.first + "=\"" + escape(attribute.second) + "\"";
+
+	if (children.empty())
+	{
+		out += "/>\n";
+		return;
+	}
+
+	out += ">\n";
+
+	for (auto& child : children)
+		child->write(out, indent + 2);
+
+	out.append(indent, ' ');
+	out += "</" + tagName + ">\n";
+}
+
+std::string XmlNode::toDocument() const
+{
+	std::string out = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n";
+	write(out, 0);
+	return out;
+}
+
+bool XmlNode::writeToFile(const std::string& path) const
+{
+	std::string document = toDocument();
+
+	// write next to the destination first, so a failure never leaves a truncated file behind
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+
+	if (file == nullptr)
+		return false;
+
+	bool ok = fwrite(document.data(), 1, document.size(), file) == document.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	remove(path.c_str());
+	return rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+std::string StructureFile::sanitizeName(const std::string& name)
+{
+	std::string out;
+
+	for (char c : name)
+	{
+		if (c == ' ')
+			continue;
+
+		out += (c == '_') ? '-' : c;
+	}
+
+	return out;
+}
+
+std::string StructureFile::getContinuousFileName(int sourceNodeId, const std::string& streamName,
+	const std::string& channelName, int experimentNumber)
+{
+	std::string filename = std::to_string(sourceNodeId) + "_" + sanitizeName(streamName) + "_" + sanitizeName(channelName);
+
+	if (experimentNumber > 1)
+		filename += "_" + std::to_string(experimentNumber);
+
+	return filename + ".continuous";
+}
@@ -0,0 +1,128 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STRUCTUREFILE_H_DEFINED
+#define STRUCTUREFILE_H_DEFINED
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+	A minimal XML element tree for reading and rewriting structure.openephys
+	files outside of the GUI.
+
+	Only what the Open Ephys format uses is supported: nested elements with
+	attributes, the XML declaration and comments. Text content is ignored.
+*/
+class XmlNode
+{
+public:
+
+	/** Constructor */
+	explicit XmlNode(const std::string& tag) : tagName(tag) { }
+
+	/** Returns the element's tag name */
+	const std::string& getTagName() const { return tagName; }
+
+	/** Returns true if the element has the given tag name */
+	bool hasTagName(const std::string& tag) const { return tagName == tag; }
+
+	/** Returns true if the element has the given attribute */
+	bool hasAttribute(const std::string& name) const;
+
+	/** Returns an attribute value, or defaultValue if the attribute does not exist */
+	std::string getAttribute(const std::string& name, const std::string& defaultValue = std::string()) const;
+
+	/** Returns an attribute as an integer (positions are written as doubles, so these are accepted too) */
+	int64_t getIntAttribute(const std::string& name, int64_t defaultValue = 0) const;
+
+	/** Returns an attribute as a double */
+	double getDoubleAttribute(const std::string& name, double defaultValue = 0.0) const;
+
+	/** Adds or replaces an attribute */
+	void setAttribute(const std::string& name, const std::string& value);
+
+	/** Adds or replaces an integer attribute */
+	void setAttribute(const std::string& name, int64_t value);
+
+	/** Removes an attribute, if it exists */
+	void removeAttribute(const std::string& name);
+
+	/** Adds a child element and returns it */
+	XmlNode* addChild(std::unique_ptr<XmlNode> child);
+
+	/** Inserts a child element before the one at 'index' (or at the end) and returns it */
+	XmlNode* insertChild(std::unique_ptr<XmlNode> child, size_t index);
+
+	/** Removes (and deletes) a child element */
+	void removeChild(const XmlNode* child);
+
+	/** Returns the first child with the given tag name, or nullptr */
+	XmlNode* getChildByName(const std::string& tag) const;
+
+	/** Returns all children with the given tag name, in document order */
+	std::vector<XmlNode*> getChildrenByName(const std::string& tag) const;
+
+	/** Returns all children, in document order */
+	const std::vector<std::unique_ptr<XmlNode>>& getChildren() const { return children; }
+
+	/** Returns a deep copy of the element */
+	std::unique_ptr<XmlNode> clone() const;
+
+	/** Parses a document and returns its root element, or nullptr (with a message in error) */
+	static std::unique_ptr<XmlNode> parse(const std::string& text, std::string& error);
+
+	/** Reads and parses a file, returning its root element or nullptr */
+	static std::unique_ptr<XmlNode> parseFile(const std::string& path, std::string& error);
+
+	/** Serializes the element as a complete document, in the same layout the GUI uses */
+	std::string toDocument() const;
+
+	/** Writes the element to a file as a complete document */
+	bool writeToFile(const std::string& path) const;
+
+private:
+
+	void write(std::string& out, int indent) const;
+
+	std::string tagName;
+	std::vector<std::pair<std::string, std::string>> attributes;
+	std::vector<std::unique_ptr<XmlNode>> children;
+};
+
+/** Helpers for the Open Ephys file naming scheme */
+namespace StructureFile
+{
+	/** Applies the same clean-up the record engine uses for names in file names */
+	std::string sanitizeName(const std::string& name);
+
+	/** Returns the classic per-channel .continuous file name for a channel */
+	std::string getContinuousFileName(int sourceNodeId, const std::string& streamName,
+		const std::string& channelName, int experimentNumber);
+}
+
+#endif
@@ -0,0 +1,647 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-convert
+
+	Converts the continuous data of an experiment into one interleaved matrix of
+	little-endian int16 samples (samples x channels, same scaling as the
+	.continuous files) per stream and recording, as a .npy file or a flat binary
+	.dat file.
+
+	Records are located with the same record index the File Source uses (loaded
+	from the .index file written with the data, or rebuilt from the record
+	headers), and placed by their sample numbers: samples that were never
+	written are left as zeros (holes in the output file), and records whose
+	sample numbers go backwards, or whose header doesn't match the index in one
+	channel file, are skipped (or zeroed) as the File Source does.
+
+	Conversion runs as a pipeline of blocks of records: one thread reads the
+	records of all channels, a pool of threads transposes them to samples x
+	channels and swaps their byte order, and one thread writes them with large
+	writes from page-aligned buffers (the .npy header is padded to 4096 bytes).
+	The time each stage spends working is reported, to show which one limits the
+	conversion.
+
+	Usage: oe-convert [-f npy|dat] [-o output_directory] [-s stream_name] [-t threads] structure.openephys
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Definitions.h"
+#include "FileUtils.h"
+#include "RecordIndex.h"
+#include "SampleKernels.h"
+#include "StructureFile.h"
+#include "StructureReader.h"
+#include "WorkerPool.h"
+
+namespace
+{
+	/** Bytes of records read per block (at least one record or frame) */
+	const int64_t targetBlockBytes = 8 << 20;
+
+	/** Blocks in flight between the stages */
+	const int numBlocks = 4;
+
+	/** Alignment of output buffers, and of the samples in .npy files */
+	const size_t outputAlignment = 4096;
+
+	/** One stream of one recording, and where its records are */
+	struct Conversion
+	{
+		std::string streamName;
+		int recording;
+		int numChannels;
+		bool packed;
+
+		/** Data file of each channel (a single file for packed streams) */
+		std::vector<std::string> paths;
+
+		/** Offset of each channel's records from the indexed file's (per-channel files) */
+		std::vector<int64_t> channelOffsets;
+
+		const RecordIndex* index;
+		int64_t firstEntry;
+		int64_t numEntries;
+
+		/** Output sample position of each entry's record, or -1 if it's skipped */
+		std::vector<int64_t> positions;
+
+		int64_t firstSample;
+		int64_t numSamples;
+	};
+
+	/** A run of consecutive records (or frames) going through the pipeline */
+	struct Block
+	{
+		int64_t firstEntry = 0;
+		int numRecords = 0;
+
+		/** Records as read: each channel's records in turn, or whole frames for packed streams */
+		std::vector<uint8_t> records;
+
+		/** Interleaved little-endian samples, BLOCK_LENGTH x numChannels per record */
+		int16_t* samples = nullptr;
+		std::unique_ptr<uint8_t[]> storage;
+
+		void allocate(size_t recordBytes, size_t sampleBytes)
+		{
+			records.resize(recordBytes);
+			storage.reset(new uint8_t[sampleBytes + outputAlignment]);
+
+			uintptr_t address = reinterpret_cast<uintptr_t>(storage.get());
+			samples = reinterpret_cast<int16_t*>((address + outputAlignment - 1) & ~uintptr_t(outputAlignment - 1));
+		}
+	};
+
+	/** Hands blocks from one stage to the next; nullptr marks the end of a conversion */
+	class BlockQueue
+	{
+	public:
+		void push(Block* block)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				blocks.push_back(block);
+			}
+
+			available.notify_one();
+		}
+
+		Block* pop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this] { return !blocks.empty(); });
+
+			Block* block = blocks.front();
+			blocks.pop_front();
+			return block;
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable available;
+		std::deque<Block*> blocks;
+	};
+
+	/** Time each stage spent working (not waiting for the others), and what it moved */
+	struct StageTimes
+	{
+		double read = 0.0;
+		double transpose = 0.0;
+		double write = 0.0;
+
+		int64_t bytesRead = 0;
+		int64_t bytesWritten = 0;
+
+		void add(const StageTimes& other)
+		{
+			read += other.read;
+			transpose += other.transpose;
+			write += other.write;
+			bytesRead += other.bytesRead;
+			bytesWritten += other.bytesWritten;
+		}
+	};
+
+	double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/** Returns the stream's record index, loading it or rebuilding it from the first data file as the File Source does */
+	bool loadIndex(const std::string& indexPath, const std::string& dataPath, int64_t firstPosition, int64_t recordBytes, RecordIndex& index)
+	{
+		const int64_t numRecords = std::max<int64_t>(0, (FileUtils::getFileSize(dataPath) - firstPosition) / recordBytes);
+
+		if (index.load(indexPath) && index.size() > 0 && index[0].offset <= firstPosition
+			&& index.size() >= (firstPosition - index[0].offset) / recordBytes + numRecords)
+			return true;
+
+		if (!index.build(dataPath, firstPosition, recordBytes))
+			return false;
+
+		printf("Rebuilt the record index of %s (%lld records)\n", FileUtils::getFileName(dataPath).c_str(), (long long) index.size());
+		return true;
+	}
+
+	/** Places the records of a conversion by sample number; returns false if it has none */
+	bool placeRecords(Conversion& conversion)
+	{
+		const RecordIndex& index = *conversion.index;
+
+		conversion.positions.assign((size_t) conversion.numEntries, -1);
+
+		bool any = false;
+		int64_t nextSample = 0;
+
+		for (int64_t i = 0; i < conversion.numEntries; i++)
+		{
+			const int64_t sampleNumber = index[conversion.firstEntry + i].sampleNumber;
+
+			// records whose sample numbers go backwards are skipped
+			if (any && sampleNumber < nextSample)
+				continue;
+
+			if (!any)
+				conversion.firstSample = sampleNumber;
+
+			any = true;
+			conversion.positions[(size_t) i] = sampleNumber - conversion.firstSample;
+			nextSample = sampleNumber + BLOCK_LENGTH;
+		}
+
+		conversion.numSamples = any ? nextSample - conversion.firstSample : 0;
+		return any;
+	}
+
+	std::string getNpyHeader(int64_t numSamples, int numChannels)
+	{
+		std::string header = "{'descr': '<i2', 'fortran_order': False, 'shape': (" + std::to_string(numSamples) + ", "
+			+ std::to_string(numChannels) + "), }";
+
+		// magic string, version 1.0 and header length, then the header padded with spaces to a whole page
+		std::string npy("\x93NUMPY\x01\x00", 8);
+		const size_t headerLength = outputAlignment - 10;
+
+		npy += char(headerLength & 0xff);
+		npy += char(headerLength >> 8);
+		npy += header;
+		npy.append(outputAlignment - 1 - npy.size(), ' ');
+		npy += '\n';
+
+		return npy;
+	}
+
+	/** Reads the records of each block (first stage) */
+	void readBlocks(const Conversion& conversion, int recordsPerBlock, BlockQueue& freeBlocks, BlockQueue& readBlocks,
+		StageTimes& times, std::string& error)
+	{
+		std::vector<FILE*> files;
+
+		for (const std::string& path : conversion.paths)
+		{
+			files.push_back(fopen(path.c_str(), "rb"));
+
+			if (files.back() == nullptr)
+				error = "cannot open " + path;
+			else
+				setvbuf(files.back(), nullptr, _IONBF, 0);
+		}
+
+		const int64_t recordBytes = conversion.packed ? int64_t(RECORD_SIZE) * conversion.numChannels : RECORD_SIZE;
+
+		for (int64_t entry = 0; entry < conversion.numEntries && error.empty(); entry += recordsPerBlock)
+		{
+			Block* block = freeBlocks.pop();
+
+			auto start = std::chrono::steady_clock::now();
+
+			block->firstEntry = entry;
+			block->numRecords = (int) std::min<int64_t>(recordsPerBlock, conversion.numEntries - entry);
+
+			const int64_t offset = (*conversion.index)[conversion.firstEntry + entry].offset;
+			const size_t length = size_t(block->numRecords * recordBytes);
+
+			// records are consecutive in every file, so each file is read with one request per block
+			for (size_t f = 0; f < files.size(); f++)
+			{
+				uint8_t* dest = block->records.data() + f * length;
+				size_t numRead = 0;
+
+				if (FileUtils::seek(files[f], offset + conversion.channelOffsets[f]))
+					numRead = fread(dest, 1, length, files[f]);
+
+				// whatever is missing at the end of a file reads as zeros
+				memset(dest + numRead, 0, length - numRead);
+				times.bytesRead += (int64_t) numRead;
+			}
+
+			times.read += secondsSince(start);
+			readBlocks.push(block);
+		}
+
+		for (FILE* file : files)
+			if (file != nullptr)
+				fclose(file);
+
+		readBlocks.push(nullptr);
+	}
+
+	/** Transposes each record of a block to samples x channels, in little-endian order (second stage) */
+	void transposeBlock(const Conversion& conversion, Block& block, WorkerPool& pool)
+	{
+		static const int16_t zeros[BLOCK_LENGTH] = {};
+
+		const int numChannels = conversion.numChannels;
+		const RecordIndex& index = *conversion.index;
+
+		pool.runRanges(block.numRecords, 1, 1, [&](int begin, int end)
+			{
+				std::vector<const int16_t*> sources((size_t) numChannels);
+
+				for (int k = begin; k < end; k++)
+				{
+					const int64_t entry = block.firstEntry + k;
+
+					if (conversion.positions[(size_t) entry] < 0)
+						continue;
+
+					const int64_t sampleNumber = index[conversion.firstEntry + entry].sampleNumber;
+
+					for (int j = 0; j < numChannels; j++)
+					{
+						const uint8_t* record = conversion.packed
+							? block.records.data() + (int64_t(k) * numChannels + j) * RECORD_SIZE
+							: block.records.data() + (int64_t(j) * block.numRecords + k) * RECORD_SIZE;
+
+						int64_t recordSample;
+						memcpy(&recordSample, record, sizeof(recordSample));
+
+						// a record that doesn't match the index (e.g. lost by this channel only) reads as zeros
+						sources[(size_t) j] = recordSample == sampleNumber
+							? reinterpret_cast<const int16_t*>(record + RECORD_HEADER_SIZE) : zeros;
+					}
+
+					int16_t* dest = block.samples + int64_t(k) * BLOCK_LENGTH * numChannels;
+
+					SampleKernels::interleave(sources.data(), numChannels, BLOCK_LENGTH, dest);
+					SampleKernels::swapBytes(dest, size_t(BLOCK_LENGTH) * numChannels);
+				}
+			});
+	}
+
+	/** Writes the samples of each block where their sample numbers put them (third stage) */
+	void writeBlocks(const Conversion& conversion, FILE* output, int64_t dataOffset, BlockQueue& transposedBlocks,
+		BlockQueue& freeBlocks, StageTimes& times, std::string& error)
+	{
+		const int64_t recordBytes = int64_t(BLOCK_LENGTH) * conversion.numChannels * 2;
+
+		while (Block* block = transposedBlocks.pop())
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			// records that follow each other without a gap are written together
+			for (int k = 0; k < block->numRecords && error.empty();)
+			{
+				const int64_t position = conversion.positions[size_t(block->firstEntry + k)];
+				int run = 1;
+
+				if (position < 0)
+				{
+					k++;
+					continue;
+				}
+
+				while (k + run < block->numRecords
+					&& conversion.positions[size_t(block->firstEntry + k + run)] == position + int64_t(run) * BLOCK_LENGTH)
+					run++;
+
+				const size_t length = size_t(run * recordBytes);
+
+				if (!FileUtils::seek(output, dataOffset + position * conversion.numChannels * 2)
+					|| fwrite(block->samples + int64_t(k) * BLOCK_LENGTH * conversion.numChannels, 1, length, output) != length)
+					error = "cannot write the output file";
+
+				times.bytesWritten += (int64_t) length;
+				k += run;
+			}
+
+			times.write += secondsSince(start);
+			freeBlocks.push(block);
+		}
+	}
+
+	/** Converts one stream of one recording; returns false (with a message in error) if it fails */
+	bool convert(const Conversion& conversion, const std::string& outputPath, bool npy, WorkerPool& pool, StageTimes& times, std::string& error)
+	{
+		FILE* output = fopen(outputPath.c_str(), "wb");
+
+		if (output == nullptr)
+		{
+			error = "cannot create " + outputPath;
+			return false;
+		}
+
+		setvbuf(output, nullptr, _IONBF, 0);
+
+		int64_t dataOffset = 0;
+
+		if (npy)
+		{
+			std::string header = getNpyHeader(conversion.numSamples, conversion.numChannels);
+			fwrite(header.data(), 1, header.size(), output);
+			dataOffset = (int64_t) header.size();
+		}
+
+		const int64_t recordBytes = int64_t(RECORD_SIZE) * conversion.numChannels;
+		const int recordsPerBlock = (int) std::max<int64_t>(1, targetBlockBytes / recordBytes);
+
+		std::vector<Block> blocks(numBlocks);
+		BlockQueue freeBlocks, readQueue, transposedQueue;
+
+		for (Block& block : blocks)
+		{
+			block.allocate(size_t(recordsPerBlock * recordBytes), size_t(recordsPerBlock) * BLOCK_LENGTH * conversion.numChannels * 2);
+			freeBlocks.push(&block);
+		}
+
+		std::string readError, writeError;
+		StageTimes readTimes, writeTimes;
+
+		std::thread reader([&] { readBlocks(conversion, recordsPerBlock, freeBlocks, readQueue, readTimes, readError); });
+		std::thread writer([&] { writeBlocks(conversion, output, dataOffset, transposedQueue, freeBlocks, writeTimes, writeError); });
+
+		while (Block* block = readQueue.pop())
+		{
+			auto start = std::chrono::steady_clock::now();
+			transposeBlock(conversion, *block, pool);
+			times.transpose += secondsSince(start);
+
+			transposedQueue.push(block);
+		}
+
+		transposedQueue.push(nullptr);
+
+		reader.join();
+		writer.join();
+
+		fclose(output);
+
+		times.read += readTimes.read;
+		times.bytesRead += readTimes.bytesRead;
+		times.write += writeTimes.write;
+		times.bytesWritten += writeTimes.bytesWritten;
+
+		error = !readError.empty() ? readError : writeError;
+
+		// samples after the last record written (none unless the last records were skipped) are zeros too
+		return error.empty() && FileUtils::truncate(outputPath, dataOffset + conversion.numSamples * conversion.numChannels * 2);
+	}
+
+	double gigabytesPerSecond(int64_t bytes, double seconds)
+	{
+		return seconds > 0 ? bytes / 1e9 / seconds : 0.0;
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-convert [-f npy|dat] [-o output_directory] [-s stream_name] [-t threads] structure.openephys\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string structurePath;
+	std::string outputDirectory;
+	std::string streamFilter;
+	bool npy = true;
+	int numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-f" && i + 1 < argc && (strcmp(argv[i + 1], "npy") == 0 || strcmp(argv[i + 1], "dat") == 0))
+			npy = strcmp(argv[++i], "npy") == 0;
+		else if (arg == "-o" && i + 1 < argc)
+			outputDirectory = argv[++i];
+		else if (arg == "-s" && i + 1 < argc)
+			streamFilter = argv[++i];
+		else if (arg == "-t" && i + 1 < argc)
+			numThreads = std::max(1, atoi(argv[++i]));
+		else if (arg[0] != '-' && structurePath.empty())
+			structurePath = arg;
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (structurePath.empty())
+	{
+		printUsage();
+		return 2;
+	}
+
+	StructureTables tables;
+	std::string error;
+
+	if (!StructureReader::read(structurePath, tables, error))
+	{
+		fprintf(stderr, "%s: not a valid structure file (%s)\n", structurePath.c_str(), error.c_str());
+		return 1;
+	}
+
+	const std::string directory = FileUtils::getDirectory(structurePath);
+
+	if (outputDirectory.empty())
+		outputDirectory = directory;
+	else if (outputDirectory.back() != '/' && outputDirectory.back() != '\\')
+		outputDirectory += "/";
+
+	// Streams in the order of their recordings, which is also the order of their records in the data files
+	std::map<std::string, std::vector<std::pair<int, const StructureTables::Stream*>>> streams;
+
+	for (const StructureTables::Stream& stream : tables.streams)
+	{
+		if (stream.numChannels > 0 && (streamFilter.empty() || stream.name == streamFilter))
+			streams[stream.name].push_back({ tables.recordings[(size_t) stream.recording].number, &stream });
+	}
+
+	if (streams.empty())
+	{
+		fprintf(stderr, "%s: no continuous streams to convert\n", structurePath.c_str());
+		return 1;
+	}
+
+	WorkerPool pool(numThreads);
+	std::map<std::string, RecordIndex> indices;
+
+	StageTimes total;
+	int64_t totalOutputBytes = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	for (auto& entry : streams)
+	{
+		std::vector<std::pair<int, const StructureTables::Stream*>>& recordings = entry.second;
+		std::sort(recordings.begin(), recordings.end(),
+			[](const std::pair<int, const StructureTables::Stream*>& a, const std::pair<int, const StructureTables::Stream*>& b) { return a.first < b.first; });
+
+		auto getChannels = [&tables](const StructureTables::Stream* stream)
+		{
+			std::vector<const StructureTables::Channel*> channels;
+
+			for (int j = 0; j < stream->numChannels; j++)
+				channels.push_back(&tables.channels[size_t(stream->firstChannel + j)]);
+
+			// packed channels are stored in packed_index order
+			std::stable_sort(channels.begin(), channels.end(),
+				[](const StructureTables::Channel* a, const StructureTables::Channel* b) { return a->packedIndex < b->packedIndex; });
+
+			return channels;
+		};
+
+		const StructureTables::Stream* first = recordings.front().second;
+		const std::vector<const StructureTables::Channel*> firstChannels = getChannels(first);
+		const bool packed = first->numPackedChannels > 0;
+		const int64_t recordBytes = int64_t(RECORD_SIZE) * (packed ? first->numChannels : 1);
+
+		const std::string dataPath = directory + firstChannels[0]->filename;
+		RecordIndex& index = indices[entry.first];
+
+		if (!loadIndex(dataPath + ".index", dataPath, firstChannels[0]->position, recordBytes, index))
+		{
+			fprintf(stderr, "cannot read %s\n", dataPath.c_str());
+			return 1;
+		}
+
+		for (size_t r = 0; r < recordings.size(); r++)
+		{
+			const StructureTables::Stream* stream = recordings[r].second;
+			const std::vector<const StructureTables::Channel*> channels = getChannels(stream);
+
+			Conversion conversion;
+			conversion.streamName = stream->name;
+			conversion.recording = recordings[r].first;
+			conversion.numChannels = stream->numChannels;
+			conversion.packed = packed;
+			conversion.index = &index;
+
+			if (packed)
+			{
+				conversion.paths.push_back(directory + channels[0]->filename);
+				conversion.channelOffsets.push_back(0);
+			}
+			else
+			{
+				for (const StructureTables::Channel* channel : channels)
+				{
+					conversion.paths.push_back(directory + channel->filename);
+					conversion.channelOffsets.push_back(channel->position - channels[0]->position);
+				}
+			}
+
+			// a recording's records end where the next one's start
+			const int64_t start = channels[0]->position;
+			const int64_t end = r + 1 < recordings.size() ? getChannels(recordings[r + 1].second)[0]->position : INT64_MAX;
+
+			conversion.firstEntry = index.findOffset(start);
+			conversion.numEntries = index.findOffset(end) - conversion.firstEntry;
+
+			if (!placeRecords(conversion))
+			{
+				printf("Recording %d, stream '%s': no records\n", conversion.recording, stream->name.c_str());
+				continue;
+			}
+
+			const std::string outputPath = outputDirectory + StructureFile::sanitizeName(stream->name)
+				+ "_recording" + std::to_string(conversion.recording) + (npy ? ".npy" : ".dat");
+
+			StageTimes times;
+			auto conversionStart = std::chrono::steady_clock::now();
+
+			if (!convert(conversion, outputPath, npy, pool, times, error))
+			{
+				fprintf(stderr, "%s\n", error.empty() ? ("cannot write " + outputPath).c_str() : error.c_str());
+				return 1;
+			}
+
+			const double seconds = secondsSince(conversionStart);
+			const int64_t outputBytes = conversion.numSamples * conversion.numChannels * 2;
+
+			printf("Recording %d, stream '%s': %lld samples x %d channels from sample %lld to %s (%.2f GB/s)\n",
+				conversion.recording, stream->name.c_str(), (long long) conversion.numSamples, conversion.numChannels,
+				(long long) conversion.firstSample, FileUtils::getFileName(outputPath).c_str(), gigabytesPerSecond(outputBytes, seconds));
+
+			total.add(times);
+			totalOutputBytes += outputBytes;
+		}
+	}
+
+	const double seconds = secondsSince(startTime);
+
+	printf("\nConverted %.2f GB in %.2f s (%.2f GB/s, %d threads)\n", totalOutputBytes / 1e9, seconds,
+		gigabytesPerSecond(totalOutputBytes, seconds), pool.getNumThreads());
+	printf("%10s %10s %10s %10s\n", "stage", "busy (s)", "GB", "GB/s");
+	printf("%10s %10.2f %10.2f %10.2f\n", "read", total.read, total.bytesRead / 1e9, gigabytesPerSecond(total.bytesRead, total.read));
+	printf("%10s %10.2f %10.2f %10.2f\n", "transpose", total.transpose, total.bytesRead / 1e9, gigabytesPerSecond(total.bytesRead, total.transpose));
+	printf("%10s %10.2f %10.2f %10.2f\n", "write", total.write, total.bytesWritten / 1e9, gigabytesPerSecond(total.bytesWritten, total.write));
+
+	return 0;
+}
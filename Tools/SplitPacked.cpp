@@ -0,0 +1,391 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-split-packed
+
+	Regenerates classic per-channel .continuous (and .summary) files from the
+	packed per-stream files written by the record engine in packed mode, and
+	rewrites structure.openephys to reference them, for tools that only know
+	the one-file-per-channel layout.
+
+	Usage: oe-split-packed [-o output_directory] [-n max_open_files] structure.openephys
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Definitions.h"
+#include "RecordSummary.h"
+
+#include "FileUtils.h"
+#include "StructureFile.h"
+
+namespace
+{
+	/** Output files created by this run; existing files are never appended to */
+	std::set<std::string> createdFiles;
+
+	/** Total number of bytes copied */
+	int64_t bytesCopied = 0;
+
+	/**
+		Copies the entries of a packed file in [start, end) to one file per channel.
+
+		Packed files hold a stream header, one header per channel, then frames of
+		one fixed-size entry per channel. Each output gets its channel's header when
+		it is created; positions receives the offset at which the copied entries start.
+	*/
+	bool splitPacked(const std::string& packedPath, int numChannels, size_t entrySize,
+		int64_t start, int64_t end, const std::vector<std::string>& outputPaths, size_t maxOpenFiles,
+		std::vector<int64_t>& positions, std::string& error)
+	{
+		FILE* in = fopen(packedPath.c_str(), "rb");
+
+		if (in == nullptr)
+		{
+			error = "cannot open " + packedPath;
+			return false;
+		}
+
+		const size_t frameSize = entrySize * numChannels;
+		const int64_t numFrames = (end - start) / (int64_t) frameSize;
+		const size_t framesPerRead = std::max<size_t>(1, (8 << 20) / frameSize);
+
+		std::vector<char> header(HEADER_SIZE);
+		std::vector<char> frames(frameSize * framesPerRead);
+
+		positions.assign(numChannels, 0);
+
+		bool ok = true;
+
+		// channels are written in groups, so the number of open files stays bounded
+		for (size_t first = 0; ok && first < (size_t) numChannels; first += maxOpenFiles)
+		{
+			const size_t last = std::min((size_t) numChannels, first + maxOpenFiles);
+			std::vector<FILE*> outputs;
+
+			for (size_t k = first; k < last; k++)
+			{
+				const std::string& path = outputPaths[k];
+				int64_t size = FileUtils::getFileSize(path);
+
+				if (size >= 0 && createdFiles.count(path) == 0)
+				{
+					error = path + " already exists";
+					ok = false;
+					break;
+				}
+
+				FILE* out = fopen(path.c_str(), "ab");
+
+				if (out == nullptr)
+				{
+					error = "cannot create " + path;
+					ok = false;
+					break;
+				}
+
+				setvbuf(out, nullptr, _IOFBF, 1 << 16);
+				outputs.push_back(out);
+
+				if (size < 0)
+				{
+					createdFiles.insert(path);
+
+					if (!FileUtils::seek(in, int64_t(HEADER_SIZE) * (k + 1))
+						|| fread(header.data(), 1, HEADER_SIZE, in) != HEADER_SIZE)
+					{
+						error = "cannot read channel header " + std::to_string(k) + " of " + packedPath;
+						ok = false;
+						break;
+					}
+
+					fwrite(header.data(), 1, HEADER_SIZE, out);
+					size = HEADER_SIZE;
+				}
+
+				positions[k] = size;
+			}
+
+			if (ok && !FileUtils::seek(in, start))
+			{
+				error = "cannot seek in " + packedPath;
+				ok = false;
+			}
+
+			for (int64_t frame = 0; ok && frame < numFrames; )
+			{
+				const size_t count = (size_t) std::min<int64_t>(framesPerRead, numFrames - frame);
+
+				if (fread(frames.data(), frameSize, count, in) != count)
+				{
+					error = "unexpected end of " + packedPath;
+					ok = false;
+					break;
+				}
+
+				for (size_t i = 0; i < count; i++)
+				{
+					const char* entries = frames.data() + i * frameSize;
+
+					for (size_t k = first; k < last; k++)
+					{
+						if (fwrite(entries + k * entrySize, entrySize, 1, outputs[k - first]) != 1)
+						{
+							error = "write failed for " + outputPaths[k];
+							ok = false;
+						}
+					}
+				}
+
+				bytesCopied += (int64_t) (count * frameSize * (last - first) / numChannels);
+				frame += count;
+			}
+
+			for (FILE* out : outputs)
+			{
+				if (fclose(out) != 0)
+					ok = false;
+			}
+		}
+
+		fclose(in);
+		return ok;
+	}
+
+	/** Returns the end of the region that starts at position (the next recording's position, or the end of the file) */
+	int64_t getRegionEnd(const std::vector<int64_t>& positions, int64_t position, const std::string& path)
+	{
+		for (int64_t p : positions)
+			if (p > position)
+				return p;
+
+		return FileUtils::getFileSize(path);
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "Usage: oe-split-packed [-o output_directory] [-n max_open_files] structure.openephys\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string structurePath;
+	std::string outputDirectory;
+	size_t maxOpenFiles = 256;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-o" && i + 1 < argc)
+			outputDirectory = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			maxOpenFiles = std::max(1, atoi(argv[++i]));
+		else if (arg[0] != '-' && structurePath.empty())
+			structurePath = arg;
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (structurePath.empty())
+	{
+		printUsage();
+		return 2;
+	}
+
+	std::string error;
+	std::unique_ptr<XmlNode> experiment = XmlNode::parseFile(structurePath, error);
+
+	if (experiment == nullptr || !experiment->hasTagName("EXPERIMENT"))
+	{
+		fprintf(stderr, "%s: not a valid structure file (%s)\n", structurePath.c_str(), error.c_str());
+		return 1;
+	}
+
+	const std::string directory = FileUtils::getDirectory(structurePath);
+
+	if (outputDirectory.empty())
+		outputDirectory = directory;
+	else if (outputDirectory.back() != '/' && outputDirectory.back() != '\\')
+		outputDirectory += "/";
+
+	const int experimentNumber = (int) experiment->getIntAttribute("number", 1);
+
+	// Start positions of every recording in each packed file, to find where each one ends
+	std::map<std::string, std::vector<int64_t>> regionStarts;
+
+	for (XmlNode* recording : experiment->getChildrenByName("RECORDING"))
+	{
+		for (XmlNode* stream : recording->getChildrenByName("STREAM"))
+		{
+			XmlNode* packed = stream->getChildByName("PACKED");
+
+			if (packed == nullptr)
+				continue;
+
+			regionStarts[packed->getAttribute("filename")].push_back(packed->getIntAttribute("position"));
+
+			for (XmlNode* channel : stream->getChildrenByName("CHANNEL"))
+			{
+				if (channel->hasAttribute("summary"))
+				{
+					regionStarts[channel->getAttribute("summary")].push_back(channel->getIntAttribute("summary_position"));
+					break;
+				}
+			}
+		}
+	}
+
+	if (regionStarts.empty())
+	{
+		printf("%s does not contain any packed streams\n", structurePath.c_str());
+		return 0;
+	}
+
+	for (auto& entry : regionStarts)
+		std::sort(entry.second.begin(), entry.second.end());
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	for (XmlNode* recording : experiment->getChildrenByName("RECORDING"))
+	{
+		for (XmlNode* stream : recording->getChildrenByName("STREAM"))
+		{
+			XmlNode* packed = stream->getChildByName("PACKED");
+
+			if (packed == nullptr)
+				continue;
+
+			const std::string packedName = packed->getAttribute("filename");
+			const int numChannels = (int) packed->getIntAttribute("num_channels");
+
+			std::vector<XmlNode*> channels(numChannels, nullptr);
+
+			for (XmlNode* channel : stream->getChildrenByName("CHANNEL"))
+			{
+				int64_t slot = channel->getIntAttribute("packed_index", -1);
+
+				if (slot >= 0 && slot < numChannels)
+					channels[slot] = channel;
+			}
+
+			if (std::find(channels.begin(), channels.end(), nullptr) != channels.end())
+			{
+				fprintf(stderr, "%s: stream '%s' does not list all %d packed channels\n",
+					structurePath.c_str(), stream->getAttribute("name").c_str(), numChannels);
+				return 1;
+			}
+
+			std::vector<std::string> continuousNames;
+			std::vector<std::string> continuousPaths;
+			std::vector<std::string> summaryPaths;
+
+			for (XmlNode* channel : channels)
+			{
+				std::string name = StructureFile::getContinuousFileName((int) stream->getIntAttribute("source_node_id"),
+					stream->getAttribute("name"), channel->getAttribute("name"), experimentNumber);
+
+				continuousNames.push_back(name);
+				continuousPaths.push_back(outputDirectory + name);
+				summaryPaths.push_back(outputDirectory + name.substr(0, name.size() - strlen(".continuous")) + ".summary");
+			}
+
+			const std::string packedPath = directory + packedName;
+			const int64_t start = packed->getIntAttribute("position");
+			const int64_t end = getRegionEnd(regionStarts[packedName], start, packedPath);
+
+			std::vector<int64_t> positions;
+
+			if (!splitPacked(packedPath, numChannels, RECORD_SIZE, start, end, continuousPaths, maxOpenFiles, positions, error))
+			{
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+
+			for (int k = 0; k < numChannels; k++)
+			{
+				channels[k]->setAttribute("filename", continuousNames[k]);
+				channels[k]->setAttribute("position", positions[k]);
+				channels[k]->removeAttribute("packed_index");
+			}
+
+			if (channels[0]->hasAttribute("summary"))
+			{
+				const std::string summaryName = channels[0]->getAttribute("summary");
+				const std::string summaryPath = directory + summaryName;
+				const int64_t summaryStart = channels[0]->getIntAttribute("summary_position");
+				const int64_t summaryEnd = getRegionEnd(regionStarts[summaryName], summaryStart, summaryPath);
+
+				if (!splitPacked(summaryPath, numChannels, sizeof(RecordSummary), summaryStart, summaryEnd, summaryPaths, maxOpenFiles, positions, error))
+				{
+					fprintf(stderr, "%s\n", error.c_str());
+					return 1;
+				}
+
+				for (int k = 0; k < numChannels; k++)
+				{
+					channels[k]->setAttribute("summary", FileUtils::getFileName(summaryPaths[k]));
+					channels[k]->setAttribute("summary_position", positions[k]);
+				}
+			}
+
+			stream->removeChild(packed);
+
+			printf("Recording %s, stream '%s': %d channels\n", recording->getAttribute("number").c_str(),
+				stream->getAttribute("name").c_str(), numChannels);
+		}
+	}
+
+	const std::string structureName = FileUtils::getFileName(structurePath);
+
+	// keep the original structure file when rewriting it in place
+	if (outputDirectory == directory && !FileUtils::exists(structurePath + ".packed"))
+		rename(structurePath.c_str(), (structurePath + ".packed").c_str());
+
+	if (!experiment->writeToFile(outputDirectory + structureName))
+	{
+		fprintf(stderr, "cannot write %s%s\n", outputDirectory.c_str(), structureName.c_str());
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	printf("Wrote %zu files, %.1f MB in %.2f s (%.1f MB/s)\n", createdFiles.size(), bytesCopied / 1e6, seconds,
+		seconds > 0 ? bytesCopied / 1e6 / seconds : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,393 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-test-chunk-archive
+
+	Writes a packed stream and a stream of per-channel files through StreamWriter,
+	with a torn record at the end of one file of each, and checks that chunk
+	archives of them read back byte for byte: whole, in ranges across chunk
+	boundaries, and not at all once a chunk is damaged. When the path of oe-archive
+	is given, the files are also archived and extracted again with it, through a
+	structure file like the one the plugin writes.
+
+	Usage: oe-test-chunk-archive [work_directory [oe-archive]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ChunkArchive.h"
+#include "Definitions.h"
+#include "StreamWriter.h"
+#include "WorkerPool.h"
+
+#include "FileUtils.h"
+#include "StructureFile.h"
+
+namespace
+{
+	int numFailures = 0;
+
+	/** Reports a failed check without stopping the test */
+	bool check(bool condition, const char* text, const char* file, int line)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+			numFailures++;
+		}
+
+		return condition;
+	}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+	const int sourceNodeId = 100;
+	const int numSamples = 30 * BLOCK_LENGTH + 300;
+	const int bufferSize = 1000;
+
+	/** A data file written for the test, with the size of its records (or packed frames) */
+	struct DataFile
+	{
+		std::string filename;
+		int64_t firstRecord;
+		int64_t recordBytes;
+	};
+
+	/** Sample values that give the codec every kind of group: constant runs, full-scale
+		swings and noise of every bit width */
+	int16_t getValue(int channel, int64_t sampleNumber)
+	{
+		const int64_t phase = sampleNumber % 5000;
+
+		if (phase < 1000)
+			return int16_t(channel * 100);
+
+		if (phase < 1500)
+			return (sampleNumber & 1) ? 32767 : -32767;
+
+		const uint32_t hash = uint32_t(sampleNumber * 2654435761u) ^ uint32_t(channel * 40503u);
+		const int bits = int(sampleNumber / 64 % 16);
+
+		return int16_t(int32_t(hash >> 8) % (1 << bits) - (1 << bits) / 2);
+	}
+
+	/** Opens a file for writing, with a blank header of numHeaders * HEADER_SIZE bytes */
+	FILE* createFile(const std::string& path, int numHeaders)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+
+		if (file != nullptr)
+		{
+			const std::vector<char> header(size_t(numHeaders) * HEADER_SIZE, ' ');
+			fwrite(header.data(), 1, header.size(), file);
+		}
+
+		return file;
+	}
+
+	/** Feeds the test samples to a writer, one buffer of every channel at a time, and closes its files */
+	void feed(StreamWriter& writer)
+	{
+		std::vector<float> data(bufferSize);
+		std::vector<double> timestamps(bufferSize);
+
+		for (int64_t start = 0; start < numSamples; start += bufferSize)
+		{
+			const int size = (int) std::min<int64_t>(bufferSize, numSamples - start);
+
+			for (int i = 0; i < size; i++)
+				timestamps[i] = double(start + i) / 30000.0;
+
+			for (int c = 0; c < writer.getNumChannels(); c++)
+			{
+				for (int i = 0; i < size; i++)
+					data[i] = float(getValue(c, start + i));
+
+				writer.write(c, data.data(), timestamps.data(), start, size);
+			}
+		}
+
+		writer.finish();
+		writer.close();
+	}
+
+	/** Appends the start of one more record, as a recording that was cut off leaves it */
+	void appendTornRecord(const std::string& path, size_t numBytes)
+	{
+		std::vector<uint8_t> record(numBytes, 0x5a);
+		const int64_t sampleNumber = numSamples;
+
+		memcpy(record.data(), &sampleNumber, 8);
+
+		FILE* file = fopen(path.c_str(), "ab");
+
+		if (CHECK(file != nullptr))
+		{
+			fwrite(record.data(), 1, record.size(), file);
+			fclose(file);
+		}
+	}
+
+	/** Reads a whole file */
+	std::vector<uint8_t> readFile(const std::string& path)
+	{
+		std::vector<uint8_t> bytes;
+		FILE* file = fopen(path.c_str(), "rb");
+
+		if (file != nullptr)
+		{
+			bytes.resize((size_t) std::max<int64_t>(0, FileUtils::getFileSize(path)));
+
+			if (fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+				bytes.clear();
+
+			fclose(file);
+		}
+
+		return bytes;
+	}
+
+	/** Writes a packed stream of four channels and a stream of three per-channel files, each ending
+		with a torn record, and the structure file that lists them */
+	std::vector<DataFile> writeRecording(const std::string& directory)
+	{
+		std::vector<DataFile> files;
+
+		auto experiment = std::make_unique<XmlNode>("EXPERIMENT");
+		experiment->setAttribute("number", int64_t(1));
+
+		XmlNode* recording = experiment->addChild(std::make_unique<XmlNode>("RECORDING"));
+		recording->setAttribute("number", int64_t(1));
+
+		// packed stream
+		{
+			const int numChannels = 4;
+			const int64_t dataStart = int64_t(numChannels + 1) * HEADER_SIZE;
+
+			StreamWriter writer(numChannels);
+			writer.setPackedFiles(createFile(directory + "packed.packed", numChannels + 1),
+				createFile(directory + "packed.packed.index", 1), nullptr, dataStart);
+			feed(writer);
+
+			appendTornRecord(directory + "packed.packed", RECORD_SIZE + 700);
+			files.push_back({ "packed.packed", dataStart, int64_t(RECORD_SIZE) * numChannels });
+
+			XmlNode* stream = recording->addChild(std::make_unique<XmlNode>("STREAM"));
+			stream->setAttribute("name", std::string("Packed"));
+			stream->setAttribute("source_node_id", int64_t(sourceNodeId));
+
+			for (int c = 0; c < numChannels; c++)
+			{
+				XmlNode* channel = stream->addChild(std::make_unique<XmlNode>("CHANNEL"));
+				channel->setAttribute("name", "CH" + std::to_string(c + 1));
+				channel->setAttribute("filename", std::string("packed.packed"));
+				channel->setAttribute("position", dataStart);
+				channel->setAttribute("packed_index", int64_t(c));
+			}
+
+			XmlNode* packed = stream->addChild(std::make_unique<XmlNode>("PACKED"));
+			packed->setAttribute("filename", std::string("packed.packed"));
+			packed->setAttribute("index", std::string("packed.packed.index"));
+			packed->setAttribute("num_channels", int64_t(numChannels));
+			packed->setAttribute("position", dataStart);
+		}
+
+		// per-channel stream
+		{
+			const int numChannels = 3;
+
+			XmlNode* stream = recording->addChild(std::make_unique<XmlNode>("STREAM"));
+			stream->setAttribute("name", std::string("Plain"));
+			stream->setAttribute("source_node_id", int64_t(sourceNodeId));
+
+			StreamWriter writer(numChannels);
+
+			for (int c = 0; c < numChannels; c++)
+			{
+				const std::string name = StructureFile::getContinuousFileName(sourceNodeId, "Plain", "CH" + std::to_string(c + 1), 1);
+
+				writer.setChannelFile(c, createFile(directory + name, 1), nullptr);
+
+				if (c == 0)
+					writer.setIndexFile(createFile(directory + name + ".index", 1), HEADER_SIZE);
+
+				files.push_back({ name, HEADER_SIZE, RECORD_SIZE });
+
+				XmlNode* channel = stream->addChild(std::make_unique<XmlNode>("CHANNEL"));
+				channel->setAttribute("name", "CH" + std::to_string(c + 1));
+				channel->setAttribute("filename", name);
+				channel->setAttribute("position", int64_t(HEADER_SIZE));
+			}
+
+			feed(writer);
+
+			appendTornRecord(directory + files.back().filename, 1000);
+		}
+
+		CHECK(experiment->writeToFile(directory + "structure.openephys"));
+
+		return files;
+	}
+
+	/** Checks that a range of an archive reads back as the same range of the original */
+	void checkRange(ChunkArchive& archive, const std::vector<uint8_t>& original, int64_t offset, int64_t length, WorkerPool* pool)
+	{
+		std::vector<uint8_t> decoded((size_t) length);
+
+		if (CHECK(archive.read(offset, length, decoded.data(), pool)))
+			CHECK(memcmp(decoded.data(), &original[(size_t) offset], (size_t) length) == 0);
+	}
+
+	/** Packs a file with small chunks and reads it back whole and in pieces, then damages the archive */
+	void testArchive(const std::string& directory, const DataFile& file, WorkerPool& pool)
+	{
+		const std::string dataPath = directory + file.filename;
+		const std::string archivePath = dataPath + ".test.oea";
+		const std::vector<uint8_t> original = readFile(dataPath);
+		const int64_t size = (int64_t) original.size();
+
+		std::string error;
+
+		if (!CHECK(size > 0) || !CHECK(ChunkArchive::pack(dataPath, archivePath, file.firstRecord, file.recordBytes, 3, pool, error)))
+			return;
+
+		CHECK(ChunkArchive::readOriginalSize(archivePath) == size);
+
+		{
+			ChunkArchive archive;
+
+			if (!CHECK(archive.open(archivePath)) || !CHECK(archive.getSize() == size))
+				return;
+
+			// the headers, then chunks of three records, the last one with the torn record
+			CHECK(archive.getChunkStart(1) == file.firstRecord);
+			CHECK(archive.getNumChunks() == 1 + ((size - file.firstRecord) / file.recordBytes + 1 + 2) / 3);
+
+			checkRange(archive, original, 0, size, &pool);
+			checkRange(archive, original, 0, size, nullptr);
+
+			for (int64_t chunk = 1; chunk < archive.getNumChunks(); chunk++)
+			{
+				const int64_t start = archive.getChunkStart(chunk);
+
+				checkRange(archive, original, start - 5, std::min<int64_t>(10, size - start + 5), nullptr);
+				checkRange(archive, original, start + 11, 1, nullptr);
+			}
+
+			checkRange(archive, original, size - 100, 100, nullptr);
+			checkRange(archive, original, file.firstRecord - 1, file.recordBytes * 4 + 2, &pool);
+
+			std::vector<uint8_t> beyond(20);
+			CHECK(!archive.read(size - 10, 20, beyond.data(), nullptr));
+		}
+
+		// a flipped byte in the compressed data fails the chunk's checksum
+		std::vector<uint8_t> damaged = readFile(archivePath);
+		damaged[64 + (damaged.size() - 64) / 3] ^= 0x10;
+
+		FILE* out = fopen(archivePath.c_str(), "wb");
+
+		if (CHECK(out != nullptr))
+		{
+			fwrite(damaged.data(), 1, damaged.size(), out);
+			fclose(out);
+		}
+
+		{
+			ChunkArchive archive;
+			std::vector<uint8_t> decoded((size_t) size);
+
+			if (CHECK(archive.open(archivePath)))
+				CHECK(!archive.read(0, size, decoded.data(), &pool));
+		}
+
+		remove(archivePath.c_str());
+	}
+
+	/** Archives the recording with oe-archive, extracts it with oe-archive -x, and compares every file */
+	void testArchiveTool(const std::string& directory, const std::string& archiveTool, const std::vector<DataFile>& files)
+	{
+		std::vector<std::vector<uint8_t>> originals;
+
+		for (const DataFile& file : files)
+			originals.push_back(readFile(directory + file.filename));
+
+		const std::string structurePath = "\"" + directory + "structure.openephys\"";
+
+		if (!CHECK(system(("\"" + archiveTool + "\" -c 32 -t 2 " + structurePath).c_str()) == 0))
+			return;
+
+		for (const DataFile& file : files)
+		{
+			CHECK(!FileUtils::exists(directory + file.filename));
+			CHECK(FileUtils::exists(ChunkArchive::getArchivePath(directory + file.filename)));
+		}
+
+		if (!CHECK(system(("\"" + archiveTool + "\" -x " + structurePath).c_str()) == 0))
+			return;
+
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			CHECK(readFile(directory + files[i].filename) == originals[i]);
+			CHECK(!FileUtils::exists(ChunkArchive::getArchivePath(directory + files[i].filename)));
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = (argc > 1 ? std::string(argv[1]) : std::string("chunk-archive-test")) + "/";
+	std::string archiveTool = (argc > 2 ? std::string(argv[2]) : std::string());
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+	std::filesystem::create_directories(directory, error);
+
+	const std::vector<DataFile> files = writeRecording(directory);
+
+	WorkerPool pool(2);
+
+	for (const DataFile& file : files)
+		testArchive(directory, file, pool);
+
+	if (!archiveTool.empty())
+		testArchiveTool(directory, archiveTool, files);
+
+	if (numFailures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", numFailures);
+		return 1;
+	}
+
+	printf("All checks passed\n");
+	return 0;
+}
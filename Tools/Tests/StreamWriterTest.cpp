@@ -0,0 +1,642 @@
+/*
+	------------------------------------------------------------------
+
+	This file is part of the Open Ephys GUI
+	Copyright (C) 2022 Open Ephys
+
+	------------------------------------------------------------------
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	oe-test-stream-writer
+
+	Writes streams through StreamWriter with buffers that don't line up with
+	records, as the Record Engine receives them, in each of its modes (per-channel,
+	packed, gated and NPY), and checks every record, index entry, summary and
+	timestamp that comes out. When the path of oe-split-packed is given, the packed
+	stream is also split back into per-channel files, which are checked the same way.
+
+	Usage: oe-test-stream-writer [work_directory [oe-split-packed]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Definitions.h"
+#include "RecordIndex.h"
+#include "RecordSummary.h"
+#include "StreamWriter.h"
+
+#include "FileUtils.h"
+#include "StructureFile.h"
+
+namespace
+{
+	int numFailures = 0;
+
+	/** Reports a failed check without stopping the test */
+	bool check(bool condition, const char* text, const char* file, int line)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+			numFailures++;
+		}
+
+		return condition;
+	}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+	/** Buffer sizes fed to the writer: shorter and longer than a record, and a few records long */
+	const std::vector<int> bufferSizes = { 700, 1500, 3000, 1, 1023, 2049, 333, 4096, 517 };
+
+	const int64_t firstSampleNumber = 123456;
+	const double sampleRate = 30000.0;
+	const uint16_t recordingNumber = 2;
+
+	/** Powers of two, so that value / bitVolts is exact */
+	float getBitVolts(int channel)
+	{
+		return float(1 << (channel % 4)) * 0.25f;
+	}
+
+	/** The int16 value written for a sample of a channel */
+	int16_t getValue(int channel, int64_t sampleNumber)
+	{
+		return int16_t((sampleNumber * 37 + channel * 1009) % 20001 - 10000);
+	}
+
+	/** Total number of samples in a list of buffer sizes */
+	int64_t getNumSamples(const std::vector<int>& sizes = bufferSizes)
+	{
+		int64_t total = 0;
+
+		for (int size : sizes)
+			total += size;
+
+		return total;
+	}
+
+	/** End of the samples fed to the last writer */
+	int64_t dataEnd = 0;
+
+	/** Value expected in the files, including the zeros that pad the last record */
+	int16_t getExpected(int channel, int64_t sampleNumber)
+	{
+		return sampleNumber < dataEnd ? getValue(channel, sampleNumber) : 0;
+	}
+
+	/** Rows received by a NpyTarget */
+	struct NpyData
+	{
+		std::vector<uint8_t> bytes;
+		int64_t numRows = 0;
+	};
+
+	/** Keeps the rows of an NPY file in memory */
+	class MemoryNpyTarget : public StreamWriter::NpyTarget
+	{
+	public:
+		explicit MemoryNpyTarget(NpyData& data_) : data(data_) {}
+
+		void write(const void* rows, size_t numBytes, int numRows) override
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(rows);
+
+			data.bytes.insert(data.bytes.end(), bytes, bytes + numBytes);
+			data.numRows += numRows;
+		}
+
+	private:
+		NpyData& data;
+	};
+
+	/** Feeds every buffer to the writer, one channel after the other, then opens the
+		gate for the events that fall in that buffer, as the Record Engine does */
+	void feed(StreamWriter& writer, const std::vector<int>& sizes = bufferSizes, const std::vector<int64_t>& events = {})
+	{
+		const int numChannels = writer.getNumChannels();
+		int64_t sampleNumber = firstSampleNumber;
+
+		for (int size : sizes)
+		{
+			std::vector<float> data((size_t) size);
+			std::vector<double> timestamps((size_t) size);
+
+			for (int i = 0; i < size; i++)
+				timestamps[i] = double(sampleNumber + i) / sampleRate;
+
+			for (int c = 0; c < numChannels; c++)
+			{
+				for (int i = 0; i < size; i++)
+					data[i] = float(getValue(c, sampleNumber + i)) * getBitVolts(c);
+
+				writer.write(c, data.data(), timestamps.data(), sampleNumber, size);
+			}
+
+			for (int64_t event : events)
+			{
+				if (event >= sampleNumber && event < sampleNumber + size)
+					writer.openGate(event);
+			}
+
+			sampleNumber += size;
+		}
+
+		dataEnd = sampleNumber;
+	}
+
+	/** Opens a file for writing, with a blank header of numHeaders * HEADER_SIZE bytes */
+	FILE* createFile(const std::string& path, int numHeaders)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+
+		if (file != nullptr)
+		{
+			const std::vector<char> header(size_t(numHeaders) * HEADER_SIZE, ' ');
+			fwrite(header.data(), 1, header.size(), file);
+		}
+
+		return file;
+	}
+
+	/** Checks one record (header, samples and marker) of a channel */
+	void checkRecord(const uint8_t* record, int channel, int64_t sampleNumber)
+	{
+		int64_t recordSampleNumber;
+		uint16_t numSamples, recordRecordingNumber;
+
+		memcpy(&recordSampleNumber, record, 8);
+		memcpy(&numSamples, record + 8, 2);
+		memcpy(&recordRecordingNumber, record + 10, 2);
+
+		CHECK(recordSampleNumber == sampleNumber);
+		CHECK(numSamples == BLOCK_LENGTH);
+		CHECK(recordRecordingNumber == recordingNumber);
+
+		int wrongSamples = 0;
+
+		for (int i = 0; i < BLOCK_LENGTH; i++)
+		{
+			const uint8_t* bytes = record + RECORD_HEADER_SIZE + 2 * i;
+			int16_t value = int16_t((bytes[0] << 8) | bytes[1]);
+
+			if (value != getExpected(channel, sampleNumber + i))
+				wrongSamples++;
+		}
+
+		CHECK(wrongSamples == 0);
+
+		const uint8_t marker[RECORD_MARKER_SIZE] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 255 };
+		CHECK(memcmp(record + RECORD_SIZE - RECORD_MARKER_SIZE, marker, RECORD_MARKER_SIZE) == 0);
+	}
+
+	/** Checks the summary of one record */
+	void checkSummary(const RecordSummary& summary, int channel, int64_t sampleNumber)
+	{
+		int16_t minimum = 32767, maximum = -32768;
+		int64_t sum = 0;
+
+		for (int i = 0; i < BLOCK_LENGTH; i++)
+		{
+			int16_t value = getExpected(channel, sampleNumber + i);
+
+			minimum = std::min(minimum, value);
+			maximum = std::max(maximum, value);
+			sum += value;
+		}
+
+		CHECK(summary.sampleNumber == sampleNumber);
+		CHECK(summary.recordingNumber == recordingNumber);
+		CHECK(summary.minimum == minimum);
+		CHECK(summary.maximum == maximum);
+		CHECK(summary.sum == sum);
+	}
+
+	/** Checks the per-channel files of a stream: its records, from the given position, and their summaries */
+	void checkChannelFiles(const std::string& path, const std::string& summaryPath, int64_t position,
+		int64_t summaryPosition, int channel, const std::vector<int64_t>& recordSampleNumbers)
+	{
+		const int64_t numRecords = (int64_t) recordSampleNumbers.size();
+
+		FileUtils::MappedFile data;
+
+		if (CHECK(data.open(path)) && CHECK(data.getSize() == position + numRecords * RECORD_SIZE))
+		{
+			for (int64_t r = 0; r < numRecords; r++)
+				checkRecord(data.getData() + position + r * RECORD_SIZE, channel, recordSampleNumbers[r]);
+		}
+
+		FileUtils::MappedFile summaries;
+
+		if (CHECK(summaries.open(summaryPath))
+			&& CHECK(summaries.getSize() == summaryPosition + numRecords * int64_t(sizeof(RecordSummary))))
+		{
+			const RecordSummary* summary = reinterpret_cast<const RecordSummary*>(summaries.getData() + summaryPosition);
+
+			for (int64_t r = 0; r < numRecords; r++)
+				checkSummary(summary[r], channel, recordSampleNumbers[r]);
+		}
+	}
+
+	/** Checks the .timestamps file, which has the timestamp of the first sample of every record */
+	void checkTimestampFile(const std::string& path, const std::vector<int64_t>& recordSampleNumbers)
+	{
+		FileUtils::MappedFile timestamps;
+
+		if (CHECK(timestamps.open(path)) && CHECK(timestamps.getSize() == int64_t(recordSampleNumbers.size()) * 8))
+		{
+			const double* timestamp = reinterpret_cast<const double*>(timestamps.getData());
+
+			for (size_t r = 0; r < recordSampleNumbers.size(); r++)
+				CHECK(timestamp[r] == double(recordSampleNumbers[r]) / sampleRate);
+		}
+	}
+
+	/** Checks the NPY rows: one timestamp per sample, and the samples of every channel in native byte order */
+	void checkNpyData(const NpyData& timestamps, const NpyData& samples, int numChannels,
+		const std::vector<int64_t>& sampleNumbers)
+	{
+		const int64_t numRows = (int64_t) sampleNumbers.size();
+
+		if (CHECK(timestamps.numRows == numRows) && CHECK(timestamps.bytes.size() == size_t(numRows) * sizeof(double)))
+		{
+			const double* timestamp = reinterpret_cast<const double*>(timestamps.bytes.data());
+			int wrongTimestamps = 0;
+
+			for (int64_t r = 0; r < numRows; r++)
+			{
+				if (timestamp[r] != double(sampleNumbers[r]) / sampleRate)
+					wrongTimestamps++;
+			}
+
+			CHECK(wrongTimestamps == 0);
+		}
+
+		if (CHECK(samples.numRows == numRows) && CHECK(samples.bytes.size() == size_t(numRows) * numChannels * sizeof(int16_t)))
+		{
+			const int16_t* sample = reinterpret_cast<const int16_t*>(samples.bytes.data());
+			int wrongSamples = 0;
+
+			for (int64_t r = 0; r < numRows; r++)
+			{
+				for (int c = 0; c < numChannels; c++)
+				{
+					if (sample[r * numChannels + c] != getValue(c, sampleNumbers[r]))
+						wrongSamples++;
+				}
+			}
+
+			CHECK(wrongSamples == 0);
+		}
+	}
+
+	/** Per-channel mode with NPY output: a file per channel, an index for the stream, and the NPY rows */
+	void testPlain(const std::string& directory)
+	{
+		const int numChannels = 3;
+		const int64_t numRecords = getNumSamples() / BLOCK_LENGTH + 1;
+
+		StreamWriter writer(numChannels);
+		writer.setRecordingNumber(recordingNumber);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const std::string path = directory + "plain_CH" + std::to_string(c + 1);
+
+			writer.setBitVolts(c, getBitVolts(c));
+			writer.setChannelFile(c, createFile(path + ".continuous", 1), createFile(path + ".summary", 1));
+		}
+
+		NpyData npyTimestamps, npySamples;
+
+		writer.setIndexFile(createFile(directory + "plain.index", 1), HEADER_SIZE);
+		writer.setTimestampFile(fopen((directory + "plain.timestamps").c_str(), "wb"));
+		writer.setNpyTargets(std::make_unique<MemoryNpyTarget>(npyTimestamps), std::make_unique<MemoryNpyTarget>(npySamples));
+
+		feed(writer);
+		writer.finish();
+		writer.close();
+
+		std::vector<int64_t> recordSampleNumbers;
+
+		for (int64_t r = 0; r < numRecords; r++)
+			recordSampleNumbers.push_back(firstSampleNumber + r * BLOCK_LENGTH);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const std::string path = directory + "plain_CH" + std::to_string(c + 1);
+			checkChannelFiles(path + ".continuous", path + ".summary", HEADER_SIZE, HEADER_SIZE, c, recordSampleNumbers);
+		}
+
+		RecordIndex index;
+
+		if (CHECK(index.load(directory + "plain.index")) && CHECK(index.size() == numRecords))
+		{
+			for (int64_t r = 0; r < numRecords; r++)
+			{
+				CHECK(index[r].offset == HEADER_SIZE + r * RECORD_SIZE);
+				CHECK(index[r].sampleNumber == recordSampleNumbers[r]);
+				CHECK(index[r].recordingNumber == recordingNumber);
+			}
+		}
+
+		checkTimestampFile(directory + "plain.timestamps", recordSampleNumbers);
+
+		// the NPY files only hold the samples that were received, without the padding
+		std::vector<int64_t> sampleNumbers;
+
+		for (int64_t i = 0; i < getNumSamples(); i++)
+			sampleNumbers.push_back(firstSampleNumber + i);
+
+		checkNpyData(npyTimestamps, npySamples, numChannels, sampleNumbers);
+	}
+
+	/** Gated mode with NPY output: only the complete records that overlap a window around an event are written */
+	void testGated(const std::string& directory, const std::string& name, int numChannels, int64_t preSamples,
+		int64_t postSamples, const std::vector<int>& sizes, const std::vector<int64_t>& events, size_t numRecords)
+	{
+		const int64_t endSample = firstSampleNumber + getNumSamples(sizes);
+
+		StreamWriter writer(numChannels);
+		writer.setRecordingNumber(recordingNumber);
+		writer.setGate(preSamples, postSamples);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const std::string path = directory + name + "_CH" + std::to_string(c + 1);
+
+			writer.setBitVolts(c, getBitVolts(c));
+			writer.setChannelFile(c, createFile(path + ".continuous", 1), createFile(path + ".summary", 1));
+		}
+
+		NpyData npyTimestamps, npySamples;
+
+		writer.setIndexFile(createFile(directory + name + ".index", 1), HEADER_SIZE);
+		writer.setTimestampFile(fopen((directory + name + ".timestamps").c_str(), "wb"));
+		writer.setNpyTargets(std::make_unique<MemoryNpyTarget>(npyTimestamps), std::make_unique<MemoryNpyTarget>(npySamples));
+
+		feed(writer, sizes, events);
+		writer.finish();
+		writer.close();
+
+		// complete records that overlap at least one window
+		std::vector<int64_t> recordSampleNumbers;
+
+		for (int64_t start = firstSampleNumber; start + BLOCK_LENGTH <= endSample; start += BLOCK_LENGTH)
+		{
+			for (int64_t event : events)
+			{
+				if (start + BLOCK_LENGTH > event - preSamples && start <= event + postSamples)
+				{
+					recordSampleNumbers.push_back(start);
+					break;
+				}
+			}
+		}
+
+		CHECK(recordSampleNumbers.size() == numRecords);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const std::string path = directory + name + "_CH" + std::to_string(c + 1);
+			checkChannelFiles(path + ".continuous", path + ".summary", HEADER_SIZE, HEADER_SIZE, c, recordSampleNumbers);
+		}
+
+		RecordIndex index;
+
+		if (CHECK(index.load(directory + name + ".index")) && CHECK(index.size() == (int64_t) recordSampleNumbers.size()))
+		{
+			for (size_t r = 0; r < recordSampleNumbers.size(); r++)
+			{
+				CHECK(index[r].offset == HEADER_SIZE + int64_t(r) * RECORD_SIZE);
+				CHECK(index[r].sampleNumber == recordSampleNumbers[r]);
+			}
+		}
+
+		checkTimestampFile(directory + name + ".timestamps", recordSampleNumbers);
+
+		// the NPY files hold the written records back to back
+		std::vector<int64_t> sampleNumbers;
+
+		for (int64_t start : recordSampleNumbers)
+		{
+			for (int i = 0; i < BLOCK_LENGTH; i++)
+				sampleNumbers.push_back(start + i);
+		}
+
+		checkNpyData(npyTimestamps, npySamples, numChannels, sampleNumbers);
+	}
+
+	/** Splits the packed stream with oe-split-packed, through a structure file like the one the plugin writes */
+	void testSplitPacked(const std::string& directory, const std::string& splitTool, int numChannels, int64_t numFrames)
+	{
+		const int sourceNodeId = 100;
+		const std::string streamName = "Packed Stream";
+
+		auto experiment = std::make_unique<XmlNode>("EXPERIMENT");
+		experiment->setAttribute("number", int64_t(1));
+
+		XmlNode* recording = experiment->addChild(std::make_unique<XmlNode>("RECORDING"));
+		recording->setAttribute("number", int64_t(recordingNumber + 1));
+
+		XmlNode* stream = recording->addChild(std::make_unique<XmlNode>("STREAM"));
+		stream->setAttribute("name", streamName);
+		stream->setAttribute("source_node_id", int64_t(sourceNodeId));
+
+		const int64_t dataStart = int64_t(numChannels + 1) * HEADER_SIZE;
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			XmlNode* channel = stream->addChild(std::make_unique<XmlNode>("CHANNEL"));
+			channel->setAttribute("name", "CH" + std::to_string(c + 1));
+			channel->setAttribute("filename", std::string("packed.packed"));
+			channel->setAttribute("position", dataStart);
+			channel->setAttribute("packed_index", int64_t(c));
+			channel->setAttribute("summary", std::string("packed.packed.summary"));
+			channel->setAttribute("summary_position", dataStart);
+		}
+
+		XmlNode* packed = stream->addChild(std::make_unique<XmlNode>("PACKED"));
+		packed->setAttribute("filename", std::string("packed.packed"));
+		packed->setAttribute("index", std::string("packed.packed.index"));
+		packed->setAttribute("num_channels", int64_t(numChannels));
+		packed->setAttribute("position", dataStart);
+
+		const std::string splitDirectory = directory + "split/";
+		std::error_code error;
+		std::filesystem::remove_all(splitDirectory, error);
+		std::filesystem::create_directories(splitDirectory, error);
+
+		if (!CHECK(experiment->writeToFile(directory + "structure.openephys")))
+			return;
+
+		const std::string command = "\"" + splitTool + "\" -o \"" + splitDirectory + "\" \"" + directory + "structure.openephys\"";
+
+		if (!CHECK(system(command.c_str()) == 0))
+			return;
+
+		std::vector<int64_t> recordSampleNumbers;
+
+		for (int64_t f = 0; f < numFrames; f++)
+			recordSampleNumbers.push_back(firstSampleNumber + f * BLOCK_LENGTH);
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			std::string name = StructureFile::getContinuousFileName(sourceNodeId, streamName, "CH" + std::to_string(c + 1), 1);
+			std::string path = splitDirectory + name;
+
+			checkChannelFiles(path, path.substr(0, path.size() - strlen(".continuous")) + ".summary", HEADER_SIZE, HEADER_SIZE,
+				c, recordSampleNumbers);
+		}
+
+		std::string parseError;
+		std::unique_ptr<XmlNode> split = XmlNode::parseFile(splitDirectory + "structure.openephys", parseError);
+
+		if (CHECK(split != nullptr))
+		{
+			XmlNode* splitStream = split->getChildByName("RECORDING")->getChildByName("STREAM");
+
+			CHECK(splitStream->getChildByName("PACKED") == nullptr);
+
+			for (XmlNode* channel : splitStream->getChildrenByName("CHANNEL"))
+			{
+				CHECK(channel->getIntAttribute("position") == HEADER_SIZE);
+				CHECK(!channel->hasAttribute("packed_index"));
+			}
+		}
+	}
+
+	/** Packed mode: every frame holds the same record of every channel, in order */
+	void testPacked(const std::string& directory, const std::string& splitTool)
+	{
+		const int numChannels = 6;
+		const int64_t dataStart = int64_t(numChannels + 1) * HEADER_SIZE;
+		const std::string path = directory + "packed.packed";
+
+		StreamWriter writer(numChannels);
+		writer.setRecordingNumber(recordingNumber);
+
+		for (int c = 0; c < numChannels; c++)
+			writer.setBitVolts(c, getBitVolts(c));
+
+		writer.setPackedFiles(createFile(path, numChannels + 1),
+			createFile(path + ".index", 1),
+			createFile(path + ".summary", numChannels + 1),
+			dataStart);
+
+		writer.setTimestampFile(fopen((directory + "packed.timestamps").c_str(), "wb"));
+
+		feed(writer);
+		writer.finish();
+		writer.close();
+
+		// the last record is padded with zeros (a whole record of them if the data ends on a record boundary)
+		const int64_t numFrames = getNumSamples() / BLOCK_LENGTH + 1;
+		const int64_t frameSize = int64_t(RECORD_SIZE) * numChannels;
+
+		FileUtils::MappedFile data;
+
+		if (!CHECK(data.open(path)) || !CHECK(data.getSize() == dataStart + numFrames * frameSize))
+			return;
+
+		for (int64_t f = 0; f < numFrames; f++)
+		{
+			for (int c = 0; c < numChannels; c++)
+				checkRecord(data.getData() + dataStart + f * frameSize + c * RECORD_SIZE, c, firstSampleNumber + f * BLOCK_LENGTH);
+		}
+
+		RecordIndex index;
+
+		if (CHECK(index.load(path + ".index")) && CHECK(index.size() == numFrames))
+		{
+			for (int64_t f = 0; f < numFrames; f++)
+			{
+				CHECK(index[f].offset == dataStart + f * frameSize);
+				CHECK(index[f].sampleNumber == firstSampleNumber + f * BLOCK_LENGTH);
+				CHECK(index[f].recordingNumber == recordingNumber);
+			}
+		}
+
+		FileUtils::MappedFile summaries;
+
+		if (CHECK(summaries.open(path + ".summary"))
+			&& CHECK(summaries.getSize() == dataStart + numFrames * numChannels * int64_t(sizeof(RecordSummary))))
+		{
+			const RecordSummary* summary = reinterpret_cast<const RecordSummary*>(summaries.getData() + dataStart);
+
+			for (int64_t f = 0; f < numFrames; f++)
+			{
+				for (int c = 0; c < numChannels; c++)
+					checkSummary(summary[f * numChannels + c], c, firstSampleNumber + f * BLOCK_LENGTH);
+			}
+		}
+
+		FileUtils::MappedFile timestamps;
+
+		if (CHECK(timestamps.open(directory + "packed.timestamps")) && CHECK(timestamps.getSize() == numFrames * 8))
+		{
+			const double* timestamp = reinterpret_cast<const double*>(timestamps.getData());
+
+			for (int64_t f = 0; f < numFrames; f++)
+				CHECK(timestamp[f] == double(firstSampleNumber + f * BLOCK_LENGTH) / sampleRate);
+		}
+
+		if (!splitTool.empty())
+			testSplitPacked(directory, splitTool, numChannels, numFrames);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = (argc > 1 ? std::string(argv[1]) : std::string("stream-writer-test")) + "/";
+	std::string splitTool = (argc > 2 ? std::string(argv[2]) : std::string());
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	testPlain(directory);
+	testPacked(directory, splitTool);
+
+	// the first window reaches back past the start, the second is well after it,
+	// and the last two overlap and run past the end of the data
+	const int64_t endSample = firstSampleNumber + getNumSamples();
+
+	testGated(directory, "gated", 4, 1500, 500, bufferSizes,
+		{ firstSampleNumber + 800, firstSampleNumber + 7000, endSample - 1200, endSample - 300 }, 7);
+
+	// buffers of several records, longer than the pre-window: the event's own buffer
+	// and the post-window records of the next one have to be kept until they are written
+	testGated(directory, "gated_long", 2, 0, 5000, { 4096, 4096, 4096, 4096 }, { firstSampleNumber + 100 }, 5);
+
+	if (numFailures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", numFailures);
+		return 1;
+	}
+
+	printf("All checks passed\n");
+	return 0;
+}